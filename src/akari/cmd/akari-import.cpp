@@ -26,6 +26,8 @@
 #include <akari/core/logger.h>
 #include <akari/core/mesh.h>
 #include <akari/core/misc.h>
+#include <akari/core/image.hpp>
+#include <akari/core/texture-cache.h>
 using namespace akari;
 std::shared_ptr<Mesh> load_wavefront_obj(const fs::path &path, std::string &generated) {
     info("loading {}", fs::absolute(path).string());
@@ -199,7 +201,8 @@ std::shared_ptr<Mesh> load_wavefront_obj(const fs::path &path, std::string &gene
 
 int main(int argc, const char **argv) {
     try {
-        cxxopts::Options options("akari-import", " - Import OBJ meshes to akari scene description file");
+        cxxopts::Options options("akari-import", " - Import OBJ meshes to akari scene description file, or convert "
+                                                 "an image to a tiled texture when output ends in .akt");
         options.positional_help("input output").show_positional_help();
         {
             auto opt = options.allow_unrecognised_options().add_options();
@@ -225,6 +228,16 @@ int main(int argc, const char **argv) {
         }
         auto inputFilename = result["input"].as<std::string>();
         auto outputFilename = result["output"].as<std::string>();
+        if (fs::path(outputFilename).extension() == ".akt") {
+            // image to tiled texture
+            auto image = default_image_reader()->read(inputFilename);
+            if (!image) {
+                fatal("cannot read {}\n", inputFilename);
+                exit(1);
+            }
+            write_tiled_texture(*image, outputFilename);
+            return 0;
+        }
         auto generated = std::string();
         auto mesh = load_wavefront_obj(fs::path(inputFilename), generated);
         auto res = std::make_shared<BinaryGeometry>(mesh);
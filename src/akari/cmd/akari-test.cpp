@@ -21,6 +21,7 @@
 // SOFTWARE.
 
 #include <cstdio>
+#include <akari/core/application.h>
 #include "gtest/gtest.h"
 
 void setup() { testing::InitGoogleTest(); }
@@ -28,5 +29,7 @@ void setup() { testing::InitGoogleTest(); }
 GTEST_API_ int main(int argc, char **argv) {
     printf("Running main() from %s\n", __FILE__);
     testing::InitGoogleTest(&argc, argv);
+    // releases cached resources, and the device memory they hold, before the devices are destroyed
+    akari::Application app;
     return RUN_ALL_TESTS();
 }
\ No newline at end of file
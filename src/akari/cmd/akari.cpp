@@ -24,8 +24,13 @@
 #include <cxxopts.hpp>
 #include <akari/common/color.h>
 #include <akari/core/application.h>
+#include <akari/core/cancellation.h>
 #include <akari/core/logger.h>
+#include <akari/core/options.h>
 #include <akari/core/nodes/scene.h>
+#include <akari/core/nodes/batch.h>
+#include <akari/core/nodes/animation.h>
+#include <akari/core/nodes/distributed.h>
 #include <akari/core/nodes/scenegraph.h>
 #include <akari/core/parser.h>
 using namespace akari;
@@ -37,6 +42,13 @@ namespace pybind11 {
 #endif
 
 static std::string inputFilename;
+static std::vector<int> crop;
+static bool preview = false;
+static int jobs = 0;
+static std::vector<int> frames;
+static std::string coordinator_address, worker_address;
+static int dist_tile_size = 64;
+static int dist_tile_timeout = 600;
 std::string variant = default_variant;
 void parse(int argc, const char **argv) {
     try {
@@ -47,6 +59,25 @@ void parse(int argc, const char **argv) {
             opt("i,input", "Input Scene Description File", cxxopts::value<std::string>());
             opt("v,verbose", "Use verbose output");
             opt("gpu", "Use gpu rendering");
+            opt("crop", "Render only pixels [x0, x1) x [y0, y1)", cxxopts::value<std::vector<int>>(),
+                "x0,y0,x1,y1");
+            opt("preview", "Write 1/4 and 1/2 resolution previews before the full image");
+            opt("jobs", "Number of scenes of a batch file rendered concurrently, each on its share of the threads",
+                cxxopts::value<int>(), "N");
+            opt("frames", "Render only frames [first, last] of an animation", cxxopts::value<std::vector<int>>(),
+                "first,last");
+            opt("coordinator", "Hand out tiles to workers connecting to this TCP port or unix:<path>",
+                cxxopts::value<std::string>(), "PORT");
+            opt("worker", "Render tiles for the coordinator at <host>:<port> or unix:<path>",
+                cxxopts::value<std::string>(), "ADDRESS");
+            opt("dist-tile-size", "Size of the tiles handed out by --coordinator", cxxopts::value<int>(), "N");
+            opt("dist-tile-timeout", "Seconds a worker may spend on a tile before it goes to another (default: 600)",
+                cxxopts::value<int>(), "S");
+            opt("t,threads", "Number of render threads (default: available CPUs, or $AKARI_NUM_THREADS)",
+                cxxopts::value<int>(), "N");
+            opt("pin-threads", "Pin each render thread to its own CPU (or set $AKARI_PIN_THREADS=1)");
+            opt("texture-cache", "Memory for tiled (.akt) textures in MB (default: 1024, or $AKARI_TEXTURE_CACHE_MB)",
+                cxxopts::value<int>(), "MB");
             opt("help", "Show this help");
         }
         options.parse_positional({"input"});
@@ -69,6 +100,45 @@ void parse(int argc, const char **argv) {
             exit(0);
         }
         inputFilename = result["input"].as<std::string>();
+        if (result.count("crop")) {
+            crop = result["crop"].as<std::vector<int>>();
+            if (crop.size() != 4) {
+                fatal("--crop expects x0,y0,x1,y1");
+                exit(1);
+            }
+        }
+        preview = result.count("preview") > 0;
+        if (result.count("jobs")) {
+            jobs = result["jobs"].as<int>();
+        }
+        if (result.count("coordinator")) {
+            coordinator_address = result["coordinator"].as<std::string>();
+        }
+        if (result.count("worker")) {
+            worker_address = result["worker"].as<std::string>();
+        }
+        if (result.count("dist-tile-size")) {
+            dist_tile_size = result["dist-tile-size"].as<int>();
+        }
+        if (result.count("dist-tile-timeout")) {
+            dist_tile_timeout = std::max(result["dist-tile-timeout"].as<int>(), 1);
+        }
+        if (result.count("threads")) {
+            GlobalOptions::get()->num_threads = result["threads"].as<int>();
+        }
+        if (result.count("pin-threads")) {
+            GlobalOptions::get()->pin_threads = true;
+        }
+        if (result.count("texture-cache")) {
+            GlobalOptions::get()->texture_cache_mb = std::max(result["texture-cache"].as<int>(), 1);
+        }
+        if (result.count("frames")) {
+            frames = result["frames"].as<std::vector<int>>();
+            if (frames.size() != 2) {
+                fatal("--frames expects first,last");
+                exit(1);
+            }
+        }
     } catch (const cxxopts::OptionException &e) {
         std::cout << "error parsing options: " << e.what() << std::endl;
         exit(1);
@@ -81,12 +151,55 @@ void parse_and_run() {
     RegisterSceneGraph<C>::register_scene_graph();
     SceneGraphParser<C> parser;
     auto module = parser.parse_file(inputFilename, "this");
+    // a batch file exports a list of jobs instead of a single scene
+    if (auto batch_it = module->exports.find("batch"); batch_it != module->exports.end()) {
+        auto batch = dyn_cast<BatchNode<C>>(batch_it->second.object());
+        AKR_ASSERT_THROW(batch);
+        if (jobs > 0) {
+            batch->concurrency = jobs;
+        }
+        batch->render();
+        return;
+    }
+    if (auto animation_it = module->exports.find("animation"); animation_it != module->exports.end()) {
+        auto animation = dyn_cast<AnimationNode<C>>(animation_it->second.object());
+        AKR_ASSERT_THROW(animation);
+        if (!frames.empty()) {
+            animation->frames = int2(frames[0], frames[1]);
+        }
+        animation->render();
+        return;
+    }
     auto it = module->exports.find("scene");
     if (it == module->exports.end()) {
         fatal("variable 'scene' not found");
     }
     auto scene = dyn_cast<SceneNode<C>>(it->second.object());
     AKR_ASSERT_THROW(scene);
+    if (!crop.empty()) {
+        scene->crop = int4(crop[0], crop[1], crop[2], crop[3]);
+    }
+    if (preview) {
+        scene->preview = true;
+    }
+    if (!coordinator_address.empty()) {
+        auto listener = coordinator_address.rfind("unix:", 0) == 0
+                            ? listen_local(fs::path(coordinator_address.substr(5)))
+                            : listen(std::stoul(coordinator_address));
+        if (!listener) {
+            exit(1);
+        }
+        RenderCoordinator<C>(*scene, dist_tile_size, dist_tile_timeout).run(*listener);
+        return;
+    }
+    if (!worker_address.empty()) {
+        auto channel = connect(worker_address);
+        if (!channel) {
+            exit(1);
+        }
+        RenderWorker<C>(*scene).run(*channel);
+        return;
+    }
     scene->render();
 }
 
@@ -95,6 +208,10 @@ int main(int argc, const char **argv) {
         Application app;
         parse(argc, argv);
         AKR_INVOKE_VARIANT(variant, parse_and_run);
+        // the partial image is on disk, but tell the caller the render did not finish
+        if (auto sig = InterruptHandler::signal()) {
+            return 128 + sig;
+        }
     } catch (std::exception &e) {
         fatal("Exception: {}", e.what());
         exit(1);
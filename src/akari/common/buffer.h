@@ -65,13 +65,18 @@ namespace akari {
                 std::memcpy(data(), host_ptr, sizeof(T) * size());
             }
         }
-        Buffer(Buffer &&rhs) : allocator(std::move(rhs.allocator)) {
+        Buffer(Buffer &&rhs) : resource(rhs.resource), allocator(std::move(rhs.allocator)) {
             _data = rhs._data;
             _size = rhs._size;
             rhs._data = nullptr;
             rhs._size = 0;
         }
         Buffer &operator=(Buffer &&rhs) {
+            if (this == &rhs)
+                return *this;
+            if (_data)
+                allocator.deallocate(_data, _size);
+            resource = rhs.resource;
             _data = rhs._data;
             _size = rhs._size;
             rhs._data = nullptr;
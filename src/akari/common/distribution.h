@@ -21,9 +21,13 @@
 // SOFTWARE.
 
 #pragma once
+#include <functional>
 #include <akari/common/math.h>
 #include <akari/common/buffer.h>
 namespace akari {
+    // Calls body(begin, end) on blocks of at most grain indices covering [0, n), possibly concurrently. The tables
+    // below are built sequentially unless given one; core/parallel.h provides parallel_loop.
+    using ParallelLoop = std::function<void(size_t n, size_t grain, const std::function<void(size_t, size_t)> &body)>;
     /*
      * Return the largest index i such that
      * pred(i) is true
@@ -48,40 +52,44 @@ namespace akari {
         AKR_IMPORT_TYPES()
         template <class _C>
         friend struct Distribution2D;
-        Distribution1D(MemoryResource *resource, const Float *f, size_t n) : func(resource), cdf(resource) {
-            func.copy(f, n);
-            cdf.resize(n + 1);
-            cdf[0] = 0;
-            for (size_t i = 0; i < n; i++) {
-                cdf[i + 1] = cdf[i] + func[i] / n;
-            }
-            funcInt = cdf[n];
-            if (funcInt == 0) {
-                for (uint32_t i = 1; i < n + 1; ++i)
-                    cdf[i] = Float(i) / Float(n);
-            } else {
-                for (uint32_t i = 1; i < n + 1; ++i)
-                    cdf[i] /= funcInt;
-            }
+        // Walker's alias table entry: bin i is kept with probability p, otherwise alias is returned
+        struct AliasEntry {
+            Float p;
+            int alias;
+        };
+        // tables at least this large are normalized and summed with parallel, if given
+        static constexpr size_t ParallelThreshold = 64 * 1024;
+        Distribution1D(MemoryResource *resource, const Float *f, size_t n, const ParallelLoop &parallel = {})
+            : Distribution1D(resource, n) {
+            build(f, n >= ParallelThreshold ? parallel : ParallelLoop());
         }
         // y = F^{-1}(u)
         // P(Y <= y) = P(F^{-1}(U) <= u) = P(U <= F(u)) = F(u)
         // Assume: 0 <= i < n
-        [[nodiscard]] AKR_XPU Float pdf_discrete(int i) const { return func[i] / (funcInt * count()); }
+        [[nodiscard]] AKR_XPU Float pdf_discrete(int i) const {
+            if (funcInt == 0)
+                return Float(1.0f) / count();
+            return func[i] / (funcInt * count());
+        }
         [[nodiscard]] AKR_XPU Float pdf_continuous(Float x) const {
             uint32_t offset = std::clamp<uint32_t>(static_cast<uint32_t>(x * count()), 0, count() - 1);
+            if (funcInt == 0)
+                return Float(1.0f);
             return func[offset] / funcInt;
         }
-        AKR_XPU int sample_discrete(Float u, Float *pdf = nullptr) {
-            uint32_t i = upper_bound(0, cdf.size(), [=](int idx) { return cdf[idx] <= u; });
+        // O(1) sampling through the alias table
+        AKR_XPU int sample_discrete(Float u, Float *pdf = nullptr) const {
+            Float du;
+            int i = sample_alias(u, &du);
             if (pdf) {
                 *pdf = pdf_discrete(i);
             }
             return i;
         }
 
-        AKR_XPU Float sample_continuous(Float u, Float *pdf = nullptr, int *p_offset = nullptr) {
-            uint32_t offset = UpperBound(0, cdf.size(), [=] AKR_XPU(int idx) { return cdf[idx] <= u; });
+        // inverts the CDF; preserves the stratification of u at the cost of a binary search
+        AKR_XPU Float sample_continuous(Float u, Float *pdf = nullptr, int *p_offset = nullptr) const {
+            uint32_t offset = upper_bound(0, cdf.size(), [=] AKR_XPU(int idx) { return cdf[idx] <= u; });
             if (p_offset) {
                 *p_offset = offset;
             }
@@ -89,7 +97,19 @@ namespace akari {
             if ((cdf[offset + 1] - cdf[offset]) > 0)
                 du /= (cdf[offset + 1] - cdf[offset]);
             if (pdf)
-                *pdf = func[offset] / funcInt;
+                *pdf = pdf_continuous((offset + Float(0.5f)) / count());
+            return ((float)offset + du) / count();
+        }
+
+        // same density as sample_continuous() in O(1), but neighbouring u may land in distant bins
+        AKR_XPU Float sample_continuous_alias(Float u, Float *pdf = nullptr, int *p_offset = nullptr) const {
+            Float du;
+            int offset = sample_alias(u, &du);
+            if (p_offset) {
+                *p_offset = offset;
+            }
+            if (pdf)
+                *pdf = pdf_continuous((offset + Float(0.5f)) / count());
             return ((float)offset + du) / count();
         }
 
@@ -98,38 +118,180 @@ namespace akari {
 
       private:
         Buffer<Float> func, cdf;
-        Float funcInt;
+        Buffer<AliasEntry> alias;
+        Float funcInt = 0;
+
+        Distribution1D(MemoryResource *resource, size_t n) : func(resource), cdf(resource), alias(resource) {
+            func.resize(n);
+            cdf.resize(n + 1);
+            alias.resize(n);
+        }
+        // picks a bin and returns the remainder of u rescaled to [0, 1) in *du
+        AKR_XPU int sample_alias(Float u, Float *du) const {
+            Float x = u * count();
+            int i = std::min<int>(int(x), int(count()) - 1);
+            Float up = std::min<Float>(x - i, Float(1.0f) - std::numeric_limits<Float>::epsilon());
+            auto &entry = alias[i];
+            if (up < entry.p) {
+                *du = up / entry.p;
+                return i;
+            }
+            *du = (up - entry.p) / (Float(1.0f) - entry.p);
+            return entry.alias;
+        }
+        // sequential if parallel is empty
+        void build(const Float *f, const ParallelLoop &parallel) {
+            size_t n = count();
+            func.copy(f, n);
+            build_cdf(parallel);
+            build_alias_table(parallel);
+        }
+        void build_cdf(const ParallelLoop &parallel) {
+            size_t n = count();
+            cdf[0] = 0;
+            if (!parallel) {
+                for (size_t i = 0; i < n; i++) {
+                    cdf[i + 1] = cdf[i] + func[i] / n;
+                }
+            } else {
+                // blocked scan: sum each block, scan the block sums, then scan within blocks
+                constexpr size_t BlockSize = 4096;
+                size_t n_blocks = (n + BlockSize - 1) / BlockSize;
+                std::vector<Float> block_sums(n_blocks + 1, Float(0.0f));
+                parallel(n_blocks, 1, [&](size_t begin, size_t end) {
+                    for (size_t b = begin; b < end; b++) {
+                        Float sum = 0;
+                        for (size_t i = b * BlockSize; i < std::min(n, (b + 1) * BlockSize); i++) {
+                            sum += func[i] / n;
+                        }
+                        block_sums[b + 1] = sum;
+                    }
+                });
+                for (size_t b = 0; b < n_blocks; b++) {
+                    block_sums[b + 1] += block_sums[b];
+                }
+                parallel(n_blocks, 1, [&](size_t begin, size_t end) {
+                    for (size_t b = begin; b < end; b++) {
+                        Float sum = block_sums[b];
+                        for (size_t i = b * BlockSize; i < std::min(n, (b + 1) * BlockSize); i++) {
+                            sum += func[i] / n;
+                            cdf[i + 1] = sum;
+                        }
+                    }
+                });
+            }
+            funcInt = cdf[n];
+            auto normalize = [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    if (funcInt == 0) {
+                        cdf[i + 1] = Float(i + 1) / Float(n);
+                    } else {
+                        cdf[i + 1] /= funcInt;
+                    }
+                }
+            };
+            if (parallel) {
+                parallel(n, 1024, normalize);
+            } else {
+                normalize(0, n);
+            }
+        }
+        // Vose's method; the scaled weights are computed in parallel, the pairing pass is linear
+        void build_alias_table(const ParallelLoop &parallel) {
+            size_t n = count();
+            std::vector<double> q(n);
+            auto scale = [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    q[i] = funcInt == 0 ? 1.0 : double(func[i]) / n / funcInt * n;
+                }
+            };
+            if (parallel) {
+                parallel(n, 1024, scale);
+            } else {
+                scale(0, n);
+            }
+            std::vector<int> small, large;
+            for (size_t i = 0; i < n; i++) {
+                if (q[i] < 1.0)
+                    small.emplace_back(int(i));
+                else
+                    large.emplace_back(int(i));
+            }
+            while (!small.empty() && !large.empty()) {
+                int s = small.back();
+                small.pop_back();
+                int l = large.back();
+                large.pop_back();
+                alias[s] = AliasEntry{Float(q[s]), l};
+                q[l] = (q[l] + q[s]) - 1.0;
+                if (q[l] < 1.0)
+                    small.emplace_back(l);
+                else
+                    large.emplace_back(l);
+            }
+            // leftovers are 1 up to rounding
+            for (auto i : large) {
+                alias[i] = AliasEntry{Float(1.0f), i};
+            }
+            for (auto i : small) {
+                alias[i] = AliasEntry{Float(1.0f), i};
+            }
+        }
     };
     AKR_VARIANT
     struct Distribution2D {
+        AKR_IMPORT_TYPES()
         astd::pmr::vector<Distribution1D<C>> pConditionalV;
         astd::optional<Distribution1D<C>> pMarginal;
+        // sample rows and the marginal with their alias tables instead of inverting the CDFs
+        bool use_alias = false;
 
       public:
-        AKR_IMPORT_TYPES()
-        Distribution2D(MemoryResource *resource, const Float *data, size_t nu, size_t nv)
-            : pConditionalV(astd::pmr::polymorphic_allocator<>(resource)) {
+        // data holds nv rows of nu values; rows are built concurrently if parallel is given
+        Distribution2D(MemoryResource *resource, const Float *data, size_t nu, size_t nv, bool use_alias = false,
+                       const ParallelLoop &parallel = {})
+            : pConditionalV(astd::pmr::polymorphic_allocator<>(resource)), use_alias(use_alias) {
+            pConditionalV.reserve(nv);
             for (auto v = 0u; v < nv; v++) {
-                pConditionalV.emplace_back(resource, &data[v * nu], nu);
+                pConditionalV.emplace_back(Distribution1D<C>(resource, nu));
+            }
+            auto build_rows = [&](size_t begin, size_t end) {
+                for (size_t v = begin; v < end; v++) {
+                    pConditionalV[v].build(&data[v * nu], ParallelLoop());
+                }
+            };
+            if (parallel) {
+                parallel(nv, 1, build_rows);
+            } else {
+                build_rows(0, nv);
             }
             std::vector<Float> m;
             for (auto v = 0u; v < nv; v++) {
-                m.emplace_back(pConditionalV[v]->funcInt);
+                m.emplace_back(pConditionalV[v].funcInt);
             }
-            pMarginal.emplace(resource, &m[0], nv);
+            pMarginal.emplace(resource, &m[0], nv, parallel);
         }
+        // returns (u, v) in [0,1]^2
         AKR_XPU Float2 sample_continuous(const Float2 &u, Float *pdf) const {
             int v;
             Float pdfs[2];
-            auto d1 = pMarginal->sample_continuous(u[0], &pdfs[0], &v);
-            auto d0 = pConditionalV[v].sample_continuous(u[1], &pdfs[1]);
+            Float d1, d0;
+            if (use_alias) {
+                d1 = pMarginal->sample_continuous_alias(u[1], &pdfs[1], &v);
+                d0 = pConditionalV[v].sample_continuous_alias(u[0], &pdfs[0]);
+            } else {
+                d1 = pMarginal->sample_continuous(u[1], &pdfs[1], &v);
+                d0 = pConditionalV[v].sample_continuous(u[0], &pdfs[0]);
+            }
             *pdf = pdfs[0] * pdfs[1];
-            return vec2(d0, d1);
+            return Float2(d0, d1);
         }
         AKR_XPU Float pdf_continuous(const Float2 &p) const {
-            auto iu = clamp<int>(p[0] * pConditionalV[0].count(), 0, pConditionalV[0].count() - 1);
-            auto iv = clamp<int>(p[1] * pMarginal->count(), 0, pMarginal->count() - 1);
+            auto iu = std::clamp<int>(int(p[0] * pConditionalV[0].count()), 0, int(pConditionalV[0].count()) - 1);
+            auto iv = std::clamp<int>(int(p[1] * pMarginal->count()), 0, int(pMarginal->count()) - 1);
+            if (pMarginal->funcInt == 0)
+                return Float(1.0f);
             return pConditionalV[iv].func[iu] / pMarginal->funcInt;
         }
     };
-} // namespace akari
\ No newline at end of file
+} // namespace akari
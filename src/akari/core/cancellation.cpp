@@ -0,0 +1,69 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <csignal>
+#include <mutex>
+#include <akari/core/cancellation.h>
+
+namespace akari {
+    CancellationToken &render_cancellation() {
+        static CancellationToken token;
+        return token;
+    }
+    namespace {
+        std::mutex install_mutex;
+        int depth = 0;
+        void (*prev_sigint)(int) = SIG_DFL;
+        void (*prev_sigterm)(int) = SIG_DFL;
+        volatile std::sig_atomic_t last_signal = 0;
+
+        extern "C" void on_signal(int sig) {
+            if (last_signal != 0) {
+                std::signal(sig, SIG_DFL);
+                std::raise(sig);
+                return;
+            }
+            last_signal = sig;
+            render_cancellation().cancel();
+            // handlers are reset after one call on some platforms
+            std::signal(sig, on_signal);
+        }
+    } // namespace
+
+    InterruptHandler::InterruptHandler() {
+        std::lock_guard<std::mutex> _(install_mutex);
+        if (depth++ == 0) {
+            last_signal = 0;
+            render_cancellation().reset();
+            prev_sigint = std::signal(SIGINT, on_signal);
+            prev_sigterm = std::signal(SIGTERM, on_signal);
+        }
+    }
+    InterruptHandler::~InterruptHandler() {
+        std::lock_guard<std::mutex> _(install_mutex);
+        if (--depth == 0) {
+            std::signal(SIGINT, prev_sigint);
+            std::signal(SIGTERM, prev_sigterm);
+        }
+    }
+    int InterruptHandler::signal() { return last_signal; }
+} // namespace akari
@@ -0,0 +1,52 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <akari/common/platform.h>
+namespace akari {
+    // Asks long-running work to stop early. Nothing is interrupted: loops check the token between units of work
+    // (tiles, rows, passes), so whatever has been accumulated when they stop is consistent.
+    class CancellationToken {
+        std::atomic_bool cancelled{false};
+
+      public:
+        void cancel() { cancelled = true; }
+        void reset() { cancelled = false; }
+        [[nodiscard]] bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+    };
+    // the token the integrators check
+    AKR_EXPORT CancellationToken &render_cancellation();
+
+    // While alive, SIGINT and SIGTERM cancel render_cancellation() instead of killing the process, so a render
+    // can write out what it has. A second signal kills the process as usual. Installing one resets the token;
+    // nested handlers share the outermost one.
+    class AKR_EXPORT InterruptHandler {
+      public:
+        InterruptHandler();
+        ~InterruptHandler();
+        InterruptHandler(const InterruptHandler &) = delete;
+        InterruptHandler &operator=(const InterruptHandler &) = delete;
+        // the signal that cancelled the render, or 0
+        static int signal();
+    };
+} // namespace akari
@@ -73,15 +73,35 @@ namespace akari {
         AKR_IMPORT_TYPES()
         TImage<Spectrum> radiance;
         TImage<Float> weight;
+        // contributions of light paths, one AtomicFloat per channel so any thread can splat anywhere
+        astd::pmr::vector<AtomicFloat> splats;
+        // pixels the integrators render; the rest of the image stays black
+        Bounds2i crop_window;
 
       public:
         Float splatScale = 1.0f;
-        explicit Film(const int2 &dimension) : radiance(dimension), weight(dimension) {}
+        explicit Film(const int2 &dimension) : Film(dimension, Bounds2i{int2(0), dimension}) {}
+        Film(const int2 &dimension, const Bounds2i &crop)
+            : radiance(dimension, first_touch_resource()), weight(dimension, first_touch_resource()),
+              splats(dimension.x * dimension.y * array_size_v<Spectrum>, AtomicFloat(),
+                     astd::pmr::polymorphic_allocator<AtomicFloat>(first_touch_resource())),
+              crop_window(Bounds2i{max(crop.pmin, int2(0)), min(crop.pmax, dimension)}) {}
+        // tiles are small and created by the thread that renders them, so first touch already keeps them local
         Tile<C> tile(const Bounds2i &bounds) { return Tile<C>(bounds); }
         Box<Tile<C>> boxed_tile(const Bounds2i &bounds) { return Box<Tile<C>>::make( bounds); }
         [[nodiscard]] AKR_XPU int2 resolution() const { return radiance.resolution(); }
 
-        [[nodiscard]] AKR_XPU Bounds2i bounds() const { return Bounds2i{int2(0), resolution()}; }
+        // the crop window
+        [[nodiscard]] AKR_XPU Bounds2i bounds() const { return crop_window; }
+        // number of tiles needed to cover the crop window
+        [[nodiscard]] AKR_XPU int2 n_tiles(int tile_size) const {
+            return (crop_window.size() + int2(tile_size - 1)) / int2(tile_size);
+        }
+        // bounds of a tile, clipped to the crop window
+        [[nodiscard]] AKR_XPU Bounds2i tile_bounds(const int2 &tile_pos, int tile_size) const {
+            auto pmin = crop_window.pmin + tile_pos * tile_size;
+            return Bounds2i{pmin, min(pmin + int2(tile_size), crop_window.pmax)};
+        }
         AKR_XPU void merge_tile(const Tile<C> &tile) {
             const auto lo = max(tile.bounds.pmin, int2(0, 0));
             const auto hi = min(tile.bounds.pmax, radiance.resolution());
@@ -93,23 +113,93 @@ namespace akari {
                 }
             }
         }
+        // zeroes the pixels inside bounds, clipped to the image, and makes them the crop window; pixels outside it
+        // keep what was rendered before
+        void clear(const Bounds2i &bounds) {
+            crop_window = Bounds2i{max(bounds.pmin, int2(0)), min(bounds.pmax, resolution())};
+            for (int y = crop_window.pmin.y; y < crop_window.pmax.y; y++) {
+                for (int x = crop_window.pmin.x; x < crop_window.pmax.x; x++) {
+                    radiance(x, y) = Spectrum(0);
+                    weight(x, y) = 0;
+                    for (size_t i = 0; i < array_size_v<Spectrum>; i++) {
+                        splats[(x + y * resolution().x) * array_size_v<Spectrum> + i].set(0);
+                    }
+                }
+            }
+        }
+        // the accumulated pixels inside bounds, in the form merge_tile() takes
+        [[nodiscard]] Tile<C> extract_tile(const Bounds2i &bounds) const {
+            Tile<C> tile(bounds);
+            const auto lo = max(bounds.pmin, int2(0, 0));
+            const auto hi = min(bounds.pmax, radiance.resolution());
+            for (int y = lo.y; y < hi.y; y++) {
+                for (int x = lo.x; x < hi.x; x++) {
+                    auto &pix = tile(int2(x, y));
+                    pix.radiance = radiance(x, y);
+                    pix.weight = weight(x, y);
+                }
+            }
+            return tile;
+        }
+
+        // false until a sample or a splat reaches the film
+        [[nodiscard]] bool has_samples() const {
+            auto res = resolution();
+            for (int y = 0; y < res.y; y++) {
+                for (int x = 0; x < res.x; x++) {
+                    if (weight(x, y) != 0 || any(splat(x, y) != Spectrum(0))) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+        // adds L to the pixel containing p; scaled by splatScale when the image is written
+        void add_splat(const float2 &p, const Spectrum &L) {
+            auto q = int2(floor(p));
+            if (any(q < crop_window.pmin) || any(q >= crop_window.pmax))
+                return;
+            for (size_t i = 0; i < array_size_v<Spectrum>; i++) {
+                splats[(q.x + q.y * resolution().x) * array_size_v<Spectrum> + i].add(L[i]);
+            }
+        }
+        [[nodiscard]] Spectrum splat(int x, int y) const {
+            Spectrum L;
+            for (size_t i = 0; i < array_size_v<Spectrum>; i++) {
+                L[i] = splats[(x + y * resolution().x) * array_size_v<Spectrum> + i].value();
+            }
+            return L;
+        }
 
         void write_image(const fs::path &path, const PostProcessor &postProcessor = GammaCorrection()) const {
-            RGBAImage image(resolution());
-            parallel_for(
-                radiance.resolution().y,
-                [&](uint32_t y, uint32_t) {
-                    for (int x = 0; x < radiance.resolution().x; x++) {
+            write_image(path, resolution(), postProcessor);
+        }
+        // writes an image of the given size, scaling the film up with nearest-neighbour filtering; lets a preview
+        // rendered at a fraction of the resolution stand in for the final image
+        void write_image(const fs::path &path, const int2 &size,
+                         const PostProcessor &postProcessor = GammaCorrection()) const {
+            default_image_writer()->write(to_rgba_image(size), path, postProcessor);
+        }
+        // the linear radiance resolved into an image
+        [[nodiscard]] RGBAImage to_rgba_image() const { return to_rgba_image(resolution()); }
+        [[nodiscard]] RGBAImage to_rgba_image(const int2 &size) const {
+            RGBAImage image(size);
+            auto res = resolution();
+            parallel_for_range(0, size.y, 16, [&](Range r, uint32_t) {
+                for (int y_ = (int)r.begin; y_ < (int)r.end; y_++) {
+                    int y = std::min<int>(int64_t(y_) * res.y / size.y, res.y - 1);
+                    for (int x_ = 0; x_ < size.x; x_++) {
+                        int x = std::min<int>(int64_t(x_) * res.x / size.x, res.x - 1);
+                        auto color = radiance(x, y);
                         if (weight(x, y) != 0) {
-                            auto color = (radiance(x, y)) / weight(x, y);
-                            image(x, y) = RGBA(Color<float, 3>(color), 1);
-                        } else {
-                            image(x, y) = RGBA(Color<float, 3>(radiance(x, y)), 1);
+                            color = color / weight(x, y);
                         }
+                        color += splat(x, y) * splatScale;
+                        image(x_, y_) = RGBA(Color<float, 3>(color), 1);
                     }
-                },
-                1024);
-            default_image_writer()->write(image, path, postProcessor);
+                }
+            });
+            return image;
         }
     };
 } // namespace akari
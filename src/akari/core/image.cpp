@@ -21,6 +21,7 @@
 // SOFTWARE.
 
 #include <akari/core/image.hpp>
+#include <algorithm>
 #include <memory>
 #include <akari/core/logger.h>
 #include <akari/core/parallel.h>
@@ -42,17 +43,16 @@ namespace akari {
             auto &texels = image.texels();
             auto dimension = image.resolution();
             std::vector<uint8_t> buffer(texels.size() * 3);
-            parallel_for(
-                texels.size(),
-                [&](uint32_t i, uint32_t) {
+            parallel_for_range(0, texels.size(), 1024u, [&](Range r, uint32_t) {
+                for (auto i = r.begin; i < r.end; i++) {
                     auto pixel = static_cast<uint8_t *>(&buffer[i * 3]);
                     auto rgb = Float3(texels[i].rgb);
                     rgb = clamp(rgb, Float3(0), Float3(1));
                     for (int comp = 0; comp < 3; comp++) {
                         pixel[comp] = (uint8_t)std::clamp<int>((int)std::round(rgb[comp] * 255.5), 0, 255);
                     }
-                },
-                1024u);
+                }
+            });
             if (ext == ".png")
                 return stbi_write_png(path.string().c_str(), dimension.x, dimension.y, 3, buffer.data(), 0);
             else if (ext == ".jpg")
@@ -63,67 +63,241 @@ namespace akari {
 
     void GammaCorrection::process(const RGBAImage &in, RGBAImage &out) const {
         out.resize(in.resolution());
-        parallel_for(
-            in.resolution().y,
-            [&](uint32_t y, uint32_t) {
+        parallel_for_range(0, in.resolution().y, 16, [&](Range r, uint32_t) {
+            for (int y = (int)r.begin; y < (int)r.end; y++) {
                 for (int i = 0; i < in.resolution().x; i++)
                     out(i, y) = RGBA(linear_to_srgb(in(i, y).rgb), in(i, y).alpha);
-            },
-            1024);
+            }
+        });
     }
 
     std::shared_ptr<ImageWriter> default_image_writer() { return std::make_shared<DefaultImageWriter>(); }
 
+    AsyncImageWriter::AsyncImageWriter(size_t max_pending, std::shared_ptr<ImageWriter> writer)
+        : writer(std::move(writer)), max_pending(std::max<size_t>(max_pending, 1)) {
+        thread = std::thread([this] { run(); });
+    }
+    AsyncImageWriter::~AsyncImageWriter() {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        has_request.notify_all();
+        thread.join();
+    }
+    void AsyncImageWriter::write(RGBAImage image, const fs::path &path,
+                                 std::shared_ptr<PostProcessor> postProcessor) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (requests.size() >= max_pending) {
+            request_done.wait(lock);
+        }
+        requests.push_back(Request{std::move(image), path, std::move(postProcessor)});
+        has_request.notify_one();
+    }
+    void AsyncImageWriter::flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!requests.empty() || busy) {
+            request_done.wait(lock);
+        }
+    }
+    void AsyncImageWriter::run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            while (requests.empty() && !stopped) {
+                has_request.wait(lock);
+            }
+            if (requests.empty()) {
+                return;
+            }
+            auto request = std::move(requests.front());
+            requests.pop_front();
+            busy = true;
+            lock.unlock();
+            if (!writer->write(request.image, request.path, *request.postProcessor)) {
+                error("failed to write {}", request.path.string());
+            }
+            lock.lock();
+            busy = false;
+            request_done.notify_all();
+        }
+    }
+
     class DefaultImageReader : public ImageReader {
       public:
         AKR_IMPORT_CORE_TYPES_WITH(float)
+        // Color channels of 8 and 16 bit files are sRGB encoded; single channel files hold linear data such as
+        // roughness or masks. Radiance files are linear.
         std::shared_ptr<RGBAImage> read(const fs::path &path) override {
             info("Loading {}", path.string());
             std::shared_ptr<RGBAImage> image;
             int x, y, channel;
             auto ext = path.extension().string();
+            auto file = path.string();
             if (ext == ".hdr") {
-                const float *data = stbi_loadf(path.string().c_str(), &x, &y, &channel, 3);
-                image = std::make_shared<RGBAImage>(int2(x, y));
-                parallel_for(
-                    image->resolution().y,
-                    [=, &image](uint32_t y, uint32_t) {
-                        for (int x = 0; x < image->resolution().x; x++) {
-                            RGBSpectrum rgb;
-                            if (channel == 1) {
-                                rgb = RGBSpectrum(data[x + y * image->resolution().x]);
-                            } else {
-                                rgb[0] = data[3 * (x + y * image->resolution().x) + 0];
-                                rgb[1] = data[3 * (x + y * image->resolution().x) + 1];
-                                rgb[2] = data[3 * (x + y * image->resolution().x) + 2];
-                            }
-                            (*image)(x, y) = RGBA(rgb, 1.0f);
-                        }
-                    },
-                    128);
+                float *data = stbi_loadf(file.c_str(), &x, &y, &channel, 0);
+                if (!data) {
+                    return nullptr;
+                }
+                image = decode(data, x, y, channel, [](float v) { return v; }, [](float v) { return v; });
+                // half floats overflow past HalfMax, which bright emitters and suns easily reach
+                bool fits_half = *std::max_element(data, data + size_t(x) * y * channel) <= HalfMax;
+                image->format = channel == 1 ? TexelFormat::R32F
+                                : fits_half  ? TexelFormat::RGB16F
+                                             : TexelFormat::RGBA32F;
+                stbi_image_free(data);
+            } else if (stbi_is_16_bit(file.c_str())) {
+                stbi_us *data = stbi_load_16(file.c_str(), &x, &y, &channel, 0);
+                if (!data) {
+                    return nullptr;
+                }
+                image = decode(
+                    data, x, y, channel, [](stbi_us v) { return srgb_to_linear(float(v) / 65535.0f); },
+                    [](stbi_us v) { return float(v) / 65535.0f; });
+                image->format = channel == 1   ? TexelFormat::R16
+                                : channel == 3 ? TexelFormat::RGB16F
+                                               : TexelFormat::RGBA16F;
+                stbi_image_free(data);
             } else {
-                const auto *data = stbi_load(path.string().c_str(), &x, &y, &channel, 3);
-                image = std::make_shared<RGBAImage>(int2(x, y));
-                parallel_for(
-                    image->resolution().y,
-                    [=, &image](uint32_t y, uint32_t) {
-                        for (int x = 0; x < image->resolution().x; x++) {
-                            RGBSpectrum rgb;
-                            if (channel == 1) {
-                                rgb = RGBSpectrum((float)data[x + y * image->resolution().x] / 255.0f);
-                            } else {
-                                rgb[0] = (float)data[3 * (x + y * image->resolution().x) + 0] / 255.0f;
-                                rgb[1] = (float)data[3 * (x + y * image->resolution().x) + 1] / 255.0f;
-                                rgb[2] = (float)data[3 * (x + y * image->resolution().x) + 2] / 255.0f;
-                            }
-                            (*image)(x, y) = RGBA(rgb, 1.0f);
-                        }
-                    },
-                    128);
+                stbi_uc *data = stbi_load(file.c_str(), &x, &y, &channel, 0);
+                if (!data) {
+                    return nullptr;
+                }
+                image = decode(
+                    data, x, y, channel, [](stbi_uc v) { return srgb8_to_linear(v); },
+                    [](stbi_uc v) { return float(v) / 255.0f; });
+                image->format = channel == 1 ? TexelFormat::R8 : TexelFormat::RGBA8_SRGB;
+                stbi_image_free(data);
             }
             return image;
         }
+
+      private:
+        // expands 1 to 4 interleaved channels (gray, gray alpha, rgb, rgba) into linear RGBA
+        template <class T, class Color, class Linear>
+        static std::shared_ptr<RGBAImage> decode(const T *data, int width, int height, int channel,
+                                                 Color &&color, Linear &&linear) {
+            auto image = std::make_shared<RGBAImage>(int2(width, height));
+            parallel_for_range(0, height, 8, [&](Range r, uint32_t) {
+                for (int y = (int)r.begin; y < (int)r.end; y++) {
+                    for (int x = 0; x < width; x++) {
+                        const T *p = data + size_t(channel) * (x + size_t(y) * width);
+                        RGBSpectrum rgb;
+                        float alpha = 1.0f;
+                        if (channel <= 2) {
+                            // a single channel is data unless it carries alpha, which makes it a gray color
+                            rgb = RGBSpectrum(channel == 1 ? linear(p[0]) : color(p[0]));
+                        } else {
+                            rgb = RGBSpectrum(color(p[0]), color(p[1]), color(p[2]));
+                        }
+                        if (channel == 2 || channel == 4) {
+                            alpha = linear(p[channel - 1]);
+                        }
+                        (*image)(x, y) = RGBA(rgb, alpha);
+                    }
+                }
+            });
+            return image;
+        }
     };
 
     std::shared_ptr<ImageReader> default_image_reader() { return std::make_shared<DefaultImageReader>(); }
+    std::vector<RGBAImage> build_mip_chain(const RGBAImage &image) {
+        std::vector<RGBAImage> levels;
+        const RGBAImage *prev = &image;
+        while (prev->resolution().x > 1 || prev->resolution().y > 1) {
+            auto &src = *prev;
+            RGBAImage level(max(src.resolution() / 2, int2(1)));
+            level.format = src.format;
+            parallel_for_range(0, level.resolution().y, 16, [&](Range r, uint32_t) {
+                for (int y = (int)r.begin; y < (int)r.end; y++) {
+                    for (int x = 0; x < level.resolution().x; x++) {
+                        int sx = 2 * x, sy = 2 * y;
+                        auto &a = src(sx, sy), &b = src(sx + 1, sy), &c = src(sx, sy + 1), &d = src(sx + 1, sy + 1);
+                        level(x, y) =
+                            RGBA((a.rgb + b.rgb + c.rgb + d.rgb) * 0.25f, (a.alpha + b.alpha + c.alpha + d.alpha) * 0.25f);
+                    }
+                }
+            });
+            levels.emplace_back(std::move(level));
+            prev = &levels.back();
+        }
+        return levels;
+    }
+
+    PackedImage::PackedImage(const RGBAImage &image, TexelFormat format)
+        : _format(format), _resolution(image.resolution()) {
+        auto &texels = image.texels();
+        _bytes.resize(texels.size() * texel_size(format));
+        parallel_for_range(0, texels.size(), 4096u, [&](Range r, uint32_t) {
+            auto *u16 = reinterpret_cast<uint16_t *>(_bytes.data());
+            for (auto i = r.begin; i < r.end; i++) {
+                auto &t = texels[i];
+                switch (format) {
+                case TexelFormat::RGBA8_SRGB:
+                    for (int c = 0; c < 3; c++) {
+                        _bytes[4 * i + c] = linear_to_srgb8(t.rgb[c]);
+                    }
+                    _bytes[4 * i + 3] = uint8_t(std::lround(std::clamp(t.alpha, 0.0f, 1.0f) * 255.0f));
+                    break;
+                case TexelFormat::RGB16F:
+                    for (int c = 0; c < 3; c++) {
+                        u16[3 * i + c] = float_to_half(std::min(t.rgb[c], 65504.0f));
+                    }
+                    break;
+                case TexelFormat::RGBA16F:
+                    for (int c = 0; c < 3; c++) {
+                        u16[4 * i + c] = float_to_half(std::min(t.rgb[c], 65504.0f));
+                    }
+                    u16[4 * i + 3] = float_to_half(t.alpha);
+                    break;
+                case TexelFormat::R8:
+                    _bytes[i] = uint8_t(std::lround(std::clamp(t.rgb[0], 0.0f, 1.0f) * 255.0f));
+                    break;
+                case TexelFormat::R16:
+                    u16[i] = uint16_t(std::lround(std::clamp(t.rgb[0], 0.0f, 1.0f) * 65535.0f));
+                    break;
+                case TexelFormat::R32F:
+                    std::memcpy(&_bytes[4 * i], &t.rgb[0], sizeof(float));
+                    break;
+                default: {
+                    float v[4] = {t.rgb[0], t.rgb[1], t.rgb[2], t.alpha};
+                    std::memcpy(&_bytes[16 * i], v, sizeof(v));
+                }
+                }
+            }
+        });
+    }
+
+    DeviceTexture::DeviceTexture(const RGBAImage &image)
+        : texels(active_device()->device_resource()), format(image.format) {
+        auto mips = build_mip_chain(image);
+        std::vector<uint8_t> bytes;
+        auto append = [&](const RGBAImage &level) {
+            PackedImage packed(level, format);
+            // keep every level aligned for the wider texel types
+            bytes.resize((bytes.size() + 15) & ~size_t(15));
+            level_offsets.emplace_back(bytes.size());
+            level_resolutions.emplace_back(level.resolution());
+            bytes.insert(bytes.end(), packed.bytes().begin(), packed.bytes().end());
+            unpacked_bytes += level.texels().size() * sizeof(RGBA);
+        };
+        append(image);
+        for (auto &level : mips) {
+            append(level);
+        }
+        texels.copy(bytes);
+        auto &data = image.texels();
+        double sum = parallel_reduce(
+            0, data.size(), 4096u, 0.0,
+            [&](Range r) {
+                double partial = 0.0;
+                for (auto i = r.begin; i < r.end; i++) {
+                    partial += luminance(data[i].rgb);
+                }
+                return partial;
+            },
+            [](double a, double b) { return a + b; });
+        mean_luminance = data.empty() ? 0.0f : float(sum / double(data.size()));
+    }
 } // namespace akari
@@ -25,10 +25,15 @@
 
 #include <list>
 #include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <akari/core/akari.h>
 #include <akari/common/math.h>
 #include <akari/common/color.h>
 #include <akari/common/buffer.h>
+#include <akari/core/texel.h>
 
 namespace akari {
 
@@ -120,6 +125,65 @@ namespace akari {
     class RGBAImage : public TImage<RGBA> {
       public:
         using TImage<RGBA>::TImage;
+        // most compact storage that holds the texels of the source file without further loss
+        TexelFormat format = TexelFormat::RGBA32F;
+    };
+
+    // read-only texels in any TexelFormat, decoded to linear RGBA on fetch
+    struct PackedImageView {
+        AKR_XPU RGBA operator()(int x, int y) const {
+            x = std::clamp(x, 0, _resolution[0] - 1);
+            y = std::clamp(y, 0, _resolution[1] - 1);
+            size_t i = size_t(x) + size_t(y) * size_t(_resolution[0]);
+            switch (format) {
+            case TexelFormat::RGBA8_SRGB: {
+                auto *p = _texels + 4 * i;
+                return RGBA(float3(srgb8_to_linear(p[0]), srgb8_to_linear(p[1]), srgb8_to_linear(p[2])),
+                            float(p[3]) / 255.0f);
+            }
+            case TexelFormat::RGB16F: {
+                auto *p = reinterpret_cast<const uint16_t *>(_texels) + 3 * i;
+                return RGBA(float3(half_to_float(p[0]), half_to_float(p[1]), half_to_float(p[2])), 1.0f);
+            }
+            case TexelFormat::RGBA16F: {
+                auto *p = reinterpret_cast<const uint16_t *>(_texels) + 4 * i;
+                return RGBA(float3(half_to_float(p[0]), half_to_float(p[1]), half_to_float(p[2])),
+                            half_to_float(p[3]));
+            }
+            case TexelFormat::R8:
+                return RGBA(float3(float(_texels[i]) / 255.0f), 1.0f);
+            case TexelFormat::R16:
+                return RGBA(float3(float(reinterpret_cast<const uint16_t *>(_texels)[i]) / 65535.0f), 1.0f);
+            case TexelFormat::R32F:
+                return RGBA(float3(reinterpret_cast<const float *>(_texels)[i]), 1.0f);
+            default: {
+                auto *p = reinterpret_cast<const float *>(_texels) + 4 * i;
+                return RGBA(float3(p[0], p[1], p[2]), p[3]);
+            }
+            }
+        }
+        AKR_XPU RGBA operator()(const int2 &p) const { return (*this)(p.x, p.y); }
+        AKR_XPU RGBA operator()(const float2 &p) const { return (*this)(int2(p * float2(_resolution))); }
+        [[nodiscard]] AKR_XPU int2 resolution() const { return _resolution; }
+        const uint8_t *_texels = nullptr;
+        int2 _resolution = int2(0);
+        TexelFormat format = TexelFormat::RGBA32F;
+    };
+
+    // host side texels encoded in a TexelFormat
+    class AKR_EXPORT PackedImage {
+      public:
+        PackedImage() = default;
+        PackedImage(const RGBAImage &image, TexelFormat format);
+        [[nodiscard]] TexelFormat format() const { return _format; }
+        [[nodiscard]] int2 resolution() const { return _resolution; }
+        [[nodiscard]] const std::vector<uint8_t> &bytes() const { return _bytes; }
+        PackedImageView view() const { return PackedImageView{_bytes.data(), _resolution, _format}; }
+
+      private:
+        TexelFormat _format = TexelFormat::RGBA32F;
+        int2 _resolution = int2(0);
+        std::vector<uint8_t> _bytes;
     };
 
     class AKR_EXPORT PostProcessor {
@@ -168,8 +232,63 @@ namespace akari {
     };
 
     AKR_EXPORT std::shared_ptr<ImageWriter> default_image_writer();
+
+    // Writes images on a background thread so that encoding overlaps with rendering. write() blocks while
+    // max_pending images are already waiting, which bounds the memory held by a slow disk.
+    class AKR_EXPORT AsyncImageWriter {
+      public:
+        explicit AsyncImageWriter(size_t max_pending = 2,
+                                  std::shared_ptr<ImageWriter> writer = default_image_writer());
+        // waits for every pending image to be written
+        ~AsyncImageWriter();
+        AsyncImageWriter(const AsyncImageWriter &) = delete;
+        AsyncImageWriter &operator=(const AsyncImageWriter &) = delete;
+        void write(RGBAImage image, const fs::path &path,
+                   std::shared_ptr<PostProcessor> postProcessor = std::make_shared<GammaCorrection>());
+        void flush();
+
+      private:
+        struct Request {
+            RGBAImage image;
+            fs::path path;
+            std::shared_ptr<PostProcessor> postProcessor;
+        };
+        void run();
+        std::shared_ptr<ImageWriter> writer;
+        size_t max_pending;
+        std::deque<Request> requests;
+        // true while the background thread is writing the front request
+        bool busy = false;
+        bool stopped = false;
+        std::mutex mutex;
+        std::condition_variable has_request, request_done;
+        std::thread thread;
+    };
     AKR_EXPORT std::shared_ptr<ImageReader> default_image_reader();
 
+    // An image as textures sample it: all MIP levels in the image's texel format, packed into one buffer on the
+    // active device, together with the mean luminance lights need for their power
+    struct AKR_EXPORT DeviceTexture {
+        explicit DeviceTexture(const RGBAImage &image);
+        DeviceTexture(const DeviceTexture &) = delete;
+        DeviceTexture &operator=(const DeviceTexture &) = delete;
+        [[nodiscard]] int n_levels() const { return (int)level_offsets.size(); }
+        [[nodiscard]] PackedImageView level(int i) const {
+            return PackedImageView{texels.data() + level_offsets[i], level_resolutions[i], format};
+        }
+        Buffer<uint8_t> texels;
+        std::vector<size_t> level_offsets;
+        std::vector<int2> level_resolutions;
+        TexelFormat format = TexelFormat::RGBA32F;
+        float mean_luminance = 0.0f;
+        // what the levels would take as RGBA
+        size_t unpacked_bytes = 0;
+    };
+
+    // Box filtered MIP levels below image, each half the size of the previous one (odd sizes round down) down to
+    // 1x1. The image itself is not included.
+    AKR_EXPORT std::vector<RGBAImage> build_mip_chain(const RGBAImage &image);
+
 } // namespace akari
 
 #endif // AKARIRENDER_IMAGE_HPP
@@ -19,65 +19,293 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
 #include <akari/core/ipc.h>
+#include <akari/core/logger.h>
+
+#ifdef AKR_PLATFORM_WINDOWS
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <winsock2.h>
+#    include <Ws2tcpip.h>
+#    undef NOMINMAX
+using socket_t = SOCKET;
+#else
+using socket_t = int;
+#    include <arpa/inet.h>
+#    include <errno.h>
+#    include <netdb.h>
+#    include <netinet/in.h>
+#    include <netinet/tcp.h>
+#    include <poll.h>
+#    include <signal.h>
+#    include <sys/socket.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#    define SOCKET_ERROR   (-1)
+#    define INVALID_SOCKET (-1)
+#endif
+
+namespace akari {
+    static int close_socket(socket_t socket) {
+#ifdef AKR_PLATFORM_WINDOWS
+        return closesocket(socket);
+#else
+        return ::close(socket);
+#endif
+    }
+    static std::string socket_error_string() {
+#ifdef AKR_PLATFORM_WINDOWS
+        return fmt::format("error {}", WSAGetLastError());
+#else
+        return strerror(errno);
+#endif
+    }
+    static std::once_flag socket_init;
+    static void init_sockets() {
+        std::call_once(socket_init, [] {
+#ifdef AKR_PLATFORM_WINDOWS
+            WSADATA wsaData;
+            int err = WSAStartup(MAKEWORD(2, 2), &wsaData);
+            if (err != NO_ERROR) {
+                fatal("unable to initialize WinSock: error {}", err);
+            }
+#else
+            // a peer that disappears must fail send() instead of killing the process
+            signal(SIGPIPE, SIG_IGN);
+#endif
+        });
+    }
+
+    static void enable_keepalive(socket_t socket) {
+        // lets a blocked receive notice a render node that dropped off the network; the default idle time before
+        // the first probe is two hours on Linux, so probe after 30s and give up after three unanswered probes
+        int one = 1;
+        setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, (const char *)&one, sizeof(one));
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        int idle = 30, interval = 10, count = 3;
+        setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, (const char *)&idle, sizeof(idle));
+        setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, (const char *)&interval, sizeof(interval));
+        setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, (const char *)&count, sizeof(count));
+#endif
+    }
+    // waits up to timeout_ms, or forever if negative, for socket to become readable
+    static bool wait_readable(socket_t socket, int timeout_ms) {
+        pollfd fd{};
+        fd.fd = socket;
+        fd.events = POLLIN;
+#ifdef AKR_PLATFORM_WINDOWS
+        return WSAPoll(&fd, 1, timeout_ms) > 0;
+#else
+        return poll(&fd, 1, timeout_ms) > 0;
+#endif
+    }
+
+    class SocketChannel : public IPCChannel {
+        socket_t socket;
+
+      public:
+        explicit SocketChannel(socket_t socket) : socket(socket) {}
+        size_t send(const uint8_t *data, size_t size) override {
+            size_t sent = 0;
+            while (socket != INVALID_SOCKET && sent < size) {
+                auto n = ::send(socket, (const char *)data + sent, (int)std::min<size_t>(size - sent, 1 << 30), 0);
+                if (n <= 0) {
+                    break;
+                }
+                sent += n;
+            }
+            return sent;
+        }
+        size_t receive(uint8_t *data, size_t size, int timeout_ms) override {
+            using clock = std::chrono::steady_clock;
+            auto deadline = clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+            size_t received = 0;
+            while (socket != INVALID_SOCKET && received < size) {
+                if (timeout_ms >= 0) {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now());
+                    if (left.count() <= 0 || !wait_readable(socket, (int)left.count())) {
+                        break;
+                    }
+                }
+                auto n = ::recv(socket, (char *)data + received, (int)std::min<size_t>(size - received, 1 << 30), 0);
+                if (n <= 0) {
+                    break;
+                }
+                received += n;
+            }
+            return received;
+        }
+        void close() override {
+            if (socket != INVALID_SOCKET) {
+                close_socket(socket);
+                socket = INVALID_SOCKET;
+            }
+        }
+        ~SocketChannel() override { close(); }
+    };
+
+    class SocketListener : public IPCListener {
+        socket_t socket;
+        // removed on close, for UNIX domain sockets
+        fs::path path;
+
+      public:
+        SocketListener(socket_t socket, fs::path path) : socket(socket), path(std::move(path)) {}
+        std::shared_ptr<IPCChannel> accept(int timeout_ms) override {
+            if (socket == INVALID_SOCKET) {
+                return nullptr;
+            }
+            if (!wait_readable(socket, timeout_ms)) {
+                return nullptr;
+            }
+            auto client = ::accept(socket, nullptr, nullptr);
+            if (client == INVALID_SOCKET) {
+                return nullptr;
+            }
+            if (path.empty()) {
+                enable_keepalive(client);
+            }
+            return std::make_shared<SocketChannel>(client);
+        }
+        void close() override {
+            if (socket != INVALID_SOCKET) {
+                close_socket(socket);
+                socket = INVALID_SOCKET;
+                if (!path.empty()) {
+                    std::error_code ec;
+                    fs::remove(path, ec);
+                }
+            }
+        }
+        ~SocketListener() override { close(); }
+    };
 
-// #ifdef AKR_PLATFORM_WINDOWS
-// #    ifndef NOMINMAX
-// #        define NOMINMAX
-// #    endif
-// #    include <Ws2tcpip.h>
-// #    include <winsock2.h>
-// #    undef NOMINMAX
-// using socket_t = SOCKET;
-// #else
-// using socket_t = int;
-// #    include <arpa/inet.h>
-// #    include <errno.h>
-// #    include <netdb.h>
-// #    include <netinet/in.h>
-// #    include <signal.h>
-// #    include <sys/socket.h>
-// #    include <unistd.h>
-// #    define SOCKET_ERROR   (-1)
-// #    define INVALID_SOCKET (-1)
-// #endif
+    std::shared_ptr<IPCChannel> connect(const std::string &hostname, size_t port) {
+        init_sockets();
+        addrinfo hints{}, *result = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        auto service = std::to_string(port);
+        if (int err = getaddrinfo(hostname.c_str(), service.c_str(), &hints, &result); err != 0) {
+            error("cannot resolve {}: {}", hostname, gai_strerror(err));
+            return nullptr;
+        }
+        socket_t s = INVALID_SOCKET;
+        for (auto addr = result; addr; addr = addr->ai_next) {
+            s = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (s == INVALID_SOCKET) {
+                continue;
+            }
+            if (::connect(s, addr->ai_addr, (int)addr->ai_addrlen) != SOCKET_ERROR) {
+                break;
+            }
+            close_socket(s);
+            s = INVALID_SOCKET;
+        }
+        freeaddrinfo(result);
+        if (s == INVALID_SOCKET) {
+            error("cannot connect to {}:{}: {}", hostname, port, socket_error_string());
+            return nullptr;
+        }
+        enable_keepalive(s);
+        return std::make_shared<SocketChannel>(s);
+    }
+    std::shared_ptr<IPCListener> listen(size_t port) {
+        init_sockets();
+        socket_t s = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (s == INVALID_SOCKET) {
+            error("cannot create socket: {}", socket_error_string());
+            return nullptr;
+        }
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons((uint16_t)port);
+        if (::bind(s, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR || ::listen(s, SOMAXCONN) == SOCKET_ERROR) {
+            error("cannot listen on port {}: {}", port, socket_error_string());
+            close_socket(s);
+            return nullptr;
+        }
+        return std::make_shared<SocketListener>(s, fs::path());
+    }
 
-// namespace akari {
-//     enum SocketError : int {
-// #ifdef AKR_PLATFORM_WINDOWS
-//         Again = EAGAIN,
-//         ConnRefused = WSAECONNREFUSED,
-//         WouldBlock = WSAEWOULDBLOCK,
-// #else
-//         Again = EAGAIN,
-//         ConnRefused = ECONNREFUSED,
-//         WouldBlock = EWOULDBLOCK,
-// #endif
-//     };
+#ifdef AKR_PLATFORM_WINDOWS
+    std::shared_ptr<IPCChannel> connect_local(const fs::path &path) {
+        error("UNIX domain sockets are not supported on this platform");
+        return nullptr;
+    }
+    std::shared_ptr<IPCListener> listen_local(const fs::path &path) {
+        error("UNIX domain sockets are not supported on this platform");
+        return nullptr;
+    }
+#else
+    static bool make_local_address(const fs::path &path, sockaddr_un &addr) {
+        addr = sockaddr_un{};
+        addr.sun_family = AF_UNIX;
+        auto str = path.string();
+        if (str.size() >= sizeof(addr.sun_path)) {
+            error("socket path too long: {}", str);
+            return false;
+        }
+        std::memcpy(addr.sun_path, str.c_str(), str.size() + 1);
+        return true;
+    }
+    std::shared_ptr<IPCChannel> connect_local(const fs::path &path) {
+        init_sockets();
+        sockaddr_un addr;
+        if (!make_local_address(path, addr)) {
+            return nullptr;
+        }
+        socket_t s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == INVALID_SOCKET || ::connect(s, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            error("cannot connect to {}: {}", path.string(), socket_error_string());
+            if (s != INVALID_SOCKET) {
+                close_socket(s);
+            }
+            return nullptr;
+        }
+        return std::make_shared<SocketChannel>(s);
+    }
+    std::shared_ptr<IPCListener> listen_local(const fs::path &path) {
+        init_sockets();
+        sockaddr_un addr;
+        if (!make_local_address(path, addr)) {
+            return nullptr;
+        }
+        // a stale socket file of a crashed coordinator would make bind() fail
+        std::error_code ec;
+        fs::remove(path, ec);
+        socket_t s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == INVALID_SOCKET || ::bind(s, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            ::listen(s, SOMAXCONN) == SOCKET_ERROR) {
+            error("cannot listen on {}: {}", path.string(), socket_error_string());
+            if (s != INVALID_SOCKET) {
+                close_socket(s);
+            }
+            return nullptr;
+        }
+        return std::make_shared<SocketListener>(s, path);
+    }
+#endif
 
-//     static int closeSocket(socket_t socket) {
-// #ifdef AKR_PLATFORM_WINDOWS
-//         return closesocket(socket);
-// #else
-//         return close(socket);
-// #endif
-//     }
-//     static std::atomic<int> numActiveChannels{0};
-//     class IPCChannelImpl : public IPCChannel {
-//       public:
-//         IPCChannelImpl(const std::string &hostname, size_t port) {
-//             if (numActiveChannels++ == 0) {
-// #ifdef AKR_PLATFORM_WINDOWS
-//                 WSADATA wsaData;
-//                 int err = WSAStartup(MAKEWORD(2, 2), &wsaData);
-//                 if (err != NO_ERROR)
-//                     LOG_FATAL("Unable to initialize WinSock: %s", ErrorString(err));
-// #else
-                
-// #endif
-//             }
-//         }
-//         size_t send(const uint8_t *data, size_t size) override {}
-//         size_t receive(uint8_t *data, size_t size) override {}
-//     };
-// } // namespace akari
\ No newline at end of file
+    std::shared_ptr<IPCChannel> connect(const std::string &address) {
+        if (address.rfind("unix:", 0) == 0) {
+            return connect_local(fs::path(address.substr(5)));
+        }
+        auto colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            error("address {} is neither unix:<path> nor <host>:<port>", address);
+            return nullptr;
+        }
+        return connect(address.substr(0, colon), std::stoul(address.substr(colon + 1)));
+    }
+} // namespace akari
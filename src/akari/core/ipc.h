@@ -19,17 +19,38 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
+
+#pragma once
 #include <cstdint>
 #include <cstddef>
 #include <string>
 #include <memory>
+#include <akari/core/akari.h>
 namespace akari {
-    class IPCChannel {
+    // A reliable byte stream to another process, on this machine or across the network
+    class AKR_EXPORT IPCChannel {
       public:
+        // sends all size bytes; returns fewer if the connection was lost
         virtual size_t send(const uint8_t *data, size_t size) = 0;
-        virtual size_t receive(uint8_t *data, size_t size) = 0;
+        // blocks until exactly size bytes arrived; returns fewer if the connection was closed or lost, or if they
+        // did not all arrive within timeout_ms (forever if negative)
+        virtual size_t receive(uint8_t *data, size_t size, int timeout_ms = -1) = 0;
         virtual void close() = 0;
         virtual ~IPCChannel() = default;
     };
-    std::shared_ptr<IPCChannel> connect(const std::string &hostname, size_t port);
-} // namespace akari
\ No newline at end of file
+    class AKR_EXPORT IPCListener {
+      public:
+        // waits up to timeout_ms, or forever if negative, for a connection; returns nullptr on timeout
+        virtual std::shared_ptr<IPCChannel> accept(int timeout_ms = -1) = 0;
+        virtual void close() = 0;
+        virtual ~IPCListener() = default;
+    };
+    // TCP; return nullptr on failure
+    AKR_EXPORT std::shared_ptr<IPCChannel> connect(const std::string &hostname, size_t port);
+    AKR_EXPORT std::shared_ptr<IPCListener> listen(size_t port);
+    // UNIX domain sockets, for processes on the same machine; return nullptr on failure
+    AKR_EXPORT std::shared_ptr<IPCChannel> connect_local(const fs::path &path);
+    AKR_EXPORT std::shared_ptr<IPCListener> listen_local(const fs::path &path);
+    // "unix:<path>" or "<hostname>:<port>"
+    AKR_EXPORT std::shared_ptr<IPCChannel> connect(const std::string &address);
+} // namespace akari
@@ -0,0 +1,261 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifdef AKR_ENABLE_PYTHON
+#    include <pybind11/pybind11.h>
+#    include <pybind11/stl.h>
+#endif
+#include <akari/core/cancellation.h>
+#include <akari/core/nodes/animation.h>
+#include <akari/core/nodes/session.h>
+#include <akari/core/logger.h>
+#include <akari/core/profiler.h>
+namespace akari {
+    namespace {
+        struct Pose {
+            float3 position, rotation, scale;
+            double fov;
+            // same order as PerspectiveCameraNode
+            transform3f transform() const {
+                transform3f T = transform3f::scale(scale);
+                T = transform3f::rotate_z(rotation.z) * T;
+                T = transform3f::rotate_x(rotation.y) * T;
+                T = transform3f::rotate_y(rotation.x) * T;
+                return transform3f::translate(position) * T;
+            }
+        };
+        // keys must be sorted by frame; frames outside the keys hold the first or last pose. Keys without a fov
+        // take default_fov before blending, so that a key that keeps the camera's fov does not pull it toward zero.
+        template <class Key>
+        Pose interpolate(const std::vector<std::shared_ptr<Key>> &keys, int frame, double default_fov = 0.0) {
+            auto pose = [=](const Key &key) {
+                return Pose{key.position, key.rotation, key.scale, key.fov > 0 ? key.fov : default_fov};
+            };
+            if (frame <= keys.front()->frame) {
+                return pose(*keys.front());
+            }
+            if (frame >= keys.back()->frame) {
+                return pose(*keys.back());
+            }
+            auto it = std::upper_bound(keys.begin(), keys.end(), frame,
+                                       [](int f, const std::shared_ptr<Key> &key) { return f < key->frame; });
+            const Key &ka = **(it - 1);
+            const Key &kb = **it;
+            auto a = pose(ka), b = pose(kb);
+            float t = float(frame - ka.frame) / float(kb.frame - ka.frame);
+            return Pose{a.position + (b.position - a.position) * t, a.rotation + (b.rotation - a.rotation) * t,
+                        a.scale + (b.scale - a.scale) * t, a.fov + (b.fov - a.fov) * t};
+        }
+    } // namespace
+
+    AKR_VARIANT void KeyframeNode<C>::object_field(sdl::Parser &parser, sdl::ParserContext &ctx,
+                                                   const std::string &field, const sdl::Value &value) {
+        if (field == "frame") {
+            frame = value.get<int>().value();
+        } else if (field == "position") {
+            position = load_array<float3>(value);
+        } else if (field == "rotation") {
+            rotation = radians(load_array<float3>(value));
+        } else if (field == "scale") {
+            scale = load_array<float3>(value);
+        } else if (field == "fov") {
+            fov = radians(value.get<double>().value());
+        }
+    }
+    AKR_VARIANT void ShapeAnimationNode<C>::object_field(sdl::Parser &parser, sdl::ParserContext &ctx,
+                                                         const std::string &field, const sdl::Value &value) {
+        if (field == "shape") {
+            shape = dyn_cast<MeshNode<C>>(value.object());
+            AKR_ASSERT_THROW(shape);
+        } else if (field == "keys") {
+            AKR_ASSERT_THROW(value.is_array());
+            for (auto key : value) {
+                keys.emplace_back(dyn_cast<KeyframeNode<C>>(key.object()));
+                AKR_ASSERT_THROW(keys.back());
+            }
+        }
+    }
+    AKR_VARIANT void AnimationNode<C>::render() {
+        AKR_ASSERT_THROW(scene);
+        auto by_frame = [](const std::shared_ptr<KeyframeNode<C>> &a, const std::shared_ptr<KeyframeNode<C>> &b) {
+            return a->frame < b->frame;
+        };
+        std::sort(camera.begin(), camera.end(), by_frame);
+        RenderSession<C> session(*scene);
+        auto scene_camera = scene->camera;
+        std::shared_ptr<PerspectiveCameraNode<C>> perspective;
+        if (!camera.empty()) {
+            perspective = dyn_cast<PerspectiveCameraNode<C>>(scene_camera);
+            AKR_ASSERT_THROW(perspective && "camera animation requires a PerspectiveCamera");
+        }
+        struct AnimatedMesh {
+            uint32_t mesh_id;
+            std::shared_ptr<ShapeAnimationNode<C>> animation;
+            // as loaded, in the scene's space
+            std::vector<float> vertices, normals;
+            std::vector<float> frame_vertices, frame_normals;
+            Buffer<float> vertex_buffer, normal_buffer;
+        };
+        std::vector<AnimatedMesh> meshes;
+        for (auto &animation : shapes) {
+            AKR_ASSERT_THROW(animation && !animation->keys.empty());
+            auto it = std::find(scene->shapes.begin(), scene->shapes.end(), animation->shape);
+            AKR_ASSERT_THROW(it != scene->shapes.end() && "animated shape is not part of the scene");
+            std::sort(animation->keys.begin(), animation->keys.end(), by_frame);
+            auto mesh_id = uint32_t(it - scene->shapes.begin());
+            auto &instance = scene->instances[mesh_id];
+            AnimatedMesh mesh{mesh_id,
+                              animation,
+                              std::vector<float>(instance.vertices.begin(), instance.vertices.end()),
+                              std::vector<float>(instance.normals.begin(), instance.normals.end()),
+                              {},
+                              {},
+                              Buffer<float>(active_device()->device_resource()),
+                              Buffer<float>(active_device()->device_resource())};
+            meshes.emplace_back(std::move(mesh));
+        }
+        // the background writer holds at most queue_depth finished frames
+        AsyncImageWriter writer(std::max(queue_depth, 1));
+        // an interrupted frame is still written unless it got no sample; the frames after it are skipped
+        InterruptHandler interrupt;
+        Timer animation_timer;
+        int last_frame = frames[0] - 1;
+        for (int frame = frames[0]; frame <= frames[1] && !render_cancellation().is_cancelled(); frame++) {
+            Timer timer;
+            if (perspective) {
+                auto pose = interpolate(camera, frame, perspective->fov);
+                auto node = std::make_shared<PerspectiveCameraNode<C>>(*perspective);
+                node->position = pose.position;
+                node->rotation = pose.rotation;
+                node->fov = pose.fov;
+                session.set_camera(node);
+            }
+            std::vector<uint32_t> moved;
+            for (auto &mesh : meshes) {
+                auto T = interpolate(mesh.animation->keys, frame).transform();
+                mesh.frame_vertices.resize(mesh.vertices.size());
+                for (size_t i = 0; i + 2 < mesh.vertices.size(); i += 3) {
+                    auto p = T.apply_point(float3(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]));
+                    for (int j = 0; j < 3; j++) {
+                        mesh.frame_vertices[i + j] = p[j];
+                    }
+                }
+                mesh.frame_normals.resize(mesh.normals.size());
+                for (size_t i = 0; i + 2 < mesh.normals.size(); i += 3) {
+                    auto n = T.apply_normal(float3(mesh.normals[i], mesh.normals[i + 1], mesh.normals[i + 2]));
+                    n = normalize(n);
+                    for (int j = 0; j < 3; j++) {
+                        mesh.frame_normals[i + j] = n[j];
+                    }
+                }
+                mesh.vertex_buffer.copy(mesh.frame_vertices);
+                mesh.normal_buffer.copy(mesh.frame_normals);
+                auto &instance = scene->instances[mesh.mesh_id];
+                instance.vertices = mesh.vertex_buffer.view();
+                instance.normals = mesh.normal_buffer.view();
+                moved.emplace_back(mesh.mesh_id);
+            }
+            session.update_meshes(moved);
+            session.render(spp);
+            auto path = fmt::format(output, frame);
+            if (render_cancellation().is_cancelled() && !session.get_film().has_samples()) {
+                warning("frame {} interrupted before any sample was taken; {} is left as it was", frame, path);
+                break;
+            }
+            writer.write(session.get_image(), fs::path(path));
+            info("frame {} rendered ({}s): {}", frame, timer.elapsed_seconds(), path);
+            last_frame = frame;
+        }
+        writer.flush();
+        scene->camera = scene_camera;
+        if (render_cancellation().is_cancelled()) {
+            warning("animation interrupted at frame {}", last_frame);
+            return;
+        }
+        info("{} frames done ({}s)", frames[1] - frames[0] + 1, animation_timer.elapsed_seconds());
+    }
+    AKR_VARIANT void AnimationNode<C>::object_field(sdl::Parser &parser, sdl::ParserContext &ctx,
+                                                    const std::string &field, const sdl::Value &value) {
+        if (field == "scene") {
+            scene = dyn_cast<SceneNode<C>>(value.object());
+            AKR_ASSERT_THROW(scene);
+        } else if (field == "frames") {
+            frames = load_array<int2>(value);
+        } else if (field == "output") {
+            output = value.get<std::string>().value();
+        } else if (field == "camera") {
+            AKR_ASSERT_THROW(value.is_array());
+            for (auto key : value) {
+                camera.emplace_back(dyn_cast<KeyframeNode<C>>(key.object()));
+                AKR_ASSERT_THROW(camera.back());
+            }
+        } else if (field == "shapes") {
+            AKR_ASSERT_THROW(value.is_array());
+            for (auto shape : value) {
+                shapes.emplace_back(dyn_cast<ShapeAnimationNode<C>>(shape.object()));
+                AKR_ASSERT_THROW(shapes.back());
+            }
+        } else if (field == "spp") {
+            spp = value.get<int>().value();
+        } else if (field == "queue_depth") {
+            queue_depth = value.get<int>().value();
+        }
+    }
+
+    AKR_VARIANT void RegisterAnimationNode<C>::register_nodes() {
+        register_node<C, KeyframeNode<C>>("Keyframe");
+        register_node<C, ShapeAnimationNode<C>>("ShapeAnimation");
+        register_node<C, AnimationNode<C>>("Animation");
+    }
+
+    AKR_VARIANT void RegisterAnimationNode<C>::register_python_nodes(py::module &m) {
+#ifdef AKR_ENABLE_PYTHON
+        py::class_<KeyframeNode<C>, SceneGraphNode<C>, std::shared_ptr<KeyframeNode<C>>>(m, "Keyframe")
+            .def(py::init<>())
+            .def_readwrite("frame", &KeyframeNode<C>::frame)
+            .def_readwrite("position", &KeyframeNode<C>::position)
+            .def_readwrite("rotation", &KeyframeNode<C>::rotation)
+            .def_readwrite("scale", &KeyframeNode<C>::scale)
+            .def_readwrite("fov", &KeyframeNode<C>::fov);
+        py::class_<ShapeAnimationNode<C>, SceneGraphNode<C>, std::shared_ptr<ShapeAnimationNode<C>>>(
+            m, "ShapeAnimation")
+            .def(py::init<>())
+            .def_readwrite("shape", &ShapeAnimationNode<C>::shape)
+            .def_readwrite("keys", &ShapeAnimationNode<C>::keys);
+        py::class_<AnimationNode<C>, SceneGraphNode<C>, std::shared_ptr<AnimationNode<C>>>(m, "Animation")
+            .def(py::init<>())
+            .def_readwrite("scene", &AnimationNode<C>::scene)
+            .def_readwrite("frames", &AnimationNode<C>::frames)
+            .def_readwrite("output", &AnimationNode<C>::output)
+            .def_readwrite("camera", &AnimationNode<C>::camera)
+            .def_readwrite("shapes", &AnimationNode<C>::shapes)
+            .def_readwrite("spp", &AnimationNode<C>::spp)
+            .def_readwrite("queue_depth", &AnimationNode<C>::queue_depth)
+            .def("render", &AnimationNode<C>::render);
+#endif
+    }
+
+    AKR_RENDER_CLASS(KeyframeNode)
+    AKR_RENDER_CLASS(ShapeAnimationNode)
+    AKR_RENDER_CLASS(AnimationNode)
+    AKR_RENDER_STRUCT(RegisterAnimationNode)
+} // namespace akari
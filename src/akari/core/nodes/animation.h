@@ -0,0 +1,76 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <akari/core/nodes/scene.h>
+namespace akari {
+    // Pose of an animated camera or shape at one frame; frames in between are interpolated linearly
+    AKR_VARIANT class KeyframeNode : public SceneGraphNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        int frame = 0;
+        float3 position = float3(0);
+        // euler angles in radians, applied in the same order as PerspectiveCamera's rotation
+        float3 rotation = float3(0);
+        float3 scale = float3(1);
+        // field of view in radians, cameras only; 0 keeps the camera's own
+        double fov = 0.0;
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override;
+    };
+
+    AKR_VARIANT class ShapeAnimationNode : public SceneGraphNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        // one of the scene's shapes; its vertices are transformed from their loaded positions
+        std::shared_ptr<MeshNode<C>> shape;
+        std::vector<std::shared_ptr<KeyframeNode<C>>> keys;
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override;
+    };
+
+    // Renders a range of frames of a scene whose camera and shapes follow keyframes. The scene is compiled once;
+    // each frame rebuilds only the BVHs of animated shapes, and images are written while the next frame renders.
+    AKR_VARIANT class AnimationNode : public SceneGraphNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        std::shared_ptr<SceneNode<C>> scene;
+        // first and last frame, inclusive
+        int2 frames = int2(0);
+        // fmt pattern of the image path, given the frame number, e.g. "frame{:04d}.png"
+        std::string output = "frame{:04d}.png";
+        std::vector<std::shared_ptr<KeyframeNode<C>>> camera;
+        std::vector<std::shared_ptr<ShapeAnimationNode<C>>> shapes;
+        // overrides the integrator's samples per pixel if positive
+        int spp = 0;
+        // number of finished frames that may wait to be written before rendering stalls
+        int queue_depth = 2;
+        void render();
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override;
+    };
+
+    AKR_VARIANT struct RegisterAnimationNode {
+        static void register_nodes();
+        static void register_python_nodes(py::module &m);
+    };
+} // namespace akari
@@ -0,0 +1,168 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifdef AKR_ENABLE_PYTHON
+#    include <pybind11/pybind11.h>
+#    include <pybind11/stl.h>
+#endif
+#include <mutex>
+#include <thread>
+#include <akari/core/nodes/batch.h>
+#include <akari/core/cancellation.h>
+#include <akari/core/nodes/session.h>
+#include <akari/core/logger.h>
+#include <akari/core/parallel.h>
+#include <akari/core/profiler.h>
+namespace akari {
+    AKR_VARIANT void RenderJobNode<C>::object_field(sdl::Parser &parser, sdl::ParserContext &ctx,
+                                                    const std::string &field, const sdl::Value &value) {
+        if (field == "scene") {
+            scene = dyn_cast<SceneNode<C>>(value.object());
+            AKR_ASSERT_THROW(scene);
+        } else if (field == "camera") {
+            camera = dyn_cast<CameraNode<C>>(value.object());
+            AKR_ASSERT_THROW(camera);
+        } else if (field == "output") {
+            output = value.get<std::string>().value();
+        } else if (field == "spp") {
+            spp = value.get<int>().value();
+        }
+    }
+    AKR_VARIANT void BatchNode<C>::render() {
+        // jobs grouped by scene, in the order the scenes first appear
+        std::vector<std::pair<std::shared_ptr<SceneNode<C>>, std::vector<size_t>>> groups;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            AKR_ASSERT_THROW(jobs[i] && jobs[i]->scene);
+            auto it = std::find_if(groups.begin(), groups.end(),
+                                   [&](const auto &group) { return group.first == jobs[i]->scene; });
+            if (it == groups.end()) {
+                it = groups.emplace(groups.end(), jobs[i]->scene, std::vector<size_t>());
+            }
+            it->second.emplace_back(i);
+        }
+        info("batch: {} jobs over {} scenes", jobs.size(), groups.size());
+        // an interrupted job still writes its partial image, if it has one; the jobs after it are skipped
+        InterruptHandler interrupt;
+        Timer batch_timer;
+        std::atomic<size_t> next_group(0);
+        // nodes shared between scenes are not safe to commit concurrently, so sessions are prepared one at a time
+        std::mutex prepare_mutex;
+        std::mutex error_mutex;
+        std::exception_ptr first_error;
+        auto n_workers = std::min<size_t>(std::max(concurrency, 1), groups.size());
+        // concurrent jobs split the pool evenly instead of each spreading its tiles over every thread
+        auto job_threads = std::max<size_t>(1, num_work_threads() / n_workers);
+        auto worker = [&]() {
+            try {
+                for (size_t g; (g = next_group++) < groups.size();) {
+                    auto &[scene, indices] = groups[g];
+                    std::unique_ptr<RenderSession<C>> session;
+                    {
+                        std::lock_guard<std::mutex> _(prepare_mutex);
+                        session = std::make_unique<RenderSession<C>>(*scene);
+                    }
+                    auto scene_camera = scene->camera;
+                    ThreadBudget budget(job_threads);
+                    for (auto i : indices) {
+                        if (render_cancellation().is_cancelled()) {
+                            next_group = groups.size();
+                            break;
+                        }
+                        auto &job = jobs[i];
+                        Timer timer;
+                        session->set_camera(job->camera ? job->camera : scene_camera);
+                        session->render(job->spp);
+                        auto output = job->output.empty() ? scene->output : job->output;
+                        if (render_cancellation().is_cancelled() && !session->get_film().has_samples()) {
+                            warning("job {}/{} interrupted before any sample was taken; {} is left as it was", i + 1,
+                                    jobs.size(), output);
+                            continue;
+                        }
+                        session->write_image(fs::path(output));
+                        info("job {}/{} done ({}s): {}", i + 1, jobs.size(), timer.elapsed_seconds(), output);
+                    }
+                    scene->camera = scene_camera;
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> _(error_mutex);
+                if (!first_error) {
+                    first_error = std::current_exception();
+                }
+                // lets the other workers stop after their current scene
+                next_group = groups.size();
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < n_workers; i++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        if (first_error) {
+            std::rethrow_exception(first_error);
+        }
+        if (render_cancellation().is_cancelled()) {
+            warning("batch interrupted after {}s", batch_timer.elapsed_seconds());
+            return;
+        }
+        info("batch done ({}s)", batch_timer.elapsed_seconds());
+    }
+    AKR_VARIANT void BatchNode<C>::object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                                                const sdl::Value &value) {
+        if (field == "jobs") {
+            AKR_ASSERT_THROW(value.is_array());
+            for (auto job : value) {
+                jobs.emplace_back(dyn_cast<RenderJobNode<C>>(job.object()));
+                AKR_ASSERT_THROW(jobs.back());
+            }
+        } else if (field == "concurrency") {
+            concurrency = value.get<int>().value();
+        }
+    }
+
+    AKR_VARIANT void RegisterBatchNode<C>::register_nodes() {
+        register_node<C, RenderJobNode<C>>("Job");
+        register_node<C, BatchNode<C>>("Batch");
+    }
+
+    AKR_VARIANT void RegisterBatchNode<C>::register_python_nodes(py::module &m) {
+#ifdef AKR_ENABLE_PYTHON
+        py::class_<RenderJobNode<C>, SceneGraphNode<C>, std::shared_ptr<RenderJobNode<C>>>(m, "Job")
+            .def(py::init<>())
+            .def_readwrite("scene", &RenderJobNode<C>::scene)
+            .def_readwrite("camera", &RenderJobNode<C>::camera)
+            .def_readwrite("output", &RenderJobNode<C>::output)
+            .def_readwrite("spp", &RenderJobNode<C>::spp);
+        py::class_<BatchNode<C>, SceneGraphNode<C>, std::shared_ptr<BatchNode<C>>>(m, "Batch")
+            .def(py::init<>())
+            .def_readwrite("jobs", &BatchNode<C>::jobs)
+            .def_readwrite("concurrency", &BatchNode<C>::concurrency)
+            .def("render", &BatchNode<C>::render);
+#endif
+    }
+
+    AKR_RENDER_CLASS(RenderJobNode)
+    AKR_RENDER_CLASS(BatchNode)
+    AKR_RENDER_STRUCT(RegisterBatchNode)
+} // namespace akari
@@ -0,0 +1,57 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <akari/core/nodes/scene.h>
+namespace akari {
+    // One render of a batch: a scene and the settings that override its own
+    AKR_VARIANT class RenderJobNode : public SceneGraphNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        std::shared_ptr<SceneNode<C>> scene;
+        // the scene's own camera and output are used when these are not set
+        std::shared_ptr<CameraNode<C>> camera;
+        std::string output;
+        // overrides the integrator's samples per pixel if positive
+        int spp = 0;
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override;
+    };
+
+    // Renders a list of jobs in one process. Meshes and images stay in the resource cache across jobs, and jobs
+    // naming the same scene share one RenderSession and thus its compiled materials and BVHs.
+    AKR_VARIANT class BatchNode : public SceneGraphNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        std::vector<std::shared_ptr<RenderJobNode<C>>> jobs;
+        // number of scenes prepared and rendered at the same time; each renders on an equal share of the thread pool
+        int concurrency = 1;
+        void render();
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override;
+    };
+
+    AKR_VARIANT struct RegisterBatchNode {
+        static void register_nodes();
+        static void register_python_nodes(py::module &m);
+    };
+} // namespace akari
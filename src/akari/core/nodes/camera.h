@@ -22,6 +22,7 @@
 
 #pragma once
 #include <akari/core/nodes/scenegraph.h>
+#include <akari/kernel/camera.h>
 
 namespace akari {
     AKR_VARIANT class CameraNode : public SceneGraphNode<C> {
@@ -30,6 +31,34 @@ namespace akari {
         virtual Camera<C> compile(MemoryArena<>*arena) = 0;
     };
 
+    AKR_VARIANT class PerspectiveCameraNode : public CameraNode<C> {
+      public:
+        float3 position;
+        float3 rotation;
+        int2 resolution = int2(512, 512);
+        double fov = radians(80.0f);
+        Camera<C> compile(MemoryArena<> *arena) override {
+            transform3f c2w;
+            c2w = transform3f::rotate_z(rotation.z);
+            c2w = transform3f::rotate_x(rotation.y) * c2w;
+            c2w = transform3f::rotate_y(rotation.x) * c2w;
+            c2w = transform3f::translate(position) * c2w;
+            return PerspectiveCamera<C>(resolution, c2w, fov);
+        }
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override {
+            if (field == "fov") {
+                fov = radians(value.get<double>().value());
+            } else if (field == "rotation") {
+                rotation = radians(load_array<float3>(value));
+            } else if (field == "position") {
+                position = load_array<float3>(value);
+            } else if (field == "resolution") {
+                resolution = load_array<int2>(value);
+            }
+        }
+    };
+
     AKR_VARIANT struct RegisterCameraNode {
         static void register_nodes();
         static void register_python_nodes(py::module &m);
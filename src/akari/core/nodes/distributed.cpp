@@ -0,0 +1,216 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <akari/core/nodes/distributed.h>
+#include <akari/core/nodes/session.h>
+#include <akari/core/logger.h>
+#include <akari/core/profiler.h>
+namespace akari {
+    namespace {
+        enum class MessageType : uint32_t {
+            // worker -> coordinator: int2 resolution of the worker's film
+            Hello,
+            // coordinator -> worker: int4 bounds of a tile to render
+            Tile,
+            // worker -> coordinator: int4 bounds, then radiance and weight of every pixel in the tile
+            Result,
+            // coordinator -> worker: no more tiles
+            Done,
+        };
+        struct MessageHeader {
+            MessageType type;
+            uint32_t size;
+        };
+        bool send_message(IPCChannel &channel, MessageType type, const void *data, size_t size) {
+            MessageHeader header{type, (uint32_t)size};
+            return channel.send((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+                   channel.send((const uint8_t *)data, size) == size;
+        }
+        // fails if the whole message did not arrive within timeout_ms, unless it is negative
+        bool receive_message(IPCChannel &channel, MessageHeader &header, std::vector<uint8_t> &data,
+                             int timeout_ms = -1) {
+            using clock = std::chrono::steady_clock;
+            auto deadline = clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+            auto left = [&] {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+                return timeout_ms < 0 ? -1 : (int)std::max<int64_t>(ms, 0);
+            };
+            if (channel.receive((uint8_t *)&header, sizeof(header), left()) != sizeof(header)) {
+                return false;
+            }
+            data.resize(header.size);
+            return channel.receive(data.data(), header.size, left()) == header.size;
+        }
+        AKR_VARIANT void check_tiles_supported(IntegratorNode<C> &integrator) {
+            if (!integrator.supports_tiles()) {
+                error("integrator {} cannot render the image tile by tile", integrator.description());
+                throw std::runtime_error("Integrator does not support distributed rendering");
+            }
+        }
+    } // namespace
+
+    AKR_VARIANT void RenderCoordinator<C>::run(IPCListener &listener) {
+        static constexpr size_t N = array_size_v<Spectrum>;
+        check_tiles_supported(*scene_node.integrator);
+        MemoryArena<> arena{astd::pmr::polymorphic_allocator<>(default_resource())};
+        scene_node.camera->commit();
+        auto resolution = scene_node.camera->compile(&arena).resolution();
+        Film<C> film(resolution, scene_node.crop_window(resolution));
+        std::deque<Bounds2i> pending;
+        auto n_tiles = film.n_tiles(tile_size);
+        for (int y = 0; y < n_tiles.y; y++) {
+            for (int x = 0; x < n_tiles.x; x++) {
+                pending.emplace_back(film.tile_bounds(int2(x, y), tile_size));
+            }
+        }
+        const size_t total = pending.size();
+        size_t n_merged = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+        info("coordinator: {} tiles of {}x{}, waiting for workers", total, tile_size, tile_size);
+        Timer timer;
+
+        auto serve = [&](std::shared_ptr<IPCChannel> channel, int worker_id) {
+            MessageHeader header{};
+            std::vector<uint8_t> data;
+            if (!receive_message(*channel, header, data) || header.type != MessageType::Hello ||
+                data.size() != sizeof(int2) || any(*reinterpret_cast<const int2 *>(data.data()) != resolution)) {
+                warning("worker {}: bad handshake, is it rendering the same scene?", worker_id);
+                return;
+            }
+            info("worker {} connected", worker_id);
+            while (true) {
+                Bounds2i tile;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&] { return !pending.empty() || n_merged == total; });
+                    if (n_merged == total) {
+                        break;
+                    }
+                    tile = pending.front();
+                    pending.pop_front();
+                }
+                int4 bounds(tile.pmin.x, tile.pmin.y, tile.pmax.x, tile.pmax.y);
+                bool ok = send_message(*channel, MessageType::Tile, &bounds, sizeof(bounds)) &&
+                          receive_message(*channel, header, data, tile_timeout * 1000) &&
+                          header.type == MessageType::Result;
+                auto size = tile.size();
+                ok = ok && data.size() == sizeof(int4) + sizeof(float) * (N + 1) * size.x * size.y &&
+                     all(*reinterpret_cast<const int4 *>(data.data()) == bounds);
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!ok) {
+                    // a worker that hangs or silently dropped off the network misses the deadline; a result it
+                    // sends late is never read, as its connection is closed
+                    warning("worker {} lost or timed out, reassigning its tile", worker_id);
+                    pending.push_front(tile);
+                    cv.notify_all();
+                    channel->close();
+                    return;
+                }
+                Tile<C> result(tile);
+                auto values = reinterpret_cast<const float *>(data.data() + sizeof(int4));
+                for (auto &pixel : result.pixels) {
+                    for (size_t i = 0; i < N; i++) {
+                        pixel.radiance[i] = *values++;
+                    }
+                    pixel.weight = *values++;
+                }
+                film.merge_tile(result);
+                n_merged++;
+                if (n_merged % std::max<size_t>(total / 10, 1) == 0 || n_merged == total) {
+                    info("{}/{} tiles merged", n_merged, total);
+                }
+                if (n_merged == total) {
+                    cv.notify_all();
+                }
+            }
+            send_message(*channel, MessageType::Done, nullptr, 0);
+        };
+
+        std::vector<std::thread> workers;
+        int n_workers = 0;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (n_merged == total) {
+                    break;
+                }
+            }
+            if (auto channel = listener.accept(100)) {
+                workers.emplace_back(serve, channel, n_workers++);
+            }
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        info("distributed render done with {} workers ({}s)", n_workers, timer.elapsed_seconds());
+        film.write_image(fs::path(scene_node.output));
+    }
+
+    AKR_VARIANT void RenderWorker<C>::run(IPCChannel &channel) {
+        static constexpr size_t N = array_size_v<Spectrum>;
+        check_tiles_supported(*scene_node.integrator);
+        RenderSession<C> session(scene_node);
+        auto resolution = session.get_film().resolution();
+        if (!send_message(channel, MessageType::Hello, &resolution, sizeof(resolution))) {
+            error("cannot reach the coordinator");
+            return;
+        }
+        MessageHeader header{};
+        std::vector<uint8_t> data;
+        std::vector<uint8_t> result;
+        size_t n_rendered = 0;
+        while (receive_message(channel, header, data) && header.type == MessageType::Tile) {
+            AKR_ASSERT_THROW(data.size() == sizeof(int4));
+            auto bounds = *reinterpret_cast<const int4 *>(data.data());
+            Bounds2i region{int2(bounds[0], bounds[1]), int2(bounds[2], bounds[3])};
+            session.render_region(region);
+            auto tile = session.get_film().extract_tile(region);
+            result.resize(sizeof(int4) + sizeof(float) * (N + 1) * tile.pixels.size());
+            std::memcpy(result.data(), &bounds, sizeof(int4));
+            auto values = reinterpret_cast<float *>(result.data() + sizeof(int4));
+            for (auto &pixel : tile.pixels) {
+                for (size_t i = 0; i < N; i++) {
+                    *values++ = pixel.radiance[i];
+                }
+                *values++ = pixel.weight;
+            }
+            if (!send_message(channel, MessageType::Result, result.data(), result.size())) {
+                break;
+            }
+            n_rendered++;
+        }
+        if (header.type != MessageType::Done) {
+            warning("lost the coordinator");
+        }
+        info("worker rendered {} tiles", n_rendered);
+    }
+
+    AKR_RENDER_CLASS(RenderCoordinator)
+    AKR_RENDER_CLASS(RenderWorker)
+} // namespace akari
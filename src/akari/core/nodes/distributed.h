@@ -0,0 +1,57 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <akari/core/nodes/scene.h>
+#include <akari/core/ipc.h>
+namespace akari {
+    // Renders a scene across processes. The coordinator hands out tiles of the film one at a time to workers that
+    // have loaded the same scene file, merges the accumulated pixels they send back and writes the image. The tile
+    // of a worker whose connection is lost, or that does not return it within tile_timeout seconds, goes back to the
+    // queue for the next idle worker. Integrators that cannot render a tile on its own, such as the light tracer
+    // and SPPM, are refused. Messages are in native byte order, so all processes must run on machines of the same
+    // endianness.
+    AKR_VARIANT class AKR_EXPORT RenderCoordinator {
+      public:
+        AKR_IMPORT_TYPES()
+        RenderCoordinator(SceneNode<C> &scene_node, int tile_size = 64, int tile_timeout = 600)
+            : scene_node(scene_node), tile_size(tile_size), tile_timeout(tile_timeout) {}
+        // serves workers connecting to listener until every tile is merged, then writes the scene's output
+        void run(IPCListener &listener);
+
+      private:
+        SceneNode<C> &scene_node;
+        int tile_size;
+        int tile_timeout;
+    };
+
+    AKR_VARIANT class AKR_EXPORT RenderWorker {
+      public:
+        AKR_IMPORT_TYPES()
+        explicit RenderWorker(SceneNode<C> &scene_node) : scene_node(scene_node) {}
+        // renders the tiles the coordinator sends until it says the image is done
+        void run(IPCChannel &channel);
+
+      private:
+        SceneNode<C> &scene_node;
+    };
+} // namespace akari
@@ -29,8 +29,15 @@ namespace akari {
         int spp = 16;
         int tile_size = 16;
         float occlude = std::numeric_limits<float>::infinity();
+        bool radiance_cache = false;
+        int cache_resolution = 256;
+        int cache_samples = 16;
         std::shared_ptr<cpu::Integrator<C>> compile(MemoryArena<> *arena) override {
-            return std::make_shared<cpu::Integrator<C>>(cpu::AmbientOcclusion<C>(spp, occlude));
+            cpu::AmbientOcclusion<C> ao(spp, occlude);
+            ao.radiance_cache = radiance_cache;
+            ao.cache_resolution = cache_resolution;
+            ao.cache_samples = cache_samples;
+            return std::make_shared<cpu::Integrator<C>>(ao);
         }
         const char *description() override { return "[Ambient Occlution]"; }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
@@ -39,6 +46,12 @@ namespace akari {
                 spp = value.get<int>().value();
             } else if (field == "occlude") {
                 occlude = value.get<float>().value();
+            } else if (field == "radiance_cache") {
+                radiance_cache = value.get<bool>().value();
+            } else if (field == "cache_resolution") {
+                cache_resolution = value.get<int>().value();
+            } else if (field == "cache_samples") {
+                cache_samples = value.get<int>().value();
             }
         }
 #ifdef AKR_ENABLE_GPU
@@ -55,8 +68,23 @@ namespace akari {
         int tile_size = 256;
         float ray_clamp = 10.0f;
         bool wavefront = true;
+        bool radiance_cache = false;
+        int cache_resolution = 256;
+        int cache_samples = 16;
+        int ris_candidates = 0;
+        int spatial_reuse = 0;
+        int spatial_radius = 16;
+        bool temporal_reuse = false;
         std::shared_ptr<cpu::Integrator<C>> compile(MemoryArena<> *arena) override {
-            return std::make_shared<cpu::Integrator<C>>(cpu::PathTracer<C>(spp));
+            cpu::PathTracer<C> pt(spp);
+            pt.radiance_cache = radiance_cache;
+            pt.cache_resolution = cache_resolution;
+            pt.cache_samples = cache_samples;
+            pt.ris_candidates = ris_candidates;
+            pt.spatial_reuse = spatial_reuse;
+            pt.spatial_radius = spatial_radius;
+            pt.temporal_reuse = temporal_reuse;
+            return std::make_shared<cpu::Integrator<C>>(pt);
         }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override {
@@ -72,6 +100,20 @@ namespace akari {
                 wavefront = value.get<bool>().value();
             } else if (field == "megakernel") {
                 wavefront = !value.get<bool>().value();
+            } else if (field == "radiance_cache") {
+                radiance_cache = value.get<bool>().value();
+            } else if (field == "cache_resolution") {
+                cache_resolution = value.get<int>().value();
+            } else if (field == "cache_samples") {
+                cache_samples = value.get<int>().value();
+            } else if (field == "ris_candidates") {
+                ris_candidates = value.get<int>().value();
+            } else if (field == "spatial_reuse") {
+                spatial_reuse = value.get<int>().value();
+            } else if (field == "spatial_radius") {
+                spatial_radius = value.get<int>().value();
+            } else if (field == "temporal_reuse") {
+                temporal_reuse = value.get<bool>().value();
             }
         }
 #ifdef AKR_ENABLE_GPU
@@ -82,11 +124,106 @@ namespace akari {
 #endif
         const char *description() override { return "[Path Tracer]"; }
     };
+    AKR_VARIANT class GuidedPathIntegratorNode : public IntegratorNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        int spp = 16;
+        int max_depth = 5;
+        int tile_size = 16;
+        float training_budget = 0.5f;
+        float bsdf_fraction = 0.5f;
+        float spatial_threshold = 12000.0f;
+        float directional_threshold = 0.01f;
+        std::shared_ptr<cpu::Integrator<C>> compile(MemoryArena<> *arena) override {
+            cpu::GuidedPathTracer<C> pt(spp, max_depth);
+            pt.tile_size = tile_size;
+            pt.training_budget = training_budget;
+            pt.bsdf_fraction = bsdf_fraction;
+            pt.spatial_threshold = spatial_threshold;
+            pt.directional_threshold = directional_threshold;
+            return std::make_shared<cpu::Integrator<C>>(pt);
+        }
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override {
+            if (field == "spp") {
+                spp = value.get<int>().value();
+            } else if (field == "max_depth") {
+                max_depth = value.get<int>().value();
+            } else if (field == "tile_size") {
+                tile_size = value.get<int>().value();
+            } else if (field == "training_budget") {
+                training_budget = value.get<float>().value();
+            } else if (field == "bsdf_fraction") {
+                bsdf_fraction = value.get<float>().value();
+            } else if (field == "spatial_threshold") {
+                spatial_threshold = value.get<float>().value();
+            } else if (field == "directional_threshold") {
+                directional_threshold = value.get<float>().value();
+            }
+        }
+        const char *description() override { return "[Guided Path Tracer]"; }
+    };
+    AKR_VARIANT class LightTracerIntegratorNode : public IntegratorNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        int spp = 16;
+        int max_depth = 5;
+        std::shared_ptr<cpu::Integrator<C>> compile(MemoryArena<> *arena) override {
+            return std::make_shared<cpu::Integrator<C>>(cpu::LightTracer<C>(spp, max_depth));
+        }
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override {
+            if (field == "spp") {
+                spp = value.get<int>().value();
+            } else if (field == "max_depth") {
+                max_depth = value.get<int>().value();
+            }
+        }
+        const char *description() override { return "[Light Tracer]"; }
+        // light paths splat anywhere in the image
+        bool supports_tiles() override { return false; }
+    };
+    AKR_VARIANT class SPPMIntegratorNode : public IntegratorNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        int iterations = 64;
+        int photons_per_iteration = 0;
+        int max_depth = 5;
+        float initial_radius = 0.0f;
+        float alpha = 0.7f;
+        std::shared_ptr<cpu::Integrator<C>> compile(MemoryArena<> *arena) override {
+            cpu::SPPM<C> sppm(iterations, max_depth);
+            sppm.photons_per_iteration = photons_per_iteration;
+            sppm.initial_radius = initial_radius;
+            sppm.alpha = alpha;
+            return std::make_shared<cpu::Integrator<C>>(sppm);
+        }
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override {
+            if (field == "iterations") {
+                iterations = value.get<int>().value();
+            } else if (field == "photons") {
+                photons_per_iteration = value.get<int>().value();
+            } else if (field == "max_depth") {
+                max_depth = value.get<int>().value();
+            } else if (field == "radius") {
+                initial_radius = value.get<float>().value();
+            } else if (field == "alpha") {
+                alpha = value.get<float>().value();
+            }
+        }
+        const char *description() override { return "[SPPM]"; }
+        // photons are traced for the visible points of the whole image
+        bool supports_tiles() override { return false; }
+    };
 
     AKR_VARIANT void RegisterIntegratorNode<C>::register_nodes() {
         AKR_IMPORT_TYPES()
         register_node<C, AOIntegratorNode<C>>("AO");
         register_node<C, PathIntegratorNode<C>>("Path");
+        register_node<C, GuidedPathIntegratorNode<C>>("GuidedPath");
+        register_node<C, LightTracerIntegratorNode<C>>("LightTracer");
+        register_node<C, SPPMIntegratorNode<C>>("SPPM");
     }
 
     AKR_VARIANT void RegisterIntegratorNode<C>::register_python_nodes(py::module &m) {
@@ -96,12 +233,44 @@ namespace akari {
             .def(py::init<>())
             .def_readwrite("spp", &AOIntegratorNode<C>::spp)
             .def_readwrite("tile_size", &AOIntegratorNode<C>::tile_size)
+            .def_readwrite("radiance_cache", &AOIntegratorNode<C>::radiance_cache)
+            .def_readwrite("cache_resolution", &AOIntegratorNode<C>::cache_resolution)
+            .def_readwrite("cache_samples", &AOIntegratorNode<C>::cache_samples)
             .def("commit", &AOIntegratorNode<C>::commit);
         py::class_<PathIntegratorNode<C>, IntegratorNode<C>, std::shared_ptr<PathIntegratorNode<C>>>(m, "Path")
             .def(py::init<>())
             .def_readwrite("spp", &PathIntegratorNode<C>::spp)
             .def_readwrite("tile_size", &PathIntegratorNode<C>::tile_size)
+            .def_readwrite("radiance_cache", &PathIntegratorNode<C>::radiance_cache)
+            .def_readwrite("cache_resolution", &PathIntegratorNode<C>::cache_resolution)
+            .def_readwrite("cache_samples", &PathIntegratorNode<C>::cache_samples)
+            .def_readwrite("ris_candidates", &PathIntegratorNode<C>::ris_candidates)
+            .def_readwrite("spatial_reuse", &PathIntegratorNode<C>::spatial_reuse)
+            .def_readwrite("spatial_radius", &PathIntegratorNode<C>::spatial_radius)
+            .def_readwrite("temporal_reuse", &PathIntegratorNode<C>::temporal_reuse)
             .def("commit", &PathIntegratorNode<C>::commit);
+        py::class_<GuidedPathIntegratorNode<C>, IntegratorNode<C>, std::shared_ptr<GuidedPathIntegratorNode<C>>>(
+            m, "GuidedPath")
+            .def(py::init<>())
+            .def_readwrite("spp", &GuidedPathIntegratorNode<C>::spp)
+            .def_readwrite("max_depth", &GuidedPathIntegratorNode<C>::max_depth)
+            .def_readwrite("training_budget", &GuidedPathIntegratorNode<C>::training_budget)
+            .def_readwrite("bsdf_fraction", &GuidedPathIntegratorNode<C>::bsdf_fraction)
+            .def("commit", &GuidedPathIntegratorNode<C>::commit);
+        py::class_<LightTracerIntegratorNode<C>, IntegratorNode<C>, std::shared_ptr<LightTracerIntegratorNode<C>>>(
+            m, "LightTracer")
+            .def(py::init<>())
+            .def_readwrite("spp", &LightTracerIntegratorNode<C>::spp)
+            .def_readwrite("max_depth", &LightTracerIntegratorNode<C>::max_depth)
+            .def("commit", &LightTracerIntegratorNode<C>::commit);
+        py::class_<SPPMIntegratorNode<C>, IntegratorNode<C>, std::shared_ptr<SPPMIntegratorNode<C>>>(m, "SPPM")
+            .def(py::init<>())
+            .def_readwrite("iterations", &SPPMIntegratorNode<C>::iterations)
+            .def_readwrite("photons", &SPPMIntegratorNode<C>::photons_per_iteration)
+            .def_readwrite("max_depth", &SPPMIntegratorNode<C>::max_depth)
+            .def_readwrite("radius", &SPPMIntegratorNode<C>::initial_radius)
+            .def_readwrite("alpha", &SPPMIntegratorNode<C>::alpha)
+            .def("commit", &SPPMIntegratorNode<C>::commit);
 #endif
     }
 
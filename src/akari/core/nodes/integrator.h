@@ -35,6 +35,9 @@ namespace akari {
         AKR_IMPORT_TYPES()
         virtual std::shared_ptr<cpu::Integrator<C>> compile(MemoryArena<>*arena) = 0;
         virtual std::shared_ptr<gpu::Integrator<C>> compile_gpu(MemoryArena<>*arena) { return nullptr; }
+        // false if the pixels of a tile depend on paths traced for the rest of the image, so the film cannot be
+        // rendered one tile at a time
+        virtual bool supports_tiles() { return true; }
     };
 
     AKR_VARIANT struct RegisterIntegratorNode {
@@ -0,0 +1,107 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifdef AKR_ENABLE_PYTHON
+#    include <pybind11/pybind11.h>
+#    include <pybind11/stl.h>
+#endif
+#include <akari/core/nodes/light.h>
+#include <akari/core/logger.h>
+#include <akari/core/parallel.h>
+#include <akari/core/resource.h>
+#include <akari/core/image.hpp>
+namespace akari {
+    AKR_VARIANT void EnvironmentLightNode<C>::commit() {
+        if (texture)
+            return;
+        auto res = resource_manager()->load_path<ImageResource>(path);
+        if (!res) {
+            auto err = res.extract_error();
+            error("error loading {}: {}", path, err.what());
+            throw std::runtime_error("Error loading image");
+        }
+        resource = res.extract_value();
+        texture = resource->texture();
+        // an alias table and inverted CDFs are different distributions
+        map = resource->derived<EnvironmentMap<C>>(alias, [&] {
+            auto image = texture->level(0);
+            auto res_ = image.resolution();
+            auto weights = EnvironmentLight<C>::sampling_weights(image);
+            auto map = std::make_shared<EnvironmentMap<C>>();
+            map->distribution =
+                Box<Distribution2D<C>>::make(default_resource(), weights.data(), res_.x, res_.y, alias, parallel_loop);
+            for (auto w : weights) {
+                map->integral += w;
+            }
+            map->integral *= 2.0f * Constants<Float>::Pi() * Constants<Float>::Pi() / (res_.x * res_.y);
+            return map;
+        });
+    }
+    AKR_VARIANT bool EnvironmentLightNode<C>::do_refresh() {
+        auto res = resource_manager()->load_path<ImageResource>(path);
+        if (!res || res.extract_value() == resource) {
+            return false;
+        }
+        // picks up the texture and the sampling distribution of the reloaded image
+        texture = nullptr;
+        commit();
+        return true;
+    }
+    AKR_VARIANT const EnvironmentLight<C> *EnvironmentLightNode<C>::compile(MemoryArena<> *arena) {
+        AKR_ASSERT_THROW(texture);
+        return arena->alloc<EnvironmentLight<C>>(texture->level(0), map->distribution.get(), scale);
+    }
+    AKR_VARIANT typename C::Float EnvironmentLightNode<C>::power(Float scene_radius) const {
+        // a disk of the scene's radius facing each direction
+        return scale * map->integral * scene_radius * scene_radius;
+    }
+    AKR_VARIANT void EnvironmentLightNode<C>::object_field(sdl::Parser &parser, sdl::ParserContext &ctx,
+                                                           const std::string &field, const sdl::Value &value) {
+        if (field == "image") {
+            path = ctx.resolve_path(value.get<std::string>().value()).string();
+        } else if (field == "scale") {
+            scale = value.get<float>().value();
+        } else if (field == "alias") {
+            alias = value.get<bool>().value();
+        }
+    }
+
+    AKR_VARIANT void RegisterLightNode<C>::register_nodes() {
+        AKR_IMPORT_TYPES()
+        register_node<C, EnvironmentLightNode<C>>("EnvironmentLight");
+    }
+
+    AKR_VARIANT void RegisterLightNode<C>::register_python_nodes(py::module &m) {
+#ifdef AKR_ENABLE_PYTHON
+        py::class_<EnvironmentLightNode<C>, SceneGraphNode<C>, std::shared_ptr<EnvironmentLightNode<C>>>(
+            m, "EnvironmentLight")
+            .def(py::init<>())
+            .def_readwrite("image", &EnvironmentLightNode<C>::path)
+            .def_readwrite("scale", &EnvironmentLightNode<C>::scale)
+            .def_readwrite("alias", &EnvironmentLightNode<C>::alias)
+            .def("commit", &EnvironmentLightNode<C>::commit);
+#endif
+    }
+
+    AKR_RENDER_CLASS(EnvironmentLightNode)
+    AKR_RENDER_STRUCT(RegisterLightNode)
+} // namespace akari
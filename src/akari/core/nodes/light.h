@@ -0,0 +1,65 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <akari/common/box.h>
+#include <akari/core/nodes/scenegraph.h>
+#include <akari/core/resource.h>
+#include <akari/kernel/light.h>
+
+namespace akari {
+    // what lights on the same image share besides its texture
+    AKR_VARIANT struct EnvironmentMap {
+        AKR_IMPORT_TYPES()
+        Box<Distribution2D<C>> distribution;
+        // integral of luminance over the sphere of directions
+        Float integral = 0.0f;
+    };
+    AKR_VARIANT class EnvironmentLightNode : public SceneGraphNode<C> {
+      public:
+        AKR_IMPORT_TYPES()
+        std::string path;
+        Float scale = 1.0f;
+        // sample the map through alias tables instead of inverting its CDFs
+        bool alias = false;
+        void commit() override;
+        const EnvironmentLight<C> *compile(MemoryArena<> *arena);
+        bool do_refresh() override;
+        // power in the units of SceneNode's area light power, for a scene of the given bounding radius
+        Float power(Float scene_radius) const;
+        void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
+                          const sdl::Value &value) override;
+
+      private:
+        // the resource image was read from, to tell when a refresh reloaded it
+        std::shared_ptr<const ImageResource> resource;
+        // the texels are those of the image textures on the same file
+        std::shared_ptr<const DeviceTexture> texture;
+        std::shared_ptr<const EnvironmentMap<C>> map;
+    };
+
+    AKR_VARIANT struct RegisterLightNode {
+        static void register_nodes();
+        static void register_python_nodes(py::module &m);
+    };
+
+} // namespace akari
@@ -45,40 +45,73 @@ namespace akari {
 
     AKR_VARIANT class ImageTextureNode : public TextureNode<C> {
       public:
-        std::shared_ptr<RGBAImage> image;
-        std::optional<Buffer<RGBA>> texture;
+        fs::path path;
+        // shared with every node that references the same file
+        std::shared_ptr<const DeviceTexture> texture;
+        // set instead of texture for .akt files, whose tiles are read on demand
+        std::shared_ptr<TiledImage> tiled;
         AKR_IMPORT_TYPES()
         ImageTextureNode() = default;
-        ImageTextureNode(const fs::path &path) {
+        ImageTextureNode(const fs::path &path) : path(path) { load(); }
+        Texture<C> *compile(MemoryArena<> *arena) override {
+            PackedImageView views[ImageTexture<C>::MaxLevels];
+            if (tiled) {
+                int n_levels = std::min(tiled->n_levels(), ImageTexture<C>::MaxLevels);
+                for (int i = 0; i < n_levels; i++) {
+                    views[i] = PackedImageView{nullptr, tiled->resolution(i), tiled->format()};
+                }
+                ImageTexture<C> tex(views, n_levels, tiled.get());
+                tex.mean_luminance = tiled->mean_luminance();
+                return arena->alloc<Texture<C>>(tex);
+            }
+            int n_levels = std::min(texture->n_levels(), ImageTexture<C>::MaxLevels);
+            for (int i = 0; i < n_levels; i++) {
+                views[i] = texture->level(i);
+            }
+            ImageTexture<C> tex(views, n_levels);
+            tex.mean_luminance = texture->mean_luminance;
+            return arena->alloc<Texture<C>>(tex);
+        }
+        // picks up the texture the resource manager currently holds for path; returns false if it is already loaded
+        bool load() {
+            if (path.extension() == ".akt") {
+                // tiles are paged in as they are read, so edits to the file are not picked up on refresh
+                if (tiled) {
+                    return false;
+                }
+                if (active_device()->is_gpu()) {
+                    error("{}: tiled textures are only supported on the cpu", path.string());
+                    throw std::runtime_error("Error loading image");
+                }
+                tiled = texture_cache()->open(path);
+                return true;
+            }
             auto res = resource_manager()->load_path<ImageResource>(path);
-            if (res) {
-                image = res.extract_value()->image();
-                texture.emplace(active_device()->device_resource());
-                auto &texels = texture.value();
-                texels.copy(image->texels());
-            } else {
+            if (!res) {
                 auto err = res.extract_error();
                 error("error loading {}: {}", path.string(), err.what());
                 throw std::runtime_error("Error loading image");
             }
+            auto loaded = res.extract_value()->texture();
+            if (loaded == texture) {
+                return false;
+            }
+            texture = loaded;
+            return true;
         }
-        Texture<C> *compile(MemoryArena<> *arena) override {
-            RGBAImage::View view{texture.value().data(), image->resolution()};
-            return arena->alloc<Texture<C>>(ImageTexture<C>(view));
-        }
+        bool do_refresh() override { return load(); }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override {}
     };
     AKR_VARIANT
-    static std::shared_ptr<TextureNode<C>> resolve_texture(const sdl::Value &value) {
+    static std::shared_ptr<TextureNode<C>> resolve_texture(sdl::ParserContext &ctx, const sdl::Value &value) {
         AKR_IMPORT_TYPES()
         if (value.is_array()) {
             return std::make_shared<ConstantTextureNode<C>>(load_array<Color3f>(value));
         } else if (value.is_number()) {
             return std::make_shared<ConstantTextureNode<C>>(Color3f(value.get<float>().value()));
         } else if (value.is_string()) {
-            auto path = value.get<std::string>().value();
-            return std::make_shared<ImageTextureNode<C>>(path);
+            return std::make_shared<ImageTextureNode<C>>(ctx.resolve_path(value.get<std::string>().value()));
         } else {
             AKR_ASSERT_THROW(value.is_object());
             auto tex = dyn_cast<TextureNode<C>>(value.object());
@@ -94,10 +127,11 @@ namespace akari {
             auto tex = color->compile(arena);
             return arena->alloc<Material<C>>(DiffuseMaterial<C>(tex));
         }
+        bool do_refresh() override { return color->refresh(); }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override {
             if (field == "color") {
-                color = resolve_texture<C>(value);
+                color = resolve_texture<C>(ctx, value);
             }
         }
     };
@@ -111,12 +145,14 @@ namespace akari {
             auto tex_rough = roughness->compile(arena);
             return arena->alloc<Material<C>>(GlossyMaterial<C>(tex, tex_rough));
         }
+        // refreshes every child, so none of them is left with a stale answer
+        bool do_refresh() override { return color->refresh() | roughness->refresh(); }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override {
             if (field == "color") {
-                color = resolve_texture<C>(value);
+                color = resolve_texture<C>(ctx, value);
             } else if (field == "roughness") {
-                roughness = resolve_texture<C>(value);
+                roughness = resolve_texture<C>(ctx, value);
             }
         }
     };
@@ -129,8 +165,10 @@ namespace akari {
             auto tex = fraction->compile(arena);
             auto a = first->compile(arena);
             auto b = second->compile(arena);
-            return arena->alloc<Material<C>>(MixMaterial<C>(tex, a, b));
+            auto table = arena->alloc<MixTable<C>>(tex, a, b);
+            return arena->alloc<Material<C>>(MixMaterial<C>(table));
         }
+        bool do_refresh() override { return fraction->refresh() | first->refresh() | second->refresh(); }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override {
             if (field == "first") {
@@ -140,7 +178,7 @@ namespace akari {
                 second = dyn_cast<MaterialNode<C>>(value.object());
                 AKR_ASSERT_THROW(first);
             } else if (field == "fraction") {
-                fraction = resolve_texture<C>(value);
+                fraction = resolve_texture<C>(ctx, value);
             }
         }
     };
@@ -153,10 +191,11 @@ namespace akari {
             auto tex = color->compile(arena);
             return arena->alloc<Material<C>>(EmissiveMaterial<C>(tex));
         }
+        bool do_refresh() override { return color->refresh(); }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override {
             if (field == "color") {
-                color = resolve_texture<C>(value);
+                color = resolve_texture<C>(ctx, value);
             }
         }
     };
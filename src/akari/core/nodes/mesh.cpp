@@ -59,6 +59,16 @@ namespace akari {
             }
             return instance;
         }
+        bool do_refresh() override {
+            auto loaded = mesh;
+            commit();
+            this->geometry_changed = mesh != loaded;
+            bool changed = this->geometry_changed;
+            for (auto &material : materials) {
+                changed |= material->refresh();
+            }
+            return changed;
+        }
         void set_material(uint32_t index, const std::shared_ptr<MaterialNode<C>> &mat) {
             AKR_ASSERT(mat);
             if (index >= materials.size()) {
@@ -69,7 +79,7 @@ namespace akari {
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override {
             if (field == "path") {
-                path = value.get<std::string>().value();
+                path = ctx.resolve_path(value.get<std::string>().value()).string();
             } else if (field == "materials") {
                 AKR_ASSERT_THROW(value.is_array());
                 for (auto mat : value) {
@@ -115,13 +125,12 @@ namespace akari {
 
       private:
         bool load_wavefront_obj(const fs::path &obj) {
-            info("loading {}", fs::absolute(obj).string());
+            fs::path file = fs::absolute(obj);
+            info("loading {}", file.string());
             loaded = obj.string();
-            fs::path parent_path = fs::absolute(obj).parent_path();
-            fs::path file = obj.filename();
-            CurrentPathGuard _;
-            if (!parent_path.empty())
-                fs::current_path(parent_path);
+            // .mtl files are looked up next to the .obj; the current directory is left alone, as other meshes may
+            // be loading at the same time
+            std::string mtl_dir = (file.parent_path() / "").string();
 
             tinyobj::attrib_t attrib;
             std::vector<tinyobj::shape_t> shapes;
@@ -131,7 +140,7 @@ namespace akari {
 
             std::string _file = file.string();
 
-            bool ret = misc::LoadObj(&attrib, &shapes, &obj_materials, &err, _file.c_str());
+            bool ret = misc::LoadObj(&attrib, &shapes, &obj_materials, &err, _file.c_str(), mtl_dir.c_str());
             (void)ret;
             mesh.vertices.resize(attrib.vertices.size());
             std::memcpy(&mesh.vertices[0], &attrib.vertices[0], sizeof(float) * mesh.vertices.size());
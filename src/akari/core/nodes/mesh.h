@@ -29,6 +29,8 @@ namespace akari {
       public:
         // AKR_IMPORT_TYPES()
         virtual MeshInstance<C> compile(MemoryArena<>*arena) = 0;
+        // set by refresh() when the vertices or indices were reloaded and the mesh's BVH must be rebuilt
+        bool geometry_changed = false;
     };
 
     AKR_VARIANT struct RegisterMeshNode {
@@ -19,7 +19,6 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
-#include <csignal>
 #ifdef AKR_ENABLE_PYTHON
 #    include <pybind11/pybind11.h>
 #    include <pybind11/embed.h>
@@ -27,71 +26,144 @@
 #endif
 #include <akari/common/box.h>
 #include <akari/core/nodes/scene.h>
-#include <akari/kernel/embree.inl>
-#include <akari/kernel/bvh-accelerator.h>
+#include <akari/core/nodes/session.h>
+#include <akari/core/cancellation.h>
 #include <akari/core/film.h>
+#include <akari/core/parallel.h>
 #include <akari/core/profiler.h>
+#include <akari/core/texture-cache.h>
 namespace akari {
     AKR_VARIANT void SceneNode<C>::commit() {
+        // shapes and the environment load their files independently of each other
+        std::vector<Future<void>> loads;
         for (auto &shape : shapes) {
             AKR_ASSERT_THROW(shape);
-            shape->commit();
+            loads.emplace_back(async_do([shape = shape] { shape->commit(); }));
+        }
+        if (environment) {
+            loads.emplace_back(async_do([env = environment] { env->commit(); }));
         }
         AKR_ASSERT_THROW(camera);
         camera->commit();
+        when_all(std::move(loads)).get();
     }
     AKR_VARIANT Scene<C> SceneNode<C>::compile(MemoryArena<> *arena) {
         Scene<C> scene;
 
         scene.camera = camera->compile(arena);
+        instances.clear();
         for (auto &shape : shapes) {
             instances.emplace_back(shape->compile(arena));
         }
         scene.meshes = {instances.data(), instances.size()};
-        std::vector<AreaLight<C>> area_light_buffer;
-        std::vector<Float> power;
-        std::unordered_map<const Texture<C> *, std::future<Float>> ft_integrals;
-        std::unordered_map<const Texture<C> *, Float> integrals;
+        compile_lights(scene, arena);
+        return scene;
+    }
+    AKR_VARIANT void SceneNode<C>::compile_lights(Scene<C> &scene, MemoryArena<> *arena) {
+        host_area_lights.clear();
+        host_light_indices.clear();
+        light_index_offsets.clear();
+        emission_integrals.clear();
+        std::unordered_map<const Texture<C> *, Future<Float>> ft_integrals;
         for (uint32_t mesh_id = 0; mesh_id < scene.meshes.size(); mesh_id++) {
             MeshInstance<C> &mesh = scene.meshes[mesh_id];
+            light_index_offsets.emplace_back(host_light_indices.size());
             for (uint32_t prim_id = 0; prim_id < mesh.indices.size() / 3; prim_id++) {
                 auto triangle = scene.get_triangle(mesh_id, prim_id);
                 auto material = triangle.material;
+                host_light_indices.emplace_back(-1);
                 if (!material)
                     continue;
                 if (material->template isa<EmissiveMaterial<C>>()) {
                     const EmissiveMaterial<C> *e = material->template get<EmissiveMaterial<C>>();
                     auto color = e->color;
                     if (ft_integrals.find(color) == ft_integrals.end()) {
-                        ft_integrals.emplace(color, std::async(std::launch::async, [=] { return color->integral(); }));
+                        ft_integrals.emplace(color, async_do([=] { return color->integral(); }));
                     }
-                    (void)e;
-                    area_light_buffer.emplace_back(triangle);
+                    host_light_indices.back() = (int)host_area_lights.size();
+                    host_area_lights.emplace_back(triangle);
                 }
             }
         }
         for (auto &pair : ft_integrals) {
-            integrals[pair.first] = pair.second.get();
-        }
-        for (size_t i = 0; i < area_light_buffer.size(); i++) {
-            auto &light = area_light_buffer[i];
-            auto color = light.color;
-            auto I = integrals[color];
-            auto &triangle = light.triangle;
-            Float3 tc[3];
-            for (int j = 0; j < 3; j++)
-                tc[j] = Float3(triangle.texcoords[j].x, triangle.texcoords[j].y, 0.0);
-            auto tc_area = length(cross(tc[1] - tc[0], tc[2] - tc[0])) * 0.5;
-            auto area =
-                length(cross(triangle.vertices[1] - triangle.vertices[0], triangle.vertices[2] - triangle.vertices[0]));
-            power.emplace_back(area * tc_area * I);
-        }
-        light_distribution = Box<Distribution1D<C>>::make(default_resource(), power.data(), power.size());
+            emission_integrals[pair.first] = pair.second.get();
+        }
+        light_power.clear();
+        for (auto &light : host_area_lights) {
+            light_power.emplace_back(area_light_power(light));
+        }
+        if (environment) {
+            scene.environment_light = environment->compile(arena);
+            light_power.emplace_back(0.0f);
+        }
+        light_indices.copy(host_light_indices.data(), host_light_indices.size());
+        for (uint32_t mesh_id = 0; mesh_id < scene.meshes.size(); mesh_id++) {
+            auto &mesh = scene.meshes[mesh_id];
+            mesh.light_indices = {light_indices.data() + light_index_offsets[mesh_id], mesh.indices.size() / 3};
+        }
+        build_light_samplers(scene);
+    }
+    AKR_VARIANT void SceneNode<C>::update_lights(Scene<C> &scene, const std::vector<uint32_t> &mesh_ids) {
+        for (auto mesh_id : mesh_ids) {
+            auto &mesh = scene.meshes[mesh_id];
+            for (uint32_t prim_id = 0; prim_id < mesh.indices.size() / 3; prim_id++) {
+                auto index = host_light_indices[light_index_offsets[mesh_id] + prim_id];
+                if (index < 0)
+                    continue;
+                host_area_lights[index] = AreaLight<C>(scene.get_triangle(mesh_id, prim_id));
+                light_power[index] = area_light_power(host_area_lights[index]);
+            }
+        }
+        build_light_samplers(scene);
+    }
+    AKR_VARIANT auto SceneNode<C>::area_light_power(const AreaLight<C> &light) const -> Float {
+        auto I = emission_integrals.at(light.color);
+        auto &triangle = light.triangle;
+        Float3 tc[3];
+        for (int j = 0; j < 3; j++)
+            tc[j] = Float3(triangle.texcoords[j].x, triangle.texcoords[j].y, 0.0);
+        auto tc_area = length(cross(tc[1] - tc[0], tc[2] - tc[0])) * 0.5;
+        auto area =
+            length(cross(triangle.vertices[1] - triangle.vertices[0], triangle.vertices[2] - triangle.vertices[0]));
+        return area * tc_area * I;
+    }
+    AKR_VARIANT void SceneNode<C>::build_light_samplers(Scene<C> &scene) {
+        scene.light_bvh = nullptr;
+        light_bvh.reset();
+        if (environment) {
+            auto bounds = scene.bounds();
+            Float radius = bounds.empty() ? Float(1.0f) : length(bounds.extents()) * 0.5f;
+            // power-proportional selection treats the environment as one more light after the area lights
+            light_power.back() = environment->power(radius);
+        }
+        light_distribution =
+            Box<Distribution1D<C>>::make(default_resource(), light_power.data(), light_power.size(), parallel_loop);
         scene.light_distribution = light_distribution.get();
-        area_lights.copy(area_light_buffer.data(), area_light_buffer.size());
+        if (light_sampler == "bvh" && !host_area_lights.empty()) {
+            Timer timer;
+            light_bvh = Box<LightBVH<C>>::make(default_resource(), host_area_lights.data(), light_power.data(),
+                                               host_area_lights.size());
+            scene.light_bvh = light_bvh.get();
+            info("light BVH: {} nodes for {} lights ({}s)", light_bvh->num_nodes(), host_area_lights.size(),
+                 timer.elapsed_seconds());
+        } else if (light_sampler != "power" && light_sampler != "bvh") {
+            warning("unknown light sampler {}, using power", light_sampler);
+        }
+        area_lights.copy(host_area_lights.data(), host_area_lights.size());
         scene.area_lights = area_lights.view();
-
-        return scene;
+    }
+    AKR_VARIANT auto SceneNode<C>::crop_window(const int2 &resolution) const -> Bounds2i {
+        Bounds2i image{int2(0), resolution};
+        if (!(crop[2] > crop[0] && crop[3] > crop[1])) {
+            return image;
+        }
+        auto window = Bounds2i{int2(crop[0], crop[1]), int2(crop[2], crop[3])}.intersect(image);
+        if (any(window.pmin >= window.pmax)) {
+            error("crop window [{}, {}) x [{}, {}) lies outside the {}x{} image", crop[0], crop[2], crop[1], crop[3],
+                  resolution.x, resolution.y);
+            throw std::runtime_error("Empty crop window");
+        }
+        return window;
     }
     AKR_VARIANT void SceneNode<C>::object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                                                 const sdl::Value &value) {
@@ -100,6 +172,15 @@ namespace akari {
             AKR_ASSERT_THROW(camera);
         } else if (field == "output") {
             output = value.get<std::string>().value();
+        } else if (field == "light_sampler") {
+            light_sampler = value.get<std::string>().value();
+        } else if (field == "crop") {
+            crop = load_array<int4>(value);
+        } else if (field == "preview") {
+            preview = value.get<bool>().value();
+        } else if (field == "environment") {
+            environment = dyn_cast<EnvironmentLightNode<C>>(value.object());
+            AKR_ASSERT_THROW(environment);
         } else if (field == "integrator") {
             integrator = dyn_cast<IntegratorNode<C>>(value.object());
             AKR_ASSERT_THROW(integrator);
@@ -111,57 +192,48 @@ namespace akari {
         }
     }
     AKR_VARIANT void SceneNode<C>::render() {
-        /*
-        We want to restore the SIGINT handler so that the user can interrupt the renderer
-        */
-        auto _prev_SIGINT_handler = signal(SIGINT, SIG_DFL);
-        auto _restore_handler = AtScopeExit([=]() { signal(SIGINT, _prev_SIGINT_handler); });
-        commit();
-        info("preparing scene");
-        TrackedManagedMemoryResource resource(active_device()->managed_resource());
-        auto arena = MemoryArena<>(astd::pmr::polymorphic_allocator<>(&resource));
-        auto scene = compile(&arena);
-        auto res = scene.camera.resolution();
-        auto film = Film<C>(res);
-        scene.sampler = LCGSampler<C>();
-        auto gpu_accel = Box<BVHAccelerator<C>>::make();
-        std::unique_ptr<EmbreeAccelerator<C>> embree_accel;
-        if (active_device() == gpu_device() || !akari_enable_embree) {
-            scene.accel = gpu_accel.get();
-        } else {
-            embree_accel = std::make_unique<EmbreeAccelerator<C>>();
-            scene.accel = embree_accel.get();
-        }
-        scene.commit();
-        resource.prefetch();
-        auto render_cpu = [&]() {
-            auto integrator_ = integrator->compile(&arena);
-            integrator_->render(scene, &film);
-        };
-#ifdef AKR_ENABLE_GPU
-        auto render_gpu = [&]() {
-            auto integrator_ = integrator->compile_gpu(&arena);
-            if (!integrator_) {
-                fatal("integrator {} is not supported on gpu", integrator->description());
-                std::exit(0);
+        RenderSession<C> session(*this);
+        // Ctrl-C (or SIGTERM) stops the integrator at the next tile; the pixels rendered so far are still written.
+        // Until the scene is loaded it still ends the process.
+        InterruptHandler interrupt;
+        auto nothing_rendered = [&] {
+            if (render_cancellation().is_cancelled() && !session.get_film().has_samples()) {
+                warning("render interrupted before any sample was taken; {} is left as it was", output);
+                return true;
             }
-            integrator_->render(scene, &film);
-            active_device()->sync();
+            return false;
         };
-#else
-        auto render_gpu = [&]() {
-            fatal("gpu rendering is not supported");
-            std::exit(1);
-        };
-#endif
+        if (preview) {
+            auto camera_ = session.get_scene().camera;
+            auto res = camera_.resolution();
+            for (int factor : {4, 2}) {
+                Timer timer;
+                session.set_camera(camera_.with_resolution(max(res / factor, int2(1))));
+                session.render();
+                if (nothing_rendered()) {
+                    return;
+                }
+                info("preview at 1/{} resolution took ({}s)", factor, timer.elapsed_seconds());
+                session.get_film().write_image(fs::path(output), res);
+                if (render_cancellation().is_cancelled()) {
+                    warning("render interrupted; kept the preview in {}", output);
+                    return;
+                }
+            }
+            session.set_camera(camera_);
+        }
         Timer timer;
-        if (active_device() == cpu_device()) {
-            render_cpu();
+        session.render();
+        if (nothing_rendered()) {
+            return;
+        }
+        if (render_cancellation().is_cancelled()) {
+            warning("render interrupted after {}s; writing the partial image", timer.elapsed_seconds());
         } else {
-            render_gpu();
+            info("render done took ({}s)", timer.elapsed_seconds());
         }
-        info("render done took ({}s)", timer.elapsed_seconds());
-        film.write_image(fs::path(output));
+        texture_cache()->report();
+        session.write_image(fs::path(output));
     }
 
     AKR_VARIANT void RegisterSceneNode<C>::register_nodes() {
@@ -177,7 +249,11 @@ namespace akari {
             .def_readwrite("variant", &SceneNode<C>::variant)
             .def_readwrite("camera", &SceneNode<C>::camera)
             .def_readwrite("output", &SceneNode<C>::output)
+            .def_readwrite("light_sampler", &SceneNode<C>::light_sampler)
+            .def_readwrite("crop", &SceneNode<C>::crop)
+            .def_readwrite("preview", &SceneNode<C>::preview)
             .def_readwrite("integrator", &SceneNode<C>::integrator)
+            .def_readwrite("environment", &SceneNode<C>::environment)
             .def("render", &SceneNode<C>::render)
             .def("add_mesh", &SceneNode<C>::add_mesh);
 #endif
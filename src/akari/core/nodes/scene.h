@@ -20,6 +20,7 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 #pragma once
+#include <unordered_map>
 #include <akari/common/distribution.h>
 #include <akari/common/box.h>
 #include <akari/core/nodes/scenegraph.h>
@@ -27,6 +28,7 @@
 #include <akari/core/nodes/mesh.h>
 #include <akari/core/nodes/material.h>
 #include <akari/core/nodes/integrator.h>
+#include <akari/core/nodes/light.h>
 #include <akari/kernel/scene.h>
 namespace akari {
     AKR_VARIANT class AKR_EXPORT SceneNode : public SceneGraphNode<C> {
@@ -37,18 +39,48 @@ namespace akari {
         std::shared_ptr<CameraNode<C>> camera;
         std::vector<std::shared_ptr<MeshNode<C>>> shapes;
         std::string output;
+        // "power" picks lights in proportion to their power; "bvh" also weighs their distance and orientation to the
+        // shaded point, which helps scenes with many small lights but changes the noise of existing renders
+        std::string light_sampler = "power";
+        // pixel bounds [x0, y0, x1, y1) to render; empty renders the whole frame
+        int4 crop = int4(0);
+        // renders at 1/4 and 1/2 resolution first, writing each to output before the full image replaces it
+        bool preview = false;
         std::shared_ptr<IntegratorNode<C>> integrator;
+        std::shared_ptr<EnvironmentLightNode<C>> environment;
         Buffer<AreaLight<C>> area_lights;
+        Buffer<int> light_indices;
         Box<Distribution1D<C>> light_distribution;
+        Box<LightBVH<C>> light_bvh;
         void commit() override;
         Scene<C> compile(MemoryArena<> *arena);
+        // (re)builds the area lights, light samplers and environment light of a compiled scene
+        void compile_lights(Scene<C> &scene, MemoryArena<> *arena);
+        // updates the area lights on meshes whose vertices moved since compile_lights() and rebuilds the light samplers;
+        // the meshes keep their triangles and materials, and nothing is allocated from the arena
+        void update_lights(Scene<C> &scene, const std::vector<uint32_t> &mesh_ids);
+        // crop clipped to the image, or the whole image if crop is empty; throws if nothing of crop is inside
+        Bounds2i crop_window(const int2 &resolution) const;
         void render();
         void add_mesh(const std::shared_ptr<MeshNode<C>> &mesh) { shapes.emplace_back(mesh); }
         void object_field(sdl::Parser &parser, sdl::ParserContext &ctx, const std::string &field,
                           const sdl::Value &value) override;
         SceneNode()
             : instances(TAllocator<MeshInstance<C>>(default_resource())),
-              area_lights(active_device()->device_resource()) {}
+              area_lights(active_device()->device_resource()),
+              light_indices(active_device()->device_resource()) {}
+
+      private:
+        Float area_light_power(const AreaLight<C> &light) const;
+        // the light distribution and BVH over light_power, and the device copy of the area lights
+        void build_light_samplers(Scene<C> &scene);
+        // host side of the lights built by compile_lights(), kept so that update_lights() only touches moved meshes
+        std::vector<AreaLight<C>> host_area_lights;
+        std::vector<int> host_light_indices;
+        std::vector<size_t> light_index_offsets;
+        // one entry per area light, then one for the environment if there is one
+        std::vector<Float> light_power;
+        std::unordered_map<const Texture<C> *, Float> emission_integrals;
     };
 
     AKR_VARIANT struct RegisterSceneNode {
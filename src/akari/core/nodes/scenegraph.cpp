@@ -30,6 +30,7 @@
 #include <akari/core/nodes/scenegraph.h>
 #include <akari/common/config.h>
 #include <akari/core/mesh.h>
+#include <akari/core/resource.h>
 #include <akari/kernel/scene.h>
 #include <akari/core/logger.h>
 #include <akari/core/film.h>
@@ -37,8 +38,20 @@
 #include <akari/core/nodes/mesh.h>
 #include <akari/core/nodes/material.h>
 #include <akari/core/nodes/integrator.h>
+#include <akari/core/nodes/light.h>
 #include <akari/core/nodes/scene.h>
+#include <akari/core/nodes/session.h>
+#include <akari/core/nodes/batch.h>
+#include <akari/core/nodes/animation.h>
 namespace akari {
+    bool Node::refresh() {
+        auto generation = resource_manager()->generation();
+        if (generation != refreshed_generation) {
+            refreshed_generation = generation;
+            changed = do_refresh();
+        }
+        return changed;
+    }
     namespace __node_register {
         static std::unordered_map<std::string_view, std::unordered_map<std::string, Node::CreateFunc>> map;
     }
@@ -74,6 +87,10 @@ namespace akari {
         RegisterMeshNode<C>::register_python_nodes(m);
         RegisterMaterialNode<C>::register_python_nodes(m);
         RegisterIntegratorNode<C>::register_python_nodes(m);
+        RegisterLightNode<C>::register_python_nodes(m);
+        RegisterRenderSession<C>::register_python_nodes(m);
+        RegisterBatchNode<C>::register_python_nodes(m);
+        RegisterAnimationNode<C>::register_python_nodes(m);
         m.def("set_device_cpu", []() {
             warning("compute device set to cpu\n");
             warning("use akari [scene file] instead\n");
@@ -94,6 +111,9 @@ namespace akari {
         RegisterMeshNode<C>::register_nodes();
         RegisterMaterialNode<C>::register_nodes();
         RegisterIntegratorNode<C>::register_nodes();
+        RegisterLightNode<C>::register_nodes();
+        RegisterBatchNode<C>::register_nodes();
+        RegisterAnimationNode<C>::register_nodes();
     }
 
     AKR_RENDER_STRUCT(RegisterSceneGraph)
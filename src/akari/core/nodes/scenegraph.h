@@ -40,12 +40,22 @@ namespace pybind11 {
 namespace akari {
     namespace py = pybind11;
     class Node;
-    class Node : public sdl::Object {
+    class AKR_EXPORT Node : public sdl::Object {
       public:
         virtual void commit() {}
         virtual const char *description() { return "unknown"; }
         virtual ~Node() = default;
         typedef std::shared_ptr<Node> (*CreateFunc)(void);
+        // Picks up resources reloaded by ResourceManager::refresh(). Returns true if this node or a node it refers
+        // to changed and must be compiled again. Answers once per reload, so nodes shared by several parents agree.
+        bool refresh();
+
+      protected:
+        virtual bool do_refresh() { return false; }
+
+      private:
+        uint64_t refreshed_generation = 0;
+        bool changed = false;
     };
     AKR_VARIANT class SceneGraphNode : public Node { public: };
     AKR_VARIANT class SceneNode;
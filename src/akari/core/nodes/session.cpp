@@ -0,0 +1,185 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifdef AKR_ENABLE_PYTHON
+#    include <pybind11/pybind11.h>
+#    include <pybind11/stl.h>
+#endif
+#include <akari/core/nodes/session.h>
+#include <akari/kernel/embree.inl>
+#include <akari/kernel/bvh-accelerator.h>
+#include <akari/core/profiler.h>
+#include <akari/core/resource.h>
+namespace akari {
+    AKR_VARIANT RenderSession<C>::RenderSession(SceneNode<C> &scene_node)
+        : scene_node(scene_node), resource(active_device()->managed_resource()),
+          arena(astd::pmr::polymorphic_allocator<>(&resource)),
+          camera_arena(astd::pmr::polymorphic_allocator<>(&resource)) {
+        Timer timer;
+        scene_node.commit();
+        info("preparing scene");
+        scene = scene_node.compile(&arena);
+        scene.sampler = LCGSampler<C>();
+        if (active_device() != cpu_device() || !akari_enable_embree) {
+            bvh_accel = Box<BVHAccelerator<C>>::make();
+            scene.accel = bvh_accel.get();
+        } else {
+            embree_accel = std::make_unique<EmbreeAccelerator<C>>();
+            scene.accel = embree_accel.get();
+        }
+        scene.commit();
+        resource.prefetch();
+        if (active_device() == cpu_device()) {
+            integrator = scene_node.integrator->compile(&arena);
+        } else {
+            gpu_integrator = scene_node.integrator->compile_gpu(&arena);
+            if (!gpu_integrator) {
+                fatal("integrator {} is not supported on gpu", scene_node.integrator->description());
+                std::exit(0);
+            }
+        }
+        base_resolution = scene.camera.resolution();
+        crop_window = scene_node.crop_window(base_resolution);
+        if (any(crop_window.size() < base_resolution)) {
+            info("crop window: [{}, {}) x [{}, {})", crop_window.pmin.x, crop_window.pmax.x, crop_window.pmin.y,
+                 crop_window.pmax.y);
+        }
+        set_camera(scene.camera);
+        info("scene prepared ({}s)", timer.elapsed_seconds());
+    }
+    AKR_VARIANT RenderSession<C>::~RenderSession() = default;
+
+    AKR_VARIANT void RenderSession<C>::set_camera(const std::shared_ptr<CameraNode<C>> &camera) {
+        AKR_ASSERT_THROW(camera);
+        camera->commit();
+        scene_node.camera = camera;
+        camera_arena.reset();
+        set_camera(camera->compile(&camera_arena));
+    }
+    AKR_VARIANT void RenderSession<C>::set_camera(const Camera<C> &camera) {
+        scene.camera = camera;
+        auto res = camera.resolution();
+        // rounds outwards so that a scaled down window still covers its pixels
+        auto pmin = crop_window.pmin * res / base_resolution;
+        auto pmax = (crop_window.pmax * res + base_resolution - int2(1)) / base_resolution;
+        view_window = Bounds2i{pmin, pmax};
+        film = std::make_unique<Film<C>>(res, view_window);
+    }
+    AKR_VARIANT void RenderSession<C>::render(int spp) {
+        // leaves nothing of earlier regions outside the view window
+        film->clear(Bounds2i{int2(0), film->resolution()});
+        render_region(view_window, spp);
+    }
+    AKR_VARIANT void RenderSession<C>::render_region(const Bounds2i &region, int spp) {
+        film->clear(region);
+        if (integrator) {
+            auto integrator_ = *integrator;
+            if (spp > 0) {
+                integrator_.set_spp(spp);
+            }
+            integrator_.render(scene, film.get());
+        } else {
+#ifdef AKR_ENABLE_GPU
+            auto integrator_ = *gpu_integrator;
+            if (spp > 0) {
+                integrator_.set_spp(spp);
+            }
+            integrator_.render(scene, film.get());
+            active_device()->sync();
+#else
+            fatal("gpu rendering is not supported");
+            std::exit(1);
+#endif
+        }
+    }
+    AKR_VARIANT bool RenderSession<C>::refresh() {
+        Timer timer;
+        if (resource_manager()->refresh().empty()) {
+            return false;
+        }
+        // materials replaced here stay in the arena until the session ends
+        size_t n_compiled = 0;
+        std::vector<uint32_t> rebuilt;
+        for (uint32_t i = 0; i < scene_node.shapes.size(); i++) {
+            auto &shape = scene_node.shapes[i];
+            if (!shape->refresh()) {
+                continue;
+            }
+            scene_node.instances[i] = shape->compile(&arena);
+            n_compiled++;
+            if (shape->geometry_changed) {
+                rebuilt.emplace_back(i);
+            }
+        }
+        if (!rebuilt.empty()) {
+            scene.update(rebuilt);
+        }
+        bool environment_changed = scene_node.environment && scene_node.environment->refresh();
+        if (n_compiled == 0 && !environment_changed) {
+            return false;
+        }
+        scene_node.compile_lights(scene, &arena);
+        resource.prefetch();
+        info("refreshed {} of {} shapes, rebuilt {} BVHs ({}s)", n_compiled, scene_node.shapes.size(), rebuilt.size(),
+             timer.elapsed_seconds());
+        return true;
+    }
+    AKR_VARIANT void RenderSession<C>::update_meshes(const std::vector<uint32_t> &mesh_ids) {
+        if (mesh_ids.empty()) {
+            return;
+        }
+        scene.update(mesh_ids);
+        // runs once per animation frame, so it must not allocate from the session's arena
+        scene_node.update_lights(scene, mesh_ids);
+    }
+
+    AKR_VARIANT void RegisterRenderSession<C>::register_python_nodes(py::module &m) {
+#ifdef AKR_ENABLE_PYTHON
+        py::class_<RenderSession<C>, std::shared_ptr<RenderSession<C>>>(m, "RenderSession")
+            .def(py::init<SceneNode<C> &>(), py::keep_alive<1, 2>())
+            .def("set_camera",
+                 [](RenderSession<C> &session, const std::shared_ptr<CameraNode<C>> &camera) {
+                     session.set_camera(camera);
+                 })
+            .def("render", &RenderSession<C>::render, py::arg("spp") = 0)
+            .def("refresh", &RenderSession<C>::refresh)
+            .def("write_image", [](const RenderSession<C> &session,
+                                   const std::string &path) { session.write_image(fs::path(path)); })
+            .def("get_image", [](const RenderSession<C> &session) {
+                // rows of [r, g, b, a]
+                auto image = session.get_image();
+                auto res = image.resolution();
+                std::vector<std::vector<std::array<float, 4>>> rows(res.y);
+                for (int y = 0; y < res.y; y++) {
+                    rows[y].resize(res.x);
+                    for (int x = 0; x < res.x; x++) {
+                        auto &texel = image(x, y);
+                        rows[y][x] = {texel.rgb[0], texel.rgb[1], texel.rgb[2], texel.alpha};
+                    }
+                }
+                return rows;
+            });
+#endif
+    }
+
+    AKR_RENDER_CLASS(RenderSession)
+    AKR_RENDER_STRUCT(RegisterRenderSession)
+} // namespace akari
@@ -0,0 +1,79 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#pragma once
+#include <akari/core/nodes/scene.h>
+#include <akari/core/film.h>
+namespace akari {
+    // Keeps a scene compiled between renders. Nodes are committed, materials compiled and accelerators built once,
+    // so a new view costs only the render itself.
+    AKR_VARIANT class AKR_EXPORT RenderSession {
+      public:
+        AKR_IMPORT_TYPES()
+        // scene_node must outlive the session
+        explicit RenderSession(SceneNode<C> &scene_node);
+        ~RenderSession();
+        RenderSession(const RenderSession &) = delete;
+        RenderSession &operator=(const RenderSession &) = delete;
+        void set_camera(const std::shared_ptr<CameraNode<C>> &camera);
+        // the film follows the camera's resolution; the scene's crop window is scaled to match
+        void set_camera(const Camera<C> &camera);
+        // renders the current view into a cleared film
+        // @param spp: overrides the integrator's samples per pixel if positive
+        void render(int spp = 0);
+        // renders only the pixels in region, clipped to the film; they are cleared first and the rest of the film
+        // keeps earlier renders, so tiles rendered one after another add up to the image
+        void render_region(const Bounds2i &region, int spp = 0);
+        // Reloads meshes and textures whose files changed since they were loaded. Only the shapes using them are
+        // compiled again and only the BVHs of reloaded meshes are rebuilt. Returns true if anything changed.
+        bool refresh();
+        // rebuilds the BVHs of the scene node's instances whose vertices were replaced, and the lights on them
+        void update_meshes(const std::vector<uint32_t> &mesh_ids);
+        // linear radiance of the last render
+        RGBAImage get_image() const { return film->to_rgba_image(); }
+        void write_image(const fs::path &path) const { film->write_image(path); }
+        const Film<C> &get_film() const { return *film; }
+        const Scene<C> &get_scene() const { return scene; }
+
+      private:
+        SceneNode<C> &scene_node;
+        TrackedManagedMemoryResource resource;
+        MemoryArena<> arena;
+        // cameras passed to set_camera() are compiled here; it is reset for each one, so that a camera set every
+        // animation frame does not grow the session's arena
+        MemoryArena<> camera_arena;
+        Scene<C> scene;
+        Box<BVHAccelerator<C>> bvh_accel;
+        std::unique_ptr<EmbreeAccelerator<C>> embree_accel;
+        std::shared_ptr<cpu::Integrator<C>> integrator;
+        std::shared_ptr<gpu::Integrator<C>> gpu_integrator;
+        // crop window at the resolution of the scene's own camera
+        Bounds2i crop_window;
+        // crop window at the current camera's resolution
+        Bounds2i view_window;
+        int2 base_resolution;
+        std::unique_ptr<Film<C>> film;
+    };
+
+    AKR_VARIANT struct RegisterRenderSession {
+        static void register_python_nodes(py::module &m);
+    };
+} // namespace akari
@@ -26,6 +26,12 @@
 namespace akari {
     struct AKR_EXPORT GlobalOptions {
         bool enable_profile = false;
+        // threads running parallel work, 0 picks one per available CPU; both are read when the pool starts and
+        // override AKARI_NUM_THREADS / AKARI_PIN_THREADS
+        int num_threads = 0;
+        bool pin_threads = false;
+        // memory for resident tiles of .akt textures, 0 reads $AKARI_TEXTURE_CACHE_MB or uses 1024
+        size_t texture_cache_mb = 0;
         static GlobalOptions * get();
     };
     
@@ -20,117 +20,493 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 #include <akari/core/parallel.h>
+#include <akari/core/logger.h>
+#include <akari/core/options.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <deque>
+#include <fstream>
 #include <memory>
 #include <mutex>
+#include <random>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef AKR_PLATFORM_WINDOWS
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <windows.h>
+#    undef NOMINMAX
+#elif defined(AKR_PLATFORM_LINUX)
+#    include <pthread.h>
+#    include <sched.h>
+#endif
 
 namespace akari {
-    size_t num_work_threads() { return std::thread::hardware_concurrency(); }
-    struct ParallelForContext {
-        std::atomic_uint32_t workIndex;
-        size_t count = 0;
-        uint32_t chunkSize = 0;
-        ParallelForContext() : workIndex(0) {}
-        const std::function<void(uint32_t, uint32_t)> *func = nullptr;
-        bool done() const { return workIndex >= count; }
-        ParallelForContext(const ParallelForContext &rhs)
-            : workIndex(rhs.workIndex.load()), count(rhs.count), chunkSize(rhs.chunkSize), func(rhs.func) {}
+    struct Task {
+        std::function<void()> func;
+        TaskGroup *group = nullptr;
+        // ThreadBudget of the submitting thread, in force while the task runs; 0 if unlimited
+        size_t budget = 0;
     };
 
-    struct ParallelForWorkPool {
-        std::deque<ParallelForContext> works;
-        std::vector<std::thread> threads;
-        std::condition_variable hasWork, oneThreadFinished, mainWaiting;
-        std::mutex workMutex;
-        std::atomic_bool stopped;
-        std::uint32_t workId;
-        std::uint32_t nThreadFinished;
-        ParallelForWorkPool() : workId(0), nThreadFinished(0) {
-            stopped = false;
-            auto n = num_work_threads();
-            for (uint32_t tid = 0; tid < n; tid++) {
-                threads.emplace_back([=]() {
-                    while (!stopped) {
-                        std::unique_lock<std::mutex> lock(workMutex);
-                        while (works.empty() && !stopped) {
-                            hasWork.wait(lock);
-                        }
-                        if (stopped)
-                            return;
-                        auto &loop = works.front();
-                        auto id = workId;
-                        lock.unlock();
-                        // lock held
-                        while (!loop.done()) {
-                            auto begin = loop.workIndex.fetch_add(loop.chunkSize);
-                            for (auto i = begin; i < begin + loop.chunkSize && i < loop.count; i++) {
-                                (*loop.func)(i, tid);
-                            }
-                        }
-                        lock.lock();
-                        nThreadFinished++;
-                        oneThreadFinished.notify_all();
-
-                        while (nThreadFinished != (uint32_t)threads.size() && workId == id) {
-                            oneThreadFinished.wait(lock);
-                        }
-
-                        if (workId == id) {
-                            workId++; // only one thread would reach here
-                            works.pop_front();
-                            if (works.empty()) {
-                                mainWaiting.notify_one();
-                            }
-                            nThreadFinished = 0;
-                        }
-                        lock.unlock();
-                    }
-                });
+    // Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models"). Only the owning
+    // worker pushes and takes at the bottom; any thread may steal from the top. Arrays replaced on growth are kept
+    // alive until the deque is destroyed since a concurrent thief may still be reading them.
+    class WorkStealingDeque {
+        struct Array {
+            int64_t capacity;
+            std::unique_ptr<std::atomic<Task *>[]> slots;
+            explicit Array(int64_t capacity) : capacity(capacity), slots(new std::atomic<Task *>[capacity]) {}
+            Task *get(int64_t i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+            void put(int64_t i, Task *task) { slots[i & (capacity - 1)].store(task, std::memory_order_relaxed); }
+        };
+        std::atomic<int64_t> top{0}, bottom{0};
+        std::atomic<Array *> array;
+        std::vector<std::unique_ptr<Array>> arrays;
+
+      public:
+        WorkStealingDeque() {
+            arrays.emplace_back(std::make_unique<Array>(256));
+            array = arrays.back().get();
+        }
+        bool empty() const {
+            return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+        }
+        void push(Task *task) {
+            auto b = bottom.load(std::memory_order_relaxed);
+            auto t = top.load(std::memory_order_acquire);
+            auto *a = array.load(std::memory_order_relaxed);
+            if (b - t > a->capacity - 1) {
+                auto grown = std::make_unique<Array>(a->capacity * 2);
+                for (auto i = t; i < b; i++) {
+                    grown->put(i, a->get(i));
+                }
+                a = grown.get();
+                arrays.emplace_back(std::move(grown));
+                array.store(a, std::memory_order_release);
             }
+            a->put(b, task);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
         }
-        void enqueue(const ParallelForContext &context) {
-            std::lock_guard<std::mutex> lock(workMutex);
-            works.emplace_back(context);
-            hasWork.notify_all();
+        Task *take() {
+            auto b = bottom.load(std::memory_order_relaxed) - 1;
+            auto *a = array.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = top.load(std::memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            Task *task = a->get(b);
+            if (t == b) {
+                // last element: race against thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    task = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return task;
         }
-        void wait() {
-            std::unique_lock<std::mutex> lock(workMutex);
-            while (!works.empty()) {
+        Task *steal() {
+            auto t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto b = bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return nullptr;
+            }
+            auto *a = array.load(std::memory_order_acquire);
+            Task *task = a->get(t);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return task;
+        }
+    };
 
-                mainWaiting.wait(lock);
+    // CPUs this process may run on: the affinity mask, further limited by a cgroup CPU quota when running inside
+    // a container. A quota of 2.5 CPUs yields 3 threads.
+    static std::vector<int> available_cpus() {
+        std::vector<int> cpus;
+#ifdef AKR_PLATFORM_LINUX
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &set)) {
+                    cpus.emplace_back(i);
+                }
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            for (int i = 0; i < (int)std::max(1u, std::thread::hardware_concurrency()); i++) {
+                cpus.emplace_back(i);
             }
         }
-        ~ParallelForWorkPool() {
+        return cpus;
+    }
+    static size_t cgroup_cpu_limit() {
+#ifdef AKR_PLATFORM_LINUX
+        double quota = -1, period = 0;
+        // cgroup v2: "<quota> <period>" or "max <period>"
+        if (std::ifstream in("/sys/fs/cgroup/cpu.max"); in) {
+            std::string q;
+            in >> q >> period;
+            if (q != "max") {
+                quota = std::atof(q.c_str());
+            }
+        } else if (std::ifstream in_quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us"); in_quota) {
+            std::ifstream in_period("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+            in_quota >> quota;
+            in_period >> period;
+        }
+        if (quota > 0 && period > 0) {
+            return std::max<size_t>(1, (size_t)std::ceil(quota / period));
+        }
+#endif
+        return 0;
+    }
+    static bool env_flag(const char *name) {
+        auto *v = std::getenv(name);
+        return v && *v && std::strcmp(v, "0") != 0;
+    }
+    struct ThreadSettings {
+        size_t n_threads = 1;
+        bool pin = false;
+        std::vector<int> cpus;
+    };
+    // resolved once, when first needed: GlobalOptions, then the environment, then the CPUs actually available
+    static const ThreadSettings &thread_settings() {
+        static ThreadSettings settings = [] {
+            ThreadSettings s;
+            s.cpus = available_cpus();
+            auto *options = GlobalOptions::get();
+            if (options->num_threads > 0) {
+                s.n_threads = options->num_threads;
+            } else if (auto *env = std::getenv("AKARI_NUM_THREADS"); env && std::atoi(env) > 0) {
+                s.n_threads = std::atoi(env);
+            } else {
+                s.n_threads = s.cpus.size();
+                if (auto limit = cgroup_cpu_limit(); limit > 0 && limit < s.n_threads) {
+                    info("limiting to {} threads by the cgroup cpu quota", limit);
+                    s.n_threads = limit;
+                }
+            }
+            s.pin = options->pin_threads || env_flag("AKARI_PIN_THREADS");
+            return s;
+        }();
+        return settings;
+    }
+
+    // One worker fewer than the thread count: the thread that submits work helps run it while it waits. Only a
+    // bounded number of external threads may help at once, each holding a slot after the workers' so that every
+    // thread running tasks has a distinct tid. A single thread starts no workers at all, and the thread holding the
+    // slot runs every task.
+    static size_t num_workers() { return std::max<size_t>(1, thread_settings().n_threads) - 1; }
+    static constexpr size_t num_helper_slots = 1;
+    size_t num_work_threads() { return num_workers() + num_helper_slots; }
+
+    static void pin_current_thread(int cpu) {
+#ifdef AKR_PLATFORM_LINUX
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            warning("cannot pin worker thread to cpu {}", cpu);
+        }
+#elif defined(AKR_PLATFORM_WINDOWS)
+        if (cpu < 64 && !SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu)) {
+            warning("cannot pin worker thread to cpu {}", cpu);
+        }
+#else
+        (void)cpu;
+#endif
+    }
+
+    namespace thread_internal {
+        // index into WorkStealingPool::queues for workers, -1 for external threads
+        static thread_local int worker_index = -1;
+        // tid of the running thread, -1 for external threads not holding a helper slot
+        static thread_local int slot = -1;
+        // limit set by the innermost ThreadBudget, or inherited from the running task; 0 if unlimited
+        static thread_local size_t budget = 0;
+    } // namespace thread_internal
+
+    struct WorkStealingPool {
+        std::vector<std::unique_ptr<WorkStealingDeque>> queues;
+        std::vector<std::thread> threads;
+        std::deque<Task *> injected;
+        std::mutex inject_mutex;
+        std::atomic<size_t> n_injected{0};
+        std::unique_ptr<std::atomic_bool[]> helper_busy;
+        // bumped whenever new work appears or a group completes; sleeping threads wait for it to change
+        std::atomic<uint64_t> epoch{0};
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        std::atomic_bool stopped{false};
+
+        WorkStealingPool() : helper_busy(new std::atomic_bool[num_helper_slots]) {
+            auto n = num_workers();
+            for (size_t i = 0; i < num_helper_slots; i++) {
+                helper_busy[i] = false;
+            }
+            for (size_t i = 0; i < n; i++) {
+                queues.emplace_back(std::make_unique<WorkStealingDeque>());
+            }
+            for (size_t i = 0; i < n; i++) {
+                threads.emplace_back([=]() {
+                    auto &settings = thread_settings();
+                    if (settings.pin) {
+                        pin_current_thread(settings.cpus[i % settings.cpus.size()]);
+                    }
+                    thread_internal::worker_index = (int)i;
+                    thread_internal::slot = (int)i;
+                    worker_loop(i);
+                });
+            }
+        }
+        ~WorkStealingPool() {
             stopped = true;
-            hasWork.notify_all();
+            notify();
             for (auto &thr : threads) {
                 thr.join();
             }
+            for (auto *task : injected) {
+                delete task;
+            }
+        }
+        void notify() {
+            epoch.fetch_add(1);
+            { std::lock_guard<std::mutex> _(sleep_mutex); }
+            wake.notify_all();
+        }
+        void submit(Task *task) {
+            int self = thread_internal::worker_index;
+            if (self >= 0) {
+                queues[self]->push(task);
+            } else {
+                std::lock_guard<std::mutex> _(inject_mutex);
+                injected.emplace_back(task);
+                n_injected++;
+            }
+            notify();
+        }
+        Task *find_task(std::mt19937 &rng) {
+            int self = thread_internal::worker_index;
+            if (self >= 0) {
+                if (auto *task = queues[self]->take()) {
+                    return task;
+                }
+            }
+            if (n_injected.load() > 0) {
+                std::lock_guard<std::mutex> _(inject_mutex);
+                if (!injected.empty()) {
+                    auto *task = injected.front();
+                    injected.pop_front();
+                    n_injected--;
+                    return task;
+                }
+            }
+            auto n = queues.size();
+            if (n == 0) {
+                return nullptr;
+            }
+            auto start = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+            for (size_t i = 0; i < n; i++) {
+                auto victim = (start + i) % n;
+                if ((int)victim == self) {
+                    continue;
+                }
+                if (auto *task = queues[victim]->steal()) {
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+        void execute(Task *task) {
+            auto *group = task->group;
+            auto saved_budget = std::exchange(thread_internal::budget, task->budget);
+            if (!group) {
+                task->func();
+                thread_internal::budget = saved_budget;
+                delete task;
+                return;
+            }
+            try {
+                task->func();
+            } catch (...) {
+                std::lock_guard<std::mutex> _(group->exception_mutex);
+                if (!group->exception) {
+                    group->exception = std::current_exception();
+                }
+            }
+            thread_internal::budget = saved_budget;
+            delete task;
+            if (group->pending.fetch_sub(1) == 1) {
+                notify();
+            }
+        }
+        void worker_loop(size_t index) {
+            std::mt19937 rng((uint32_t)index);
+            while (!stopped) {
+                auto e = epoch.load();
+                if (auto *task = find_task(rng)) {
+                    execute(task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [&] { return stopped || epoch.load() != e; });
+            }
+        }
+        int acquire_helper_slot() {
+            for (size_t i = 0; i < num_helper_slots; i++) {
+                bool expected = false;
+                if (helper_busy[i].compare_exchange_strong(expected, true)) {
+                    return int(num_workers() + i);
+                }
+            }
+            return -1;
+        }
+        void release_helper_slot(int s) { helper_busy[s - num_workers()] = false; }
+        template <typename Done>
+        void wait_until(Done &&done) {
+            using namespace thread_internal;
+            int acquired = -1;
+            std::mt19937 rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+            while (!done()) {
+                auto e = epoch.load();
+                // retried while waiting, as without workers nothing but a slot holder runs this thread's tasks
+                if (slot < 0) {
+                    acquired = slot = acquire_helper_slot();
+                }
+                if (slot >= 0) {
+                    if (auto *task = find_task(rng)) {
+                        execute(task);
+                        continue;
+                    }
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [&] { return done() || epoch.load() != e; });
+            }
+            if (acquired >= 0) {
+                release_helper_slot(acquired);
+                slot = -1;
+                // wakes external threads waiting for the slot
+                notify();
+            }
         }
     };
     namespace thread_internal {
         static std::once_flag flag;
-        static std::unique_ptr<ParallelForWorkPool> pool;
+        static std::unique_ptr<WorkStealingPool> pool;
+        static WorkStealingPool &get_pool() {
+            std::call_once(flag, [&]() { pool = std::make_unique<WorkStealingPool>(); });
+            return *pool;
+        }
     } // namespace thread_internal
+
+    TaskGroup::~TaskGroup() {
+        if (pending.load() > 0) {
+            thread_internal::get_pool().wait_until([this] { return pending.load() == 0; });
+        }
+    }
+    void TaskGroup::run(std::function<void()> func) {
+        pending++;
+        thread_internal::get_pool().submit(new Task{std::move(func), this, thread_internal::budget});
+    }
+    void TaskGroup::wait() {
+        thread_internal::get_pool().wait_until([this] { return pending.load() == 0; });
+        std::exception_ptr e;
+        {
+            std::lock_guard<std::mutex> _(exception_mutex);
+            std::swap(e, exception);
+        }
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+
+    uint32_t work_thread_index() { return (uint32_t)thread_internal::slot; }
+
+    ThreadBudget::ThreadBudget(size_t n) : saved(thread_internal::budget) {
+        thread_internal::budget = std::max<size_t>(n, 1);
+    }
+    ThreadBudget::~ThreadBudget() { thread_internal::budget = saved; }
+    size_t task_budget() {
+        auto n = num_work_threads();
+        return thread_internal::budget > 0 ? std::min(thread_internal::budget, n) : n;
+    }
+
     void parallel_for(int count, const std::function<void(uint32_t, uint32_t)> &func, size_t chunkSize) {
-        using namespace thread_internal;
-        std::call_once(flag, [&]() { pool = std::make_unique<ParallelForWorkPool>(); });
-        ParallelForContext ctx;
-        ctx.func = &func;
-        ctx.chunkSize = (uint32_t)chunkSize;
-        ctx.count = count;
-        ctx.workIndex = 0;
-        pool->enqueue(ctx);
-        pool->wait();
+        if (count <= 0) {
+            return;
+        }
+        parallel_for_range(0, count, chunkSize, [&](Range r, uint32_t tid) {
+            for (auto i = r.begin; i < r.end; i++) {
+                func((uint32_t)i, tid);
+            }
+        });
+    }
+    void first_touch(void *p, size_t bytes) {
+        constexpr size_t page_size = 4096;
+        auto begin = reinterpret_cast<uintptr_t>(p);
+        auto first_page = (begin + page_size - 1) / page_size;
+        auto last_page = (begin + bytes) / page_size;
+        if (last_page <= first_page) {
+            return;
+        }
+        // contiguous runs of pages per chunk, so each node holds whole rows of an image rather than every n-th page
+        auto n_pages = last_page - first_page;
+        parallel_for_range(first_page, last_page, std::max<size_t>(16, n_pages / (num_work_threads() * 4)),
+                           [](Range r, uint32_t) {
+                               for (auto page = r.begin; page < r.end; page++) {
+                                   *reinterpret_cast<volatile char *>(page * page_size) = 0;
+                               }
+                           });
+    }
+    namespace thread_internal {
+        class FirstTouchResource : public astd::pmr::memory_resource {
+            // below this the allocation likely shares pages the allocator already touched
+            static constexpr size_t min_bytes = 1024 * 1024;
+
+          public:
+            void *do_allocate(size_t bytes, size_t alignment) override {
+                auto *p = astd::pmr::get_default_resource()->allocate(bytes, alignment);
+                if (p && bytes >= min_bytes) {
+                    first_touch(p, bytes);
+                }
+                return p;
+            }
+            void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+                astd::pmr::get_default_resource()->deallocate(p, bytes, alignment);
+            }
+            bool do_is_equal(const memory_resource &other) const noexcept override { return &other == this; }
+        };
+    } // namespace thread_internal
+    astd::pmr::memory_resource *first_touch_resource() {
+        static thread_internal::FirstTouchResource resource;
+        return &resource;
     }
     namespace thread {
         void finalize() {
             using namespace thread_internal;
             pool.reset(nullptr);
         }
+        void spawn(std::function<void()> func) {
+            thread_internal::get_pool().submit(new Task{std::move(func), nullptr, thread_internal::budget});
+        }
+        void wait_until(const std::function<bool()> &done) { thread_internal::get_pool().wait_until(done); }
+        void notify_waiters() { thread_internal::get_pool().notify(); }
     } // namespace thread
-} // namespace akari
\ No newline at end of file
+} // namespace akari
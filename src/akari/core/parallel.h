@@ -25,9 +25,17 @@
 
 #include <akari/core/akari.h>
 #include <akari/common/math.h>
+#include <akari/common/astd.h>
+#include <algorithm>
 #include <atomic>
+#include <exception>
 #include <functional>
-#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 namespace akari {
     class AtomicFloat {
@@ -39,6 +47,11 @@ namespace akari {
 
         AtomicFloat(const AtomicFloat &rhs) : val((float)rhs.val) {}
 
+        AtomicFloat &operator=(const AtomicFloat &rhs) {
+            set(rhs.value());
+            return *this;
+        }
+
         void add(Float v) {
             auto current = val.load();
             while (!val.compare_exchange_weak(current, current + v)) {
@@ -52,49 +65,312 @@ namespace akari {
         void set(Float v) { val = v; }
     };
 
+    // A set of tasks run on the shared work-stealing pool. Tasks may themselves spawn tasks or call parallel_for;
+    // wait() runs pending tasks on the calling thread instead of blocking, so nested waits cannot deadlock. The
+    // first exception thrown by a task is rethrown from wait().
+    class AKR_EXPORT TaskGroup {
+      public:
+        TaskGroup() = default;
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+        ~TaskGroup();
+        void run(std::function<void()> func);
+        void wait();
+
+      private:
+        friend struct WorkStealingPool;
+        std::atomic<size_t> pending{0};
+        std::mutex exception_mutex;
+        std::exception_ptr exception;
+    };
+
+    // func(i, tid): tid is unique among the threads running concurrently and below num_work_threads(), but a
+    // thread that waits inside func may run another iteration with the same tid before returning
     AKR_EXPORT void parallel_for(int count, const std::function<void(uint32_t, uint32_t)> &func, size_t chunkSize = 1);
     AKR_EXPORT size_t num_work_threads();
-    inline void parallel_for_2d(const Point<int, 2> &dim, const std::function<void(Point<int, 2>, uint32_t)> &func,
-                                size_t chunkSize = 1) {
-        parallel_for(
-            dim.x * dim.y,
-            [&](uint32_t idx, int tid) {
-                auto x = idx % dim.x;
-                auto y = idx / dim.x;
-                func(Point<int, 2>(x, y), tid);
-            },
-            chunkSize);
+    // tid of the calling thread while it runs a task
+    AKR_EXPORT uint32_t work_thread_index();
+    // While in scope, each parallel loop started on the calling thread, or inside the tasks it spawns, runs at most n
+    // tasks at once, so that jobs running side by side can split the pool between them.
+    class AKR_EXPORT ThreadBudget {
+      public:
+        explicit ThreadBudget(size_t n);
+        ~ThreadBudget();
+        ThreadBudget(const ThreadBudget &) = delete;
+        ThreadBudget &operator=(const ThreadBudget &) = delete;
+
+      private:
+        size_t saved;
+    };
+    // tasks a parallel loop started here may run at once: num_work_threads(), or less under a ThreadBudget
+    AKR_EXPORT size_t task_budget();
+
+    // Writes one byte of every page of [p, p + bytes) from the pool's threads so that, under first-touch NUMA
+    // placement, a large buffer's pages end up spread over the nodes the workers run on.
+    AKR_EXPORT void first_touch(void *p, size_t bytes);
+    // get_default_resource() with first_touch() applied to large allocations
+    AKR_EXPORT astd::pmr::memory_resource *first_touch_resource();
+
+    // a block [begin, end) of a parallel_for_range
+    struct Range {
+        size_t begin = 0;
+        size_t end = 0;
+        [[nodiscard]] size_t size() const { return end - begin; }
+    };
+
+    // Calls func(Range, tid) on blocks of at most grain indices covering [begin, end). Unlike parallel_for, func is
+    // called directly, once per block, so tight per-element loops stay inlinable.
+    template <typename F>
+    void parallel_for_range(size_t begin, size_t end, size_t grain, F &&func) {
+        if (end <= begin) {
+            return;
+        }
+        grain = std::max<size_t>(grain, 1);
+        auto n_blocks = (end - begin + grain - 1) / grain;
+        auto n_tasks = std::min(task_budget(), n_blocks);
+        std::atomic<size_t> next{begin};
+        TaskGroup group;
+        for (size_t t = 0; t < n_tasks; t++) {
+            group.run([&]() {
+                auto tid = work_thread_index();
+                size_t lo;
+                while ((lo = next.fetch_add(grain)) < end) {
+                    func(Range{lo, std::min(lo + grain, end)}, tid);
+                }
+            });
+        }
+        group.wait();
+    }
+    // parallel_for_range over [0, n) as a ParallelLoop (common/distribution.h), for builders outside core/
+    inline void parallel_loop(size_t n, size_t grain, const std::function<void(size_t, size_t)> &body) {
+        parallel_for_range(0, n, grain, [&](Range r, uint32_t) { body(r.begin, r.end); });
+    }
+
+    // reduce(map(block_0), map(block_1), ...) over the blocks of [begin, end), starting from identity. Blocks are
+    // combined in order, so the result does not depend on scheduling even for floating point sums.
+    template <typename T, typename Map, typename Reduce>
+    T parallel_reduce(size_t begin, size_t end, size_t grain, const T &identity, Map &&map, Reduce &&reduce) {
+        if (end <= begin) {
+            return identity;
+        }
+        grain = std::max<size_t>(grain, 1);
+        std::vector<T> partial((end - begin + grain - 1) / grain, identity);
+        parallel_for_range(begin, end, grain,
+                           [&](Range r, uint32_t) { partial[(r.begin - begin) / grain] = map(r); });
+        T result = identity;
+        for (auto &p : partial) {
+            result = reduce(result, p);
+        }
+        return result;
+    }
+
+    template <typename F>
+    void parallel_for_2d(const Point<int, 2> &dim, F &&func, size_t chunkSize = 1) {
+        parallel_for_range(0, size_t(dim.x) * dim.y, chunkSize, [&](Range r, uint32_t tid) {
+            for (auto idx = r.begin; idx < r.end; idx++) {
+                func(Point<int, 2>(int(idx % dim.x), int(idx / dim.x)), tid);
+            }
+        });
     }
     namespace thread {
         AKR_EXPORT void finalize();
-    }
+        // runs func on the pool without a TaskGroup; func must not throw
+        AKR_EXPORT void spawn(std::function<void()> func);
+        // runs pool tasks on the calling thread (or sleeps) until done() holds; done() is rechecked after every
+        // notify_waiters()
+        AKR_EXPORT void wait_until(const std::function<bool()> &done);
+        AKR_EXPORT void notify_waiters();
+    } // namespace thread
+
+    template <typename T>
+    class Future;
+    template <typename T>
+    class Promise;
+    namespace detail {
+        template <typename T>
+        struct FutureValue {
+            std::optional<T> value;
+        };
+        template <>
+        struct FutureValue<void> {};
+
+        template <typename T>
+        struct FutureState : FutureValue<T> {
+            std::mutex mutex;
+            std::atomic_bool ready{false};
+            std::exception_ptr exception;
+            std::vector<std::function<void()>> continuations;
+
+            // publishes the value or exception set beforehand and runs the continuations
+            void finish() {
+                std::vector<std::function<void()>> pending;
+                {
+                    std::lock_guard<std::mutex> _(mutex);
+                    ready = true;
+                    std::swap(pending, continuations);
+                }
+                for (auto &f : pending) {
+                    f();
+                }
+                thread::notify_waiters();
+            }
+            // f runs on the thread that completes the state, or right away if it already has completed
+            void on_ready(std::function<void()> f) {
+                {
+                    std::lock_guard<std::mutex> _(mutex);
+                    if (!ready) {
+                        continuations.emplace_back(std::move(f));
+                        return;
+                    }
+                }
+                f();
+            }
+            template <typename F>
+            void fulfil(F &&f) {
+                try {
+                    if constexpr (std::is_void_v<T>) {
+                        f();
+                    } else {
+                        this->value.emplace(f());
+                    }
+                } catch (...) {
+                    exception = std::current_exception();
+                }
+                finish();
+            }
+            void wait() {
+                if (!ready) {
+                    thread::wait_until([this] { return ready.load(); });
+                }
+            }
+        };
+    } // namespace detail
 
-    // Wrapper around std::future<T>
+    // A value computed on the worker pool. Continuations attached with then() are scheduled as soon as the value
+    // is ready rather than when someone asks for it, and get() helps run pool tasks while waiting.
     template <typename T>
     class Future {
-        std::future<T> inner;
-        template <typename R>
-        friend class Future;
+        std::shared_ptr<detail::FutureState<T>> state;
 
       public:
-        Future(std::future<T> ft) : inner(std::move(ft)) {}
-        template <typename F, typename R = std::invoke_result_t<F, decltype(std::declval<std::future<T>>().get())>>
-        auto then(F &&f, std::launch policy = std::launch::deferred) -> Future<R> {
-            return Future<R>(std::async(std::launch::deferred, [=, ft = std::move(inner)]() mutable {
-                if constexpr (std::is_same_v<T, void>) {
-                    ft.get();
-                    return f();
-                } else {
-                    decltype(auto) result = ft.get();
-                    return f(result);
-                }
-            }));
+        Future() = default;
+        explicit Future(std::shared_ptr<detail::FutureState<T>> state) : state(std::move(state)) {}
+        [[nodiscard]] const std::shared_ptr<detail::FutureState<T>> &shared_state() const { return state; }
+        [[nodiscard]] bool valid() const { return state != nullptr; }
+        [[nodiscard]] bool ready() const { return state->ready; }
+        void wait() const { state->wait(); }
+        // rethrows the exception of the computation, if any
+        T get() const {
+            wait();
+            if (state->exception) {
+                std::rethrow_exception(state->exception);
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return *state->value;
+            }
+        }
+        // f(value), or f() for Future<void>, as a task on the pool once this future is ready; an exception skips f
+        // and propagates to the returned future
+        template <typename F>
+        auto then(F &&f) {
+            using R = typename std::conditional_t<std::is_void_v<T>, std::invoke_result<F>,
+                                                  std::invoke_result<F, T &>>::type;
+            auto next = std::make_shared<detail::FutureState<R>>();
+            state->on_ready([src = state, next, f = std::forward<F>(f)]() mutable {
+                thread::spawn([src, next, f]() mutable {
+                    if (src->exception) {
+                        next->exception = src->exception;
+                        next->finish();
+                        return;
+                    }
+                    if constexpr (std::is_void_v<T>) {
+                        next->fulfil(f);
+                    } else {
+                        next->fulfil([&]() -> decltype(auto) { return f(*src->value); });
+                    }
+                });
+            });
+            return Future<R>(next);
+        }
+    };
+
+    template <typename T>
+    class Promise {
+        std::shared_ptr<detail::FutureState<T>> state = std::make_shared<detail::FutureState<T>>();
+
+      public:
+        [[nodiscard]] Future<T> get_future() const { return Future<T>(state); }
+        template <typename... Args>
+        void set_value(Args &&... args) {
+            state->fulfil([&]() { return T(std::forward<Args>(args)...); });
+        }
+        void set_exception(std::exception_ptr e) {
+            state->exception = std::move(e);
+            state->finish();
         }
     };
-    template <class _Fty, class... _ArgTypes>
-    Future<std::invoke_result_t<std::decay_t<_Fty>, std::decay_t<_ArgTypes>...>>
-    async_do(std::launch policy, _Fty &&_Fnarg, _ArgTypes &&... _Args) {
-        return std::async(policy, std::forward<_Fty>(_Fnarg), std::forward<_ArgTypes>(_Args)...);
+
+    // f(args...) as a task on the worker pool
+    template <typename F, typename... Args>
+    auto async_do(F &&f, Args &&... args) {
+        using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+        auto state = std::make_shared<detail::FutureState<R>>();
+        thread::spawn([state, f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            state->fulfil([&]() -> decltype(auto) { return std::apply(f, args); });
+        });
+        return Future<R>(state);
+    }
+
+    // the values of all futures in order, once all are ready; fails with the first exception in order
+    template <typename T>
+    Future<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> when_all(std::vector<Future<T>> futures) {
+        using R = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+        auto state = std::make_shared<detail::FutureState<R>>();
+        auto remaining = std::make_shared<std::atomic<size_t>>(futures.size() + 1);
+        auto inputs = std::make_shared<std::vector<Future<T>>>(std::move(futures));
+        auto complete = [state, remaining, inputs]() {
+            if (remaining->fetch_sub(1) != 1) {
+                return;
+            }
+            for (auto &ft : *inputs) {
+                if (ft.shared_state()->exception) {
+                    state->exception = ft.shared_state()->exception;
+                    state->finish();
+                    return;
+                }
+            }
+            state->fulfil([&]() {
+                if constexpr (!std::is_void_v<T>) {
+                    R values;
+                    values.reserve(inputs->size());
+                    for (auto &ft : *inputs) {
+                        values.emplace_back(*ft.shared_state()->value);
+                    }
+                    return values;
+                }
+            });
+        };
+        for (auto &ft : *inputs) {
+            ft.shared_state()->on_ready(complete);
+        }
+        complete();
+        return Future<R>(state);
+    }
+
+    // the index of the first future to become ready
+    template <typename T>
+    Future<size_t> when_any(std::vector<Future<T>> futures) {
+        AKR_ASSERT(!futures.empty());
+        auto state = std::make_shared<detail::FutureState<size_t>>();
+        auto done = std::make_shared<std::atomic_bool>(false);
+        for (size_t i = 0; i < futures.size(); i++) {
+            futures[i].shared_state()->on_ready([state, done, i]() {
+                if (!done->exchange(true)) {
+                    state->fulfil([=]() { return i; });
+                }
+            });
+        }
+        return Future<size_t>(state);
     }
 } // namespace akari
 #endif // AKARIRENDER_PARALLEL_HPP
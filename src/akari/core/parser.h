@@ -215,6 +215,11 @@ namespace akari::sdl {
             }
         }
         P<Module> cur_mod() { return mod_stack.back(); }
+        // path taken relative to the directory of the file being parsed, so that loading it never depends on the
+        // current directory
+        [[nodiscard]] fs::path resolve_path(const std::string &path) const {
+            return fs::absolute(*loc.filename).parent_path() / path;
+        }
         [[noreturn]] void report_error(const std::string &message, SourceLoc loc_) {
             auto path = fs::path(*loc_.filename);
             path = fs::absolute(path);
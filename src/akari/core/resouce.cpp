@@ -21,9 +21,13 @@
 // SOFTWARE.
 
 #include <mutex>
+#include <atomic>
+#include <fstream>
 #include <fmt/format.h>
 #include <akari/core/resource.h>
 #include <akari/core/image.hpp>
+#include <akari/core/logger.h>
+#include <akari/core/parallel.h>
 
 namespace akari {
 
@@ -31,14 +35,49 @@ namespace akari {
         std::mutex mutex;
         struct Record {
             std::shared_ptr<Resource> resouce;
-            //            std::filesystem::file_time_type lwt;
+            CreateFunc create = nullptr;
+            fs::file_time_type lwt;
+            // content hash, kept while hashing is enabled
+            uint64_t hash = 0;
         };
         std::unordered_map<std::string, Record> cache;
+        // loads in flight, completed with the resource or the load's error
+        std::unordered_map<std::string, Future<std::shared_ptr<Resource>>> loading;
+        // loads running on this thread; such a thread never waits for another load, since the load it waits for
+        // may be suspended below it on the same stack, or waiting for one that is
+        static thread_local int loads_on_this_thread;
+        bool content_hash = false;
+        std::atomic<uint64_t> _generation{0};
+
+        static fs::file_time_type last_write_time(const fs::path &path) {
+            std::error_code ec;
+            auto t = fs::last_write_time(path, ec);
+            return ec ? fs::file_time_type::min() : t;
+        }
+        // FNV-1a
+        static uint64_t hash_file(const fs::path &path) {
+            std::ifstream in(path, std::ios::binary);
+            uint64_t h = 14695981039346656037ull;
+            char buffer[1 << 16];
+            while (in) {
+                in.read(buffer, sizeof(buffer));
+                for (std::streamsize i = 0; i < in.gcount(); i++) {
+                    h = (h ^ uint8_t(buffer[i])) * 1099511628211ull;
+                }
+            }
+            return h;
+        }
 
       public:
-        void cache_resource(const fs::path &path, const std::shared_ptr<Resource> &resource) override {
+        void cache_resource(const fs::path &path, const std::shared_ptr<Resource> &resource,
+                            CreateFunc create) override {
+            auto key = fs::absolute(path).string();
+            Record record{resource, create, last_write_time(key)};
+            if (content_hash) {
+                record.hash = hash_file(key);
+            }
             std::lock_guard<std::mutex> _(mutex);
-            cache.emplace(fs::absolute(path).string(), Record{resource});
+            cache.insert_or_assign(key, std::move(record));
         }
         std::shared_ptr<Resource> lookup(const fs::path &path) override {
             std::lock_guard<std::mutex> _(mutex);
@@ -48,7 +87,124 @@ namespace akari {
             }
             return nullptr;
         }
+        Expected<std::shared_ptr<Resource>> load_shared(const fs::path &path, CreateFunc create) override {
+            auto key = fs::absolute(path).string();
+            Promise<std::shared_ptr<Resource>> promise;
+            std::optional<Future<std::shared_ptr<Resource>>> in_flight;
+            bool owner = false;
+            {
+                std::lock_guard<std::mutex> _(mutex);
+                if (auto it = cache.find(key); it != cache.end()) {
+                    return it->second.resouce;
+                }
+                if (auto it = loading.find(key); it == loading.end()) {
+                    loading.emplace(key, promise.get_future());
+                    owner = true;
+                } else if (loads_on_this_thread == 0) {
+                    in_flight = it->second;
+                }
+            }
+            if (in_flight) {
+                try {
+                    return in_flight->get();
+                } catch (std::exception &e) {
+                    return Error(e.what());
+                }
+            }
+            // the owner publishes the resource to the cache before dropping its entry from loading, so that no
+            // thread starts a second load in between
+            auto finish = [&](const std::shared_ptr<Resource> &resource, std::exception_ptr error) {
+                if (!owner) {
+                    return;
+                }
+                if (resource) {
+                    cache_resource(path, resource, create);
+                }
+                {
+                    std::lock_guard<std::mutex> _(mutex);
+                    loading.erase(key);
+                }
+                if (resource) {
+                    promise.set_value(resource);
+                } else {
+                    promise.set_exception(error);
+                }
+            };
+            auto resource = create();
+            loads_on_this_thread++;
+            Expected<bool> exp = false;
+            try {
+                exp = resource->load(path);
+            } catch (...) {
+                loads_on_this_thread--;
+                finish(nullptr, std::current_exception());
+                throw;
+            }
+            loads_on_this_thread--;
+            if (!exp) {
+                auto err = exp.extract_error();
+                finish(nullptr, std::make_exception_ptr(std::runtime_error(err.what())));
+                return err;
+            }
+            finish(resource, nullptr);
+            return resource;
+        }
+        std::vector<fs::path> refresh() override {
+            std::vector<std::pair<std::string, Record>> stale;
+            {
+                std::lock_guard<std::mutex> _(mutex);
+                for (auto &[key, record] : cache) {
+                    auto lwt = last_write_time(key);
+                    if (lwt == record.lwt) {
+                        continue;
+                    }
+                    auto hash = record.hash;
+                    if (content_hash) {
+                        hash = hash_file(key);
+                        if (hash == record.hash) {
+                            record.lwt = lwt;
+                            continue;
+                        }
+                    }
+                    // the new stamp is recorded only once the reload succeeds, so a failed one is retried
+                    Record updated = record;
+                    updated.lwt = lwt;
+                    updated.hash = hash;
+                    stale.emplace_back(key, std::move(updated));
+                }
+            }
+            // loaded outside the lock, as loading may look up other resources
+            std::vector<fs::path> reloaded;
+            for (auto &[key, record] : stale) {
+                auto resource = record.create();
+                auto exp = resource->load(key);
+                if (!exp) {
+                    warning("failed to reload {}: {}, keeping the old version", key, exp.extract_error().what());
+                    continue;
+                }
+                info("reloaded {}", key);
+                record.resouce = resource;
+                std::lock_guard<std::mutex> _(mutex);
+                cache.insert_or_assign(key, record);
+                reloaded.emplace_back(key);
+            }
+            if (!reloaded.empty()) {
+                _generation++;
+            }
+            return reloaded;
+        }
+        void set_content_hash(bool enable) override {
+            std::lock_guard<std::mutex> _(mutex);
+            if (enable && !content_hash) {
+                for (auto &[key, record] : cache) {
+                    record.hash = hash_file(key);
+                }
+            }
+            content_hash = enable;
+        }
+        uint64_t generation() const override { return _generation.load(); }
     };
+    thread_local int ResourceManagerImpl::loads_on_this_thread = 0;
     namespace _resource_internal {
         static std::shared_ptr<ResourceManagerImpl> mgr;
         static std::once_flag flag;
@@ -64,6 +220,7 @@ namespace akari {
     }
 
     Expected<bool> ImageResource::load(const fs::path &path) {
+        _path = path;
         auto reader = default_image_reader();
         _image = reader->read(path);
         if (_image)
@@ -72,4 +229,41 @@ namespace akari {
             return Error(fmt::format("failed to read {}", path.string()));
         }
     }
+    std::shared_ptr<RGBAImage> ImageResource::image() const {
+        std::lock_guard<std::mutex> _(mutex);
+        if (_image) {
+            return _image;
+        }
+        if (auto image = _released_image.lock()) {
+            return image;
+        }
+        error("{}: the decoded image was released once its texture was built", _path.string());
+        throw std::runtime_error("Image released");
+    }
+    std::shared_ptr<const DeviceTexture> ImageResource::texture() const {
+        std::shared_ptr<RGBAImage> image;
+        {
+            std::lock_guard<std::mutex> _(mutex);
+            if (_texture) {
+                return _texture;
+            }
+            image = _image;
+        }
+        // packing and the MIP chain run on the thread pool, so they must not hold the lock a pool task may be
+        // waiting for
+        AKR_ASSERT_THROW(image);
+        auto texture = std::make_shared<DeviceTexture>(*image);
+        std::lock_guard<std::mutex> _(mutex);
+        if (!_texture) {
+            info("{}: {}x{} {}, {} levels, {:.2f}MB ({:.2f}MB saved over RGBA)", _path.string(),
+                 image->resolution().x, image->resolution().y, texel_format_name(texture->format),
+                 texture->n_levels(), texture->texels.size() / 1048576.0,
+                 (double(texture->unpacked_bytes) - double(texture->texels.size())) / 1048576.0);
+            _texture = std::move(texture);
+            // textures only read the packed texels
+            _released_image = _image;
+            _image = nullptr;
+        }
+        return _texture;
+    }
 } // namespace akari
\ No newline at end of file
@@ -26,6 +26,10 @@
 #include <akari/core/akari.h>
 #include <akari/common/platform.h>
 #include <akari/core/error.hpp>
+#include <map>
+#include <mutex>
+#include <typeindex>
+#include <typeinfo>
 
 namespace akari {
     class AKR_EXPORT Resource {
@@ -34,27 +38,44 @@ namespace akari {
         virtual ~Resource() = default;
     };
     class AKR_EXPORT ResourceManager {
-        virtual void cache_resource(const fs::path &path, const std::shared_ptr<Resource> &) = 0;
+      protected:
+        using CreateFunc = std::shared_ptr<Resource> (*)();
+
+      private:
+        // create makes an empty resource of the same type, for reloading it
+        virtual void cache_resource(const fs::path &path, const std::shared_ptr<Resource> &, CreateFunc create) = 0;
         virtual std::shared_ptr<Resource> lookup(const fs::path &path) = 0;
+        // The cached resource for path, loading it with create() on a miss. Threads that ask for a path while
+        // another thread loads it wait for that load instead of loading their own copy.
+        virtual Expected<std::shared_ptr<Resource>> load_shared(const fs::path &path, CreateFunc create) = 0;
 
       public:
+        // Reloads every cached resource whose file was modified since it was loaded and returns their paths.
+        // Later lookups get the new resource; holders of the old one keep it alive until they let go.
+        virtual std::vector<fs::path> refresh() = 0;
+        // compare file contents as well as modification times, so touching a file reloads nothing
+        virtual void set_content_hash(bool enable) = 0;
+        // incremented by every refresh() that reloaded something
+        virtual uint64_t generation() const = 0;
         Expected<std::shared_ptr<Resource>> load_resource(const fs::path &);
         template <typename T>
         Expected<std::shared_ptr<T>> load_path(const fs::path &path, bool force_reload = false) {
+            CreateFunc create = []() -> std::shared_ptr<Resource> { return std::make_shared<T>(); };
             if (!force_reload) {
-                auto cache = lookup(path);
-                if (cache) {
-                    auto res = dyn_cast<T>(cache);
-                    if (!res) {
-                        return Error("dyn_cast failed; cached resource of different type");
-                    }
-                    return res;
+                auto cache = load_shared(path, create);
+                if (!cache) {
+                    return cache.extract_error();
+                }
+                auto res = dyn_cast<T>(cache.extract_value());
+                if (!res) {
+                    return Error("dyn_cast failed; cached resource of different type");
                 }
+                return res;
             }
             auto res = std::make_shared<T>();
             auto exp = res->load(path);
             if (exp) {
-                cache_resource(path, res);
+                cache_resource(path, res, create);
                 return res;
             }
             return exp.extract_error();
@@ -65,12 +86,43 @@ namespace akari {
     AKR_EXPORT std::shared_ptr<ResourceManager> resource_manager();
 
     class RGBAImage;
+    struct DeviceTexture;
     class AKR_EXPORT ImageResource : public Resource {
-        std::shared_ptr<RGBAImage> _image;
+        fs::path _path;
+        mutable std::mutex mutex;
+        // the decoded float image, released once texture() has packed it
+        mutable std::shared_ptr<RGBAImage> _image;
+        // the released image, for as long as callers of image() keep it alive
+        mutable std::weak_ptr<RGBAImage> _released_image;
+        mutable std::shared_ptr<const DeviceTexture> _texture;
+        mutable std::map<std::pair<std::type_index, int>, std::shared_ptr<const void>> _derived;
 
       public:
         Expected<bool> load(const fs::path &) override;
-        const std::shared_ptr<RGBAImage> &image() const { return _image; }
+        // The image as linear float RGBA. Once texture() has released it, it is only available while a caller
+        // still holds it; asking for it after that throws rather than reading a file that may have changed.
+        std::shared_ptr<RGBAImage> image() const;
+        // The image's MIP chain uploaded to the active device, built on first use. Every texture of this file
+        // shares it; a reload creates a new ImageResource and with it a new upload.
+        std::shared_ptr<const DeviceTexture> texture() const;
+        // The object build() computes from this image, made once for each type T and key and shared by every
+        // caller. build() runs without holding the resource's lock; callers racing on the first use may each run
+        // it, and all of them get the object published first.
+        template <typename T, typename F>
+        std::shared_ptr<const T> derived(int key, F &&build) const {
+            auto id = std::make_pair(std::type_index(typeid(T)), key);
+            {
+                std::lock_guard<std::mutex> _(mutex);
+                auto it = _derived.find(id);
+                if (it != _derived.end()) {
+                    return std::static_pointer_cast<const T>(it->second);
+                }
+            }
+            std::shared_ptr<const T> value = build();
+            std::lock_guard<std::mutex> _(mutex);
+            auto it = _derived.emplace(id, std::move(value)).first;
+            return std::static_pointer_cast<const T>(it->second);
+        }
     };
 } // namespace akari
 
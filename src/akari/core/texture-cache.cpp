@@ -0,0 +1,404 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <akari/core/texture-cache.h>
+#include <akari/core/logger.h>
+#include <akari/core/options.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#ifdef AKR_PLATFORM_WINDOWS
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <windows.h>
+#    undef NOMINMAX
+#else
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+namespace akari {
+    static constexpr char TiledMagic[4] = {'A', 'K', 'T', 'X'};
+    static constexpr uint32_t TiledVersion = 1;
+
+    struct TileSlot {
+        // table entry this slot is mapped in, null while free
+        std::atomic<std::atomic<TileSlot *> *> owner{nullptr};
+        std::atomic<uint32_t> pins{0};
+        std::atomic<bool> referenced{false};
+        std::unique_ptr<uint8_t[]> data;
+    };
+
+    // largest power of two tile that fits in TileBytes
+    static int tile_shift_for(TexelFormat format) {
+        int shift = 0;
+        while (shift < 8 && (size_t(1) << (2 * (shift + 1))) * texel_size(format) <= TileBytes) {
+            shift++;
+        }
+        return shift;
+    }
+
+    void write_tiled_texture(const RGBAImage &image, const fs::path &path) {
+        std::vector<PackedImage> levels;
+        levels.emplace_back(image, image.format);
+        for (auto &level : build_mip_chain(image)) {
+            levels.emplace_back(level, image.format);
+        }
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("cannot open " + path.string());
+        }
+        int shift = tile_shift_for(image.format);
+        int tile_size = 1 << shift;
+        size_t bpp = texel_size(image.format);
+        auto put = [&](uint32_t v) { out.write(reinterpret_cast<const char *>(&v), sizeof(v)); };
+        out.write(TiledMagic, sizeof(TiledMagic));
+        put(TiledVersion);
+        put(uint32_t(image.format));
+        put(uint32_t(tile_size));
+        put(uint32_t(levels.size()));
+        for (auto &level : levels) {
+            put(uint32_t(level.resolution().x));
+            put(uint32_t(level.resolution().y));
+        }
+        std::vector<uint8_t> tile(size_t(tile_size) * tile_size * bpp);
+        for (auto &level : levels) {
+            auto res = level.resolution();
+            auto &bytes = level.bytes();
+            for (int ty = 0; ty < (res.y + tile_size - 1) / tile_size; ty++) {
+                for (int tx = 0; tx < (res.x + tile_size - 1) / tile_size; tx++) {
+                    for (int y = 0; y < tile_size; y++) {
+                        int sy = std::min(ty * tile_size + y, res.y - 1);
+                        for (int x = 0; x < tile_size; x++) {
+                            int sx = std::min(tx * tile_size + x, res.x - 1);
+                            std::memcpy(&tile[(size_t(y) * tile_size + x) * bpp],
+                                        &bytes[(size_t(sy) * res.x + sx) * bpp], bpp);
+                        }
+                    }
+                    out.write(reinterpret_cast<const char *>(tile.data()), tile.size());
+                }
+            }
+        }
+        if (!out) {
+            throw std::runtime_error("error writing " + path.string());
+        }
+    }
+
+    TiledImage::~TiledImage() {
+        if (cache) {
+            cache->unmap(*this);
+        }
+#ifdef AKR_PLATFORM_WINDOWS
+        if (file) {
+            CloseHandle(file);
+        }
+#else
+        if (file >= 0) {
+            ::close(file);
+        }
+#endif
+    }
+
+    RGBA TiledImage::texel(int level, int x, int y) const {
+        int2 p(x, y);
+        RGBA t;
+        texels(level, &p, 1, &t);
+        return t;
+    }
+
+    void TiledImage::texels(int level, const int2 *p, size_t n, RGBA *out) const {
+        auto &l = levels[level];
+        int mask = (1 << tile_shift) - 1;
+        TileSlot *slot = nullptr;
+        size_t pinned = 0;
+        for (size_t i = 0; i < n; i++) {
+            int x = std::clamp(p[i].x, 0, l.resolution.x - 1);
+            int y = std::clamp(p[i].y, 0, l.resolution.y - 1);
+            size_t entry = l.first_entry + size_t(y >> tile_shift) * l.tiles.x + size_t(x >> tile_shift);
+            if (!slot || entry != pinned) {
+                // one pin at a time, as claim() expects
+                if (slot) {
+                    cache->release(slot);
+                }
+                slot = cache->acquire(*this, entry);
+                pinned = entry;
+            }
+            out[i] = PackedImageView{slot->data.get(), int2(1 << tile_shift), _format}(x & mask, y & mask);
+        }
+        if (slot) {
+            cache->release(slot);
+        }
+    }
+
+    void TiledImage::read_tile(size_t entry, uint8_t *dst) const {
+        size_t level = 0;
+        while (level + 1 < levels.size() && levels[level + 1].first_entry <= entry) {
+            level++;
+        }
+        uint64_t offset = levels[level].offset + (entry - levels[level].first_entry) * tile_bytes;
+        size_t done = 0;
+        while (done < tile_bytes) {
+#ifdef AKR_PLATFORM_WINDOWS
+            OVERLAPPED overlapped{};
+            overlapped.Offset = DWORD((offset + done) & 0xffffffffu);
+            overlapped.OffsetHigh = DWORD((offset + done) >> 32);
+            DWORD n = 0;
+            if (!ReadFile(file, dst + done, DWORD(tile_bytes - done), &n, &overlapped) || n == 0) {
+                break;
+            }
+#else
+            auto n = ::pread(file, dst + done, tile_bytes - done, off_t(offset + done));
+            if (n <= 0) {
+                break;
+            }
+#endif
+            done += size_t(n);
+        }
+        if (done < tile_bytes) {
+            error("{}: short read of tile {}", _path.string(), entry);
+            std::memset(dst + done, 0, tile_bytes - done);
+        }
+    }
+
+    TileCache::TileCache(size_t budget_bytes) {
+        // a thread pins one slot at a time and never while it waits in claim(), so any count makes progress; a few
+        // slots per thread keep it from spinning
+        n_slots = std::max<size_t>(budget_bytes / TileBytes, 64);
+        slots.reset(new TileSlot[n_slots]);
+    }
+
+    TileCache::~TileCache() = default;
+
+    std::shared_ptr<TiledImage> TileCache::open(const fs::path &path) {
+        auto key = fs::absolute(path).string();
+        std::lock_guard<std::mutex> lock(open_mutex);
+        if (auto it = opened.find(key); it != opened.end()) {
+            if (auto image = it->second.lock()) {
+                return image;
+            }
+        }
+        std::ifstream in(path, std::ios::binary);
+        char magic[4] = {};
+        in.read(magic, sizeof(magic));
+        auto get = [&]() {
+            uint32_t v = 0;
+            in.read(reinterpret_cast<char *>(&v), sizeof(v));
+            return v;
+        };
+        if (!in || std::memcmp(magic, TiledMagic, sizeof(magic)) != 0 || get() != TiledVersion) {
+            throw std::runtime_error(path.string() + " is not a tiled texture");
+        }
+        std::shared_ptr<TiledImage> image(new TiledImage());
+        image->_path = path;
+        image->cache = this;
+        image->_format = TexelFormat(get());
+        uint32_t tile_size = get();
+        uint32_t n_levels = get();
+        if (!in || tile_size == 0 || (tile_size & (tile_size - 1)) != 0 || n_levels == 0 ||
+            size_t(tile_size) * tile_size * texel_size(image->_format) > TileBytes) {
+            throw std::runtime_error(path.string() + ": corrupted header");
+        }
+        while ((1u << image->tile_shift) < tile_size) {
+            image->tile_shift++;
+        }
+        image->tile_bytes = size_t(tile_size) * tile_size * texel_size(image->_format);
+        uint64_t offset = sizeof(TiledMagic) + sizeof(uint32_t) * (4 + 2 * size_t(n_levels));
+        size_t entries = 0;
+        for (uint32_t i = 0; i < n_levels; i++) {
+            TiledImage::Level level;
+            level.resolution.x = (int)get();
+            level.resolution.y = (int)get();
+            level.tiles = (level.resolution + int2(tile_size - 1)) / int2(tile_size);
+            level.offset = offset;
+            level.first_entry = entries;
+            entries += size_t(level.tiles.x) * level.tiles.y;
+            offset += uint64_t(level.tiles.x) * level.tiles.y * image->tile_bytes;
+            image->levels.emplace_back(level);
+        }
+        if (!in) {
+            throw std::runtime_error(path.string() + ": corrupted header");
+        }
+        image->table.reset(new std::atomic<TileSlot *>[entries]);
+        for (size_t i = 0; i < entries; i++) {
+            image->table[i].store(nullptr, std::memory_order_relaxed);
+        }
+#ifdef AKR_PLATFORM_WINDOWS
+        auto handle = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("cannot open " + path.string());
+        }
+        image->file = handle;
+#else
+        image->file = ::open(path.string().c_str(), O_RDONLY);
+        if (image->file < 0) {
+            throw std::runtime_error("cannot open " + path.string());
+        }
+#endif
+        auto &coarsest = image->levels.back();
+        double sum = 0.0;
+        for (int y = 0; y < coarsest.resolution.y; y++) {
+            for (int x = 0; x < coarsest.resolution.x; x++) {
+                sum += luminance(image->texel(image->n_levels() - 1, x, y).rgb);
+            }
+        }
+        image->_mean_luminance = float(sum / (double(coarsest.resolution.x) * coarsest.resolution.y));
+        info("{}: {}x{} {}, {} levels, tiled", path.string(), image->resolution(0).x, image->resolution(0).y,
+             texel_format_name(image->_format), image->n_levels());
+        opened[key] = image;
+        return image;
+    }
+
+    TileCache::Counters &TileCache::counters() {
+        static std::atomic<uint32_t> next{0};
+        thread_local uint32_t stripe = next.fetch_add(1, std::memory_order_relaxed);
+        return stripes[stripe % (sizeof(stripes) / sizeof(stripes[0]))];
+    }
+
+    TileSlot *TileCache::acquire(const TiledImage &image, size_t entry) {
+        // Every change of a slot's pins is a read-modify-write, so they form one order: a pin either comes before
+        // the evictor's claim of the slot, which then fails, or it acquires the claim's release and with it the
+        // unmapping that preceded it, which the second load then sees.
+        auto &mapped = image.table[entry];
+        while (true) {
+            if (auto *slot = mapped.load(std::memory_order_acquire)) {
+                slot->pins.fetch_add(1, std::memory_order_acquire);
+                // the slot may have been evicted between the two loads; its evictor sees the pin and leaves it
+                if (mapped.load(std::memory_order_acquire) == slot) {
+                    if (!slot->referenced.load(std::memory_order_relaxed)) {
+                        slot->referenced.store(true, std::memory_order_relaxed);
+                    }
+                    counters().hits.fetch_add(1, std::memory_order_relaxed);
+                    return slot;
+                }
+                slot->pins.fetch_sub(1, std::memory_order_release);
+                continue;
+            }
+            counters().misses.fetch_add(1, std::memory_order_relaxed);
+            auto *slot = claim();
+            image.read_tile(entry, slot->data.get());
+            slot->referenced.store(true, std::memory_order_relaxed);
+            slot->owner.store(&mapped);
+            TileSlot *expected = nullptr;
+            // publishes the tile's texels along with the slot
+            if (mapped.compare_exchange_strong(expected, slot, std::memory_order_acq_rel)) {
+                resident.fetch_add(1, std::memory_order_relaxed);
+                return slot;
+            }
+            // another thread paged the same tile in first; use its copy
+            slot->owner.store(nullptr);
+            slot->pins.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // the release orders the reader's texel loads before the evictor's acquiring claim and its refill
+    void TileCache::release(TileSlot *slot) { slot->pins.fetch_sub(1, std::memory_order_release); }
+
+    // returns a free slot pinned once
+    TileSlot *TileCache::claim() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (n_allocated < n_slots) {
+            auto &slot = slots[n_allocated++];
+            slot.data.reset(new uint8_t[TileBytes]);
+            slot.pins.store(1);
+            return &slot;
+        }
+        for (size_t scanned = 0;; scanned++) {
+            auto &slot = slots[hand];
+            hand = (hand + 1) % n_slots;
+            if (scanned > 0 && scanned % (2 * n_slots) == 0) {
+                std::this_thread::yield();
+            }
+            if (slot.pins.load(std::memory_order_relaxed) != 0 || slot.referenced.exchange(false)) {
+                continue;
+            }
+            if (auto *owner = slot.owner.load()) {
+                TileSlot *expected = &slot;
+                owner->compare_exchange_strong(expected, nullptr);
+                slot.owner.store(nullptr);
+                resident.fetch_sub(1, std::memory_order_relaxed);
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+            // a reader that pinned the slot before it was unmapped lets go once it sees the empty entry
+            uint32_t unpinned = 0;
+            if (slot.pins.compare_exchange_strong(unpinned, 1, std::memory_order_acq_rel)) {
+                return &slot;
+            }
+        }
+    }
+
+    void TileCache::unmap(const TiledImage &image) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto *begin = image.table.get();
+        auto *end = begin + (image.levels.back().first_entry +
+                             size_t(image.levels.back().tiles.x) * image.levels.back().tiles.y);
+        for (size_t i = 0; i < n_allocated; i++) {
+            auto *owner = slots[i].owner.load();
+            if (owner >= begin && owner < end) {
+                owner->store(nullptr);
+                slots[i].owner.store(nullptr);
+                slots[i].referenced.store(false);
+                resident.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    TileCache::Stats TileCache::stats() const {
+        Stats s;
+        for (auto &c : stripes) {
+            s.hits += c.hits.load(std::memory_order_relaxed);
+            s.misses += c.misses.load(std::memory_order_relaxed);
+        }
+        s.evictions = evictions.load(std::memory_order_relaxed);
+        s.resident_bytes = resident.load(std::memory_order_relaxed) * TileBytes;
+        s.budget_bytes = n_slots * TileBytes;
+        return s;
+    }
+
+    void TileCache::report() const {
+        auto s = stats();
+        if (s.hits + s.misses == 0) {
+            return;
+        }
+        info("texture cache: {:.2f}% hit rate ({} hits, {} misses, {} evictions), {:.1f}MB of {:.1f}MB resident",
+             100.0 * double(s.hits) / double(s.hits + s.misses), s.hits, s.misses, s.evictions,
+             s.resident_bytes / 1048576.0, s.budget_bytes / 1048576.0);
+    }
+
+    TileCache *texture_cache() {
+        static TileCache cache([] {
+            size_t mb = GlobalOptions::get()->texture_cache_mb;
+            if (mb == 0) {
+                if (auto *env = std::getenv("AKARI_TEXTURE_CACHE_MB"); env && std::atoi(env) > 0) {
+                    mb = size_t(std::atoi(env));
+                } else {
+                    mb = 1024;
+                }
+            }
+            return mb * 1024 * 1024;
+        }());
+        return &cache;
+    }
+} // namespace akari
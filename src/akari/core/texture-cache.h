@@ -0,0 +1,136 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <akari/core/akari.h>
+#include <akari/core/image.hpp>
+
+namespace akari {
+    // Tiled textures (.akt) keep their MIP levels on disk and are paged in tile by tile through a TileCache of
+    // fixed size, so scenes may reference far more texture data than fits in memory.
+    //
+    // Layout (little endian): "AKTX", then uint32 version, format, tile_size, n_levels and a width, height pair
+    // per level, followed by the tiles of every level from the finest, row-major. A tile is tile_size^2 texels in
+    // the header's TexelFormat and always TileBytes or less; texels past the image edge repeat the last row or
+    // column.
+    constexpr size_t TileBytes = 65536;
+
+    // converts image and its MIP chain, keeping image.format
+    AKR_EXPORT void write_tiled_texture(const RGBAImage &image, const fs::path &path);
+
+    struct TileSlot;
+    class TileCache;
+
+    class AKR_EXPORT TiledImage {
+      public:
+        ~TiledImage();
+        TiledImage(const TiledImage &) = delete;
+        TiledImage &operator=(const TiledImage &) = delete;
+        // clamps to the level's resolution; pages the tile in if it is not resident
+        RGBA texel(int level, int x, int y) const;
+        // texel() of the n points p, pinning a tile once for a run of points inside it; a filter footprint mostly
+        // lies in one tile
+        void texels(int level, const int2 *p, size_t n, RGBA *out) const;
+        [[nodiscard]] int n_levels() const { return (int)levels.size(); }
+        [[nodiscard]] int2 resolution(int level) const { return levels[level].resolution; }
+        [[nodiscard]] TexelFormat format() const { return _format; }
+        [[nodiscard]] const fs::path &path() const { return _path; }
+        // from the coarsest level, which has the same mean as the image
+        [[nodiscard]] float mean_luminance() const { return _mean_luminance; }
+
+      private:
+        friend class TileCache;
+        TiledImage() = default;
+        void read_tile(size_t entry, uint8_t *dst) const;
+        struct Level {
+            int2 resolution;
+            int2 tiles;
+            uint64_t offset;
+            // index of the level's first tile in table
+            size_t first_entry;
+        };
+        fs::path _path;
+        TileCache *cache = nullptr;
+        TexelFormat _format = TexelFormat::RGBA32F;
+        float _mean_luminance = 0.0f;
+        int tile_shift = 0;
+        size_t tile_bytes = 0;
+        std::vector<Level> levels;
+        // resident slot of every tile, null when it is on disk only
+        std::unique_ptr<std::atomic<TileSlot *>[]> table;
+#ifdef AKR_PLATFORM_WINDOWS
+        void *file = nullptr;
+#else
+        int file = -1;
+#endif
+    };
+
+    // Fixed budget of tile slots shared by every tiled texture, reclaimed with the clock algorithm. A hit pins its
+    // slot with an acquire increment and a release decrement and takes no lock; a miss reads the tile into a free
+    // slot without blocking other threads, which only wait for the short slot scan.
+    class AKR_EXPORT TileCache {
+      public:
+        explicit TileCache(size_t budget_bytes);
+        ~TileCache();
+        // every caller opening the same file while it is open gets the same TiledImage, so its tiles are cached once
+        std::shared_ptr<TiledImage> open(const fs::path &path);
+        struct Stats {
+            uint64_t hits = 0, misses = 0, evictions = 0;
+            size_t resident_bytes = 0, budget_bytes = 0;
+        };
+        [[nodiscard]] Stats stats() const;
+        // logs the hit rate if any tiled texture was read
+        void report() const;
+
+      private:
+        friend class TiledImage;
+        TileSlot *acquire(const TiledImage &image, size_t entry);
+        void release(TileSlot *slot);
+        TileSlot *claim();
+        void unmap(const TiledImage &image);
+        struct alignas(64) Counters {
+            std::atomic<uint64_t> hits{0}, misses{0};
+        };
+        Counters &counters();
+        std::unique_ptr<TileSlot[]> slots;
+        size_t n_slots = 0;
+        // slots handed out at least once; slots past it have no memory yet
+        size_t n_allocated = 0;
+        size_t hand = 0;
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<size_t> resident{0};
+        Counters stripes[16];
+        std::mutex mutex;
+        std::mutex open_mutex;
+        std::unordered_map<std::string, std::weak_ptr<TiledImage>> opened;
+    };
+
+    // the process wide cache; its budget comes from GlobalOptions::texture_cache_mb, $AKARI_TEXTURE_CACHE_MB or
+    // 1024MB, read on first use
+    AKR_EXPORT TileCache *texture_cache();
+} // namespace akari
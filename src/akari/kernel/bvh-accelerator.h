@@ -19,11 +19,13 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
-#include <future>
+
+#pragma once
 #include <akari/common/math.h>
 #include <akari/kernel/scene.h>
 #include <akari/common/mesh.h>
 #include <akari/core/logger.h>
+#include <akari/core/parallel.h>
 #include <optional>
 namespace akari {
     template <typename C, class UserData, class Hit, class Intersector, class ShapeHandleConstructor,
@@ -68,7 +70,22 @@ namespace akari {
         astd::pmr::vector<BVHNode> nodes;
         std::shared_ptr<std::mutex> m;
         std::atomic<uint32_t> n_splits;
-        TBVHAccelerator(const TBVHAccelerator &rhs) : n_splits(rhs.n_splits.load()) {}
+        TBVHAccelerator(TBVHAccelerator &&rhs) noexcept
+            : enable_sbvh(rhs.enable_sbvh), boundBox(rhs.boundBox), user_data(std::move(rhs.user_data)),
+              _intersector(std::move(rhs._intersector)), _ctor(std::move(rhs._ctor)), indicies(std::move(rhs.indicies)),
+              nodes(std::move(rhs.nodes)), m(std::move(rhs.m)), n_splits(rhs.n_splits.load()) {}
+        TBVHAccelerator &operator=(TBVHAccelerator &&rhs) noexcept {
+            enable_sbvh = rhs.enable_sbvh;
+            boundBox = rhs.boundBox;
+            user_data = std::move(rhs.user_data);
+            _intersector = std::move(rhs._intersector);
+            _ctor = std::move(rhs._ctor);
+            indicies = std::move(rhs.indicies);
+            nodes = std::move(rhs.nodes);
+            m = std::move(rhs.m);
+            n_splits = rhs.n_splits.load();
+            return *this;
+        }
         TBVHAccelerator(UserData &&user_data, size_t N, Intersector intersector = Intersector(),
                         ShapeHandleConstructor ctor = ShapeHandleConstructor())
             : user_data(std::move(user_data)), _intersector(std::move(intersector)), _ctor(std::move(ctor)),
@@ -456,20 +473,25 @@ namespace akari {
                     node.count = (uint16_t)-1;
                 }
                 AKR_ASSERT(!left_partition.empty() && !right_partition.empty());
+                int left = -1, right = -1;
                 if (refs.size() > 128 * 1024) {
-                    auto left = std::async(std::launch::async, [&]() -> int {
-                        return (int)recursiveBuild(std::move(left_partition), depth + 1);
-                    });
-                    auto right = std::async(std::launch::async, [&]() -> int {
-                        return (int)recursiveBuild(std::move(right_partition), depth + 1);
-                    });
-                    nodes[ret].left = left.get();
-                    nodes[ret].right = right.get();
+                    // split off the left half onto the shared pool; this thread runs the right half and helps
+                    // with whatever else is queued while it waits
+                    TaskGroup group;
+                    group.run([&]() { left = (int)recursiveBuild(std::move(left_partition), depth + 1); });
+                    right = (int)recursiveBuild(std::move(right_partition), depth + 1);
+                    group.wait();
                 } else {
-                    nodes[ret].left = (int)recursiveBuild(std::move(left_partition), depth + 1);
-                    nodes[ret].right = (int)recursiveBuild(std::move(right_partition), depth + 1);
+                    left = (int)recursiveBuild(std::move(left_partition), depth + 1);
+                    right = (int)recursiveBuild(std::move(right_partition), depth + 1);
+                }
+                AKR_ASSERT(right >= 0 && left >= 0);
+                {
+                    // another subtree may be growing nodes concurrently
+                    std::lock_guard<std::mutex> _(*m);
+                    nodes[ret].left = left;
+                    nodes[ret].right = right;
                 }
-                AKR_ASSERT(nodes[ret].right >= 0 && nodes[ret].left >= 0);
                 return (int)ret;
             }
         }
@@ -671,8 +693,17 @@ namespace akari {
       public:
         BVHAccelerator() : meshBVHs(TAllocator<MeshBVH>(default_resource())) {}
         void build(Scene<C> &scene) {
+            meshBVHs.reserve(scene.meshes.size());
             for (auto &instance : scene.meshes) {
-                meshBVHs.emplace_back(&instance, instance.indices.size() / 3);
+                meshBVHs.emplace_back(static_cast<const MeshInstance<C> *>(&instance), instance.indices.size() / 3);
+            }
+            topLevelBVH.emplace(MeshBVHes(meshBVHs.data(), meshBVHs.size()), meshBVHs.size());
+        }
+        // rebuilds the BVHs of the given meshes, then the top level over all of them
+        void update(Scene<C> &scene, const std::vector<uint32_t> &mesh_ids) {
+            for (auto id : mesh_ids) {
+                auto &instance = scene.meshes[id];
+                meshBVHs[id] = MeshBVH(static_cast<const MeshInstance<C> *>(&instance), instance.indices.size() / 3);
             }
             topLevelBVH.emplace(MeshBVHes(meshBVHs.data(), meshBVHs.size()), meshBVHs.size());
         }
@@ -24,6 +24,14 @@
 #include <akari/common/variant.h>
 #include <akari/common/math.h>
 namespace akari {
+    // rays through the film positions one pixel to the right (x) and one pixel down (y) of a camera sample,
+    // sharing its lens position; used to estimate the texture footprint of the first hit
+    AKR_VARIANT struct RayDifferential {
+        using Float = typename C::Float;
+        AKR_IMPORT_CORE_TYPES()
+        Float3 rx_o, rx_d, ry_o, ry_d;
+        bool valid = false;
+    };
     AKR_VARIANT struct CameraSample {
         using Float = typename C::Float;
         AKR_IMPORT_CORE_TYPES()
@@ -32,6 +40,20 @@ namespace akari {
         Float weight = 0.0f;
         Float3 normal;
         Ray<C> ray;
+        RayDifferential<C> differential;
+    };
+    // connection from a scene point to the camera, for light paths
+    AKR_VARIANT struct CameraWiSample {
+        using Float = typename C::Float;
+        AKR_IMPORT_CORE_TYPES()
+        float2 p_raster;
+        // normalized direction from the reference point towards the camera
+        Float3 wi;
+        // solid angle pdf of wi, as seen from the reference point
+        Float pdf = 0.0f;
+        // importance emitted along -wi
+        Float We = 0.0f;
+        Ray<C> shadow_ray;
     };
     AKR_VARIANT class PerspectiveCamera {
       public:
@@ -42,6 +64,8 @@ namespace akari {
         Float fov;
         Float lens_radius = 0.0f;
         Float focal_distance = 0.0f;
+        // area of the film on the plane z = -1 in camera space
+        Float film_area = 1.0f;
         AKR_XPU void preprocess() {
             Transform3f m;
             m = Transform3f::scale(Float3(1.0f / _resolution.x, 1.0f / _resolution.y, 1)) * m;
@@ -56,6 +80,9 @@ namespace akari {
             }
             r2c = m;
             c2r = r2c.inverse();
+            auto p0 = r2c.apply_point(Float3(0.0f));
+            auto p1 = r2c.apply_point(Float3(Float(_resolution.x), Float(_resolution.y), 0.0f));
+            film_area = std::abs((p1.x - p0.x) * (p1.y - p0.y));
         }
 
       public:
@@ -64,24 +91,62 @@ namespace akari {
             preprocess();
         }
         AKR_XPU int2 resolution() const { return _resolution; }
+        // the same view on a film of another resolution
+        AKR_XPU PerspectiveCamera with_resolution(const int2 &resolution) const {
+            PerspectiveCamera camera = *this;
+            camera._resolution = resolution;
+            camera.preprocess();
+            return camera;
+        }
         AKR_XPU CameraSample<C> generate_ray(const float2 &u1, const float2 &u2, const int2 &raster) const {
             CameraSample<C> sample;
             sample.p_lens = sampling<C>::concentric_disk_sampling(u1) * lens_radius;
             sample.p_film = float2(raster) + u2;
             sample.weight = 1;
 
-            float2 p = shuffle<0, 1>(r2c.apply_point(Float3(sample.p_film.x, sample.p_film.y, 0.0f)));
-            Ray3f ray(Float3(0), Float3(normalize(Float3(p.x, p.y, 0) - Float3(0, 0, 1))));
-            if (lens_radius > 0 && focal_distance > 0) {
-                Float ft = focal_distance / std::abs(ray.d.z);
-                Float3 pFocus = ray(ft);
-                ray.o = Float3(sample.p_lens.x, sample.p_lens.y, 0);
-                ray.d = Float3(normalize(pFocus - ray.o));
-            }
-            ray.o = c2w.apply_point(ray.o);
-            ray.d = c2w.apply_vector(ray.d);
+            // world space ray through a film position, leaving the lens at p_lens
+            auto through = [&](const float2 &p_film) {
+                float2 p = shuffle<0, 1>(r2c.apply_point(Float3(p_film.x, p_film.y, 0.0f)));
+                Ray3f ray(Float3(0), Float3(normalize(Float3(p.x, p.y, 0) - Float3(0, 0, 1))));
+                if (lens_radius > 0 && focal_distance > 0) {
+                    Float ft = focal_distance / std::abs(ray.d.z);
+                    Float3 pFocus = ray(ft);
+                    ray.o = Float3(sample.p_lens.x, sample.p_lens.y, 0);
+                    ray.d = Float3(normalize(pFocus - ray.o));
+                }
+                ray.o = c2w.apply_point(ray.o);
+                ray.d = c2w.apply_vector(ray.d);
+                return ray;
+            };
+            sample.ray = through(sample.p_film);
+            auto rx = through(sample.p_film + float2(1, 0));
+            auto ry = through(sample.p_film + float2(0, 1));
+            sample.differential.rx_o = rx.o;
+            sample.differential.rx_d = rx.d;
+            sample.differential.ry_o = ry.o;
+            sample.differential.ry_d = ry.d;
+            sample.differential.valid = true;
             sample.normal = c2w.apply_normal(Float3(0, 0, -1.0f));
-            sample.ray = ray;
+            return sample;
+        }
+        // Connects ref to the pinhole; the lens is ignored
+        AKR_XPU astd::optional<CameraWiSample<C>> sample_wi(const Float3 &ref) const {
+            auto pc = w2c.apply_point(ref);
+            if (pc.z >= 0.0f)
+                return astd::nullopt;
+            auto dist = length(pc);
+            auto cos_theta = -pc.z / dist;
+            auto p_film = c2r.apply_point(Float3(pc.x / -pc.z, pc.y / -pc.z, 0.0f));
+            if (p_film.x < 0.0f || p_film.y < 0.0f || p_film.x >= _resolution.x || p_film.y >= _resolution.y)
+                return astd::nullopt;
+            CameraWiSample<C> sample;
+            sample.p_raster = float2(p_film.x, p_film.y);
+            auto origin = c2w.apply_point(Float3(0.0f));
+            sample.wi = (origin - ref) / dist;
+            sample.pdf = dist * dist / cos_theta;
+            sample.We = Float(1.0f) / (film_area * cos_theta * cos_theta * cos_theta * cos_theta);
+            sample.shadow_ray =
+                Ray3f(ref, sample.wi, Constants<Float>::Eps(), dist * (Float(1.0f) - Constants<Float>::ShadowEps()));
             return sample;
         }
     };
@@ -93,5 +158,11 @@ namespace akari {
             AKR_VAR_DISPATCH(generate_ray, u1, u2, raster);
         }
         AKR_XPU int2 resolution() const { AKR_VAR_DISPATCH(resolution); }
+        AKR_XPU Camera with_resolution(const int2 &resolution) const {
+            return this->dispatch([&](auto &&camera) { return Camera(camera.with_resolution(resolution)); });
+        }
+        AKR_XPU astd::optional<CameraWiSample<C>> sample_wi(const Float3 &ref) const {
+            AKR_VAR_DISPATCH(sample_wi, ref);
+        }
     };
 } // namespace akari
\ No newline at end of file
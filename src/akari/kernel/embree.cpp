@@ -25,24 +25,39 @@
 #include <akari/core/logger.h>
 #ifdef AKR_ENABLE_EMBREE
 namespace akari {
+    AKR_VARIANT RTCGeometry EmbreeAccelerator<C>::create_geometry(const MeshInstance<C> &mesh) {
+        auto geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+        rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, &mesh.vertices[0], 0,
+                                   sizeof(float) * 3, mesh.vertices.size() / 3);
+        AKR_ASSERT_THROW(rtcGetDeviceError(device) == RTC_ERROR_NONE);
+        AKR_ASSERT(mesh.indices.size() % 3 == 0);
+        rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, &mesh.indices[0], 0,
+                                   sizeof(int) * 3, mesh.indices.size() / 3);
+        AKR_ASSERT_THROW(rtcGetDeviceError(device) == RTC_ERROR_NONE);
+        rtcCommitGeometry(geometry);
+        return geometry;
+    }
     AKR_VARIANT void EmbreeAccelerator<C>::build(Scene<C> &scene) {
         rtcScene = rtcNewScene(device);
         for (const MeshInstance<C> &mesh : scene.meshes) {
-            auto geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
-            rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, &mesh.vertices[0], 0,
-                                       sizeof(float) * 3, mesh.vertices.size() / 3);
-            AKR_ASSERT_THROW(rtcGetDeviceError(device) == RTC_ERROR_NONE);
-            AKR_ASSERT(mesh.indices.size() % 3 == 0);
-            rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, &mesh.indices[0], 0,
-                                       sizeof(int) * 3, mesh.indices.size() / 3);
-            AKR_ASSERT_THROW(rtcGetDeviceError(device) == RTC_ERROR_NONE);
-            rtcCommitGeometry(geometry);
+            auto geometry = create_geometry(mesh);
             rtcAttachGeometry(rtcScene, geometry);
             rtcReleaseGeometry(geometry);
         }
         rtcCommitScene(rtcScene);
         AKR_ASSERT_THROW(rtcGetDeviceError(device) == RTC_ERROR_NONE);
     }
+    AKR_VARIANT void EmbreeAccelerator<C>::update(Scene<C> &scene, const std::vector<uint32_t> &meshes) {
+        // geometry ids are mesh indices, so each mesh is reattached under its old id
+        for (auto id : meshes) {
+            rtcDetachGeometry(rtcScene, id);
+            auto geometry = create_geometry(scene.meshes[id]);
+            rtcAttachGeometryByID(rtcScene, geometry, id);
+            rtcReleaseGeometry(geometry);
+        }
+        rtcCommitScene(rtcScene);
+        AKR_ASSERT_THROW(rtcGetDeviceError(device) == RTC_ERROR_NONE);
+    }
     AKR_VARIANT static inline RTCRay toRTCRay(const Ray<C> &_ray) {
         RTCRay ray;
         auto _o = _ray.o;
@@ -35,12 +35,15 @@ namespace akari {
     class EmbreeAccelerator {
         RTCScene rtcScene = nullptr;
         RTCDevice device = nullptr;
+        RTCGeometry create_geometry(const MeshInstance<C> &mesh);
 
       public:
         using Float = typename C::Float;
         AKR_IMPORT_CORE_TYPES()
         EmbreeAccelerator() { device = rtcNewDevice(nullptr); }
         void build(Scene<C> &scene);
+        // replaces the geometry of the given meshes, whose buffers were reloaded
+        void update(Scene<C> &scene, const std::vector<uint32_t> &meshes);
         bool intersect(const Ray<C> &ray, Intersection<C> *isct) const;
         bool occlude(const Ray<C> &ray) const;
         ~EmbreeAccelerator() {
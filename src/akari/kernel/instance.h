@@ -33,6 +33,8 @@ namespace akari {
         BufferView<int> indices;
         BufferView<int> material_indices;
         BufferView<const Material<C> *> materials;
+        // index into Scene::area_lights for each primitive, -1 if not emissive
+        BufferView<int> light_indices;
         struct RayHit {
             float2 uv;
             Float3 ng;
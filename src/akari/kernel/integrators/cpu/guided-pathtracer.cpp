@@ -0,0 +1,473 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <array>
+#include <mutex>
+#include <akari/core/cancellation.h>
+#include <akari/core/parallel.h>
+#include <akari/kernel/integrators/cpu/integrator.h>
+#include <akari/core/film.h>
+#include <akari/core/logger.h>
+#include <akari/core/profiler.h>
+#include <akari/kernel/scene.h>
+#include <akari/kernel/interaction.h>
+#include <akari/kernel/material.h>
+#include <akari/kernel/sampling.h>
+#include <akari/kernel/pathtracer.h>
+#include <akari/core/progress.hpp>
+
+namespace akari {
+    namespace cpu {
+        namespace guiding {
+            // Directions are stored in the cylindrical parameterization (cos(theta), phi) scaled to [0,1]^2,
+            // which is area preserving, so a pdf over [0,1]^2 converts to solid angle by a constant 1/(4pi)
+            template <typename Float3>
+            inline float2 dir_to_canonical(const Float3 &d) {
+                float cos_theta = std::clamp<float>(d.z, -1.0f, 1.0f);
+                float phi = std::atan2((float)d.y, (float)d.x);
+                if (phi < 0.0f)
+                    phi += 2.0f * Constants<float>::Pi();
+                return float2((cos_theta + 1.0f) * 0.5f, phi / (2.0f * Constants<float>::Pi()));
+            }
+            template <typename Float3>
+            inline Float3 canonical_to_dir(const float2 &p) {
+                float cos_theta = 2.0f * p.x - 1.0f;
+                float phi = 2.0f * Constants<float>::Pi() * p.y;
+                float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+                return Float3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+            }
+
+            struct DTreeNode {
+                AtomicFloat sums[4];
+                // 0 means the quadrant is a leaf; the root is never a child
+                uint32_t children[4] = {0, 0, 0, 0};
+                [[nodiscard]] bool is_leaf(int i) const { return children[i] == 0; }
+                [[nodiscard]] std::array<float, 4> values() const {
+                    return {sums[0].value(), sums[1].value(), sums[2].value(), sums[3].value()};
+                }
+            };
+
+            // Quadtree over the canonical square. Sums are updated with atomics while the topology stays
+            // fixed during a pass, so recording from worker threads is lock free.
+            class DTree {
+                std::vector<DTreeNode> nodes;
+                AtomicFloat weight;
+                static constexpr int MaxDepth = 20;
+
+                static int quadrant(float2 &p) {
+                    int x = p.x >= 0.5f;
+                    int y = p.y >= 0.5f;
+                    p = (p - float2(float(x), float(y)) * 0.5f) * 2.0f;
+                    return x + 2 * y;
+                }
+                static void refine_node(DTree &out, uint32_t out_idx, const DTree &prev, int prev_idx,
+                                        const std::array<float, 4> &sums, float total, float threshold, int depth) {
+                    for (int i = 0; i < 4; i++) {
+                        if (depth >= MaxDepth || !(sums[i] / total > threshold)) {
+                            continue;
+                        }
+                        std::array<float, 4> child_sums;
+                        int child_prev = -1;
+                        if (prev_idx >= 0 && !prev.nodes[prev_idx].is_leaf(i)) {
+                            child_prev = prev.nodes[prev_idx].children[i];
+                            child_sums = prev.nodes[child_prev].values();
+                        } else {
+                            child_sums.fill(sums[i] * 0.25f);
+                        }
+                        auto child = (uint32_t)out.nodes.size();
+                        out.nodes.emplace_back();
+                        out.nodes[out_idx].children[i] = child;
+                        refine_node(out, child, prev, child_prev, child_sums, total, threshold, depth + 1);
+                    }
+                }
+
+              public:
+                DTree() { nodes.emplace_back(); }
+                [[nodiscard]] float total() const {
+                    auto v = nodes[0].values();
+                    return v[0] + v[1] + v[2] + v[3];
+                }
+                [[nodiscard]] float statistical_weight() const { return weight.value(); }
+                void set_statistical_weight(float w) { weight.set(w); }
+                [[nodiscard]] size_t num_nodes() const { return nodes.size(); }
+                void record(float2 p, float value) {
+                    weight.add(1.0f);
+                    if (!(value > 0.0f) || !std::isfinite(value)) {
+                        return;
+                    }
+                    uint32_t idx = 0;
+                    while (true) {
+                        int i = quadrant(p);
+                        nodes[idx].sums[i].add(value);
+                        if (nodes[idx].is_leaf(i))
+                            break;
+                        idx = nodes[idx].children[i];
+                    }
+                }
+                [[nodiscard]] float pdf(float2 p) const {
+                    if (!(total() > 0.0f)) {
+                        return 1.0f;
+                    }
+                    float result = 1.0f;
+                    uint32_t idx = 0;
+                    while (true) {
+                        auto s = nodes[idx].values();
+                        float node_total = s[0] + s[1] + s[2] + s[3];
+                        if (!(node_total > 0.0f)) {
+                            return 0.0f;
+                        }
+                        int i = quadrant(p);
+                        result *= 4.0f * s[i] / node_total;
+                        if (result == 0.0f || nodes[idx].is_leaf(i))
+                            return result;
+                        idx = nodes[idx].children[i];
+                    }
+                }
+                [[nodiscard]] float2 sample(float2 u) const {
+                    if (!(total() > 0.0f)) {
+                        return u;
+                    }
+                    float2 origin(0.0f);
+                    float size = 1.0f;
+                    uint32_t idx = 0;
+                    while (true) {
+                        auto s = nodes[idx].values();
+                        float left = s[0] + s[2];
+                        float node_total = left + s[1] + s[3];
+                        if (!(node_total > 0.0f)) {
+                            return origin + u * size;
+                        }
+                        float px = left / node_total;
+                        int x = 0, y = 0;
+                        if (u.x < px) {
+                            u.x = u.x / px;
+                        } else {
+                            x = 1;
+                            u.x = (u.x - px) / (1.0f - px);
+                        }
+                        float column = s[x] + s[x + 2];
+                        float py = column > 0.0f ? s[x] / column : 0.5f;
+                        if (u.y < py) {
+                            u.y = u.y / py;
+                        } else {
+                            y = 1;
+                            u.y = (u.y - py) / (1.0f - py);
+                        }
+                        u = min(max(u, float2(0.0f)), float2(1.0f - std::numeric_limits<float>::epsilon()));
+                        size *= 0.5f;
+                        origin += float2(float(x), float(y)) * size;
+                        int i = x + 2 * y;
+                        if (nodes[idx].is_leaf(i)) {
+                            return origin + u * size;
+                        }
+                        idx = nodes[idx].children[i];
+                    }
+                }
+                // New topology with zeroed sums: quadrants holding more than `threshold` of the energy are split
+                [[nodiscard]] DTree refine(float threshold) const {
+                    DTree out;
+                    float t = total();
+                    if (t > 0.0f) {
+                        refine_node(out, 0, *this, 0, nodes[0].values(), t, threshold, 1);
+                    }
+                    return out;
+                }
+            };
+
+            struct DTreeWrapper {
+                DTree building, sampling;
+                [[nodiscard]] bool valid() const { return sampling.total() > 0.0f; }
+                template <typename Float3>
+                void record(const Float3 &wi, float value) {
+                    building.record(dir_to_canonical(wi), value);
+                }
+                template <typename Float3>
+                [[nodiscard]] float pdf(const Float3 &wi) const {
+                    return sampling.pdf(dir_to_canonical(wi)) / (4.0f * Constants<float>::Pi());
+                }
+                template <typename Float3>
+                [[nodiscard]] Float3 sample(const float2 &u) const {
+                    return canonical_to_dir<Float3>(sampling.sample(u));
+                }
+                void build(float threshold) {
+                    if (!(building.statistical_weight() > 0.0f)) {
+                        return;
+                    }
+                    DTree refined = building.refine(threshold);
+                    sampling = std::move(building);
+                    building = std::move(refined);
+                }
+            };
+
+            struct STreeNode {
+                int depth = 0;
+                int dtree = -1;
+                uint32_t children[2] = {0, 0};
+                [[nodiscard]] bool is_leaf() const { return dtree >= 0; }
+            };
+
+            // Binary tree over a cube enclosing the scene, split along x, y, z in turn
+            AKR_VARIANT class STree {
+                AKR_IMPORT_TYPES()
+                Bounds3f bounds;
+                std::vector<STreeNode> nodes;
+                std::vector<DTreeWrapper> dtrees;
+                static constexpr int MaxDepth = 24;
+
+              public:
+                explicit STree(const Bounds3f &scene_bounds) {
+                    auto extents = scene_bounds.extents();
+                    Float size = hmax(extents) * Float(1.0 + 1e-3);
+                    bounds.pmin = scene_bounds.pmin - Float3(size * Float(5e-4));
+                    bounds.pmax = bounds.pmin + Float3(size);
+                    STreeNode root;
+                    root.dtree = 0;
+                    nodes.emplace_back(root);
+                    dtrees.emplace_back();
+                }
+                DTreeWrapper *lookup(const Float3 &p) {
+                    Float3 q = clamp((p - bounds.pmin) / bounds.extents(), Float3(0.0f), Float3(1.0f));
+                    uint32_t idx = 0;
+                    while (!nodes[idx].is_leaf()) {
+                        int axis = nodes[idx].depth % 3;
+                        if (q[axis] < Float(0.5f)) {
+                            q[axis] = q[axis] * Float(2.0f);
+                            idx = nodes[idx].children[0];
+                        } else {
+                            q[axis] = (q[axis] - Float(0.5f)) * Float(2.0f);
+                            idx = nodes[idx].children[1];
+                        }
+                    }
+                    return &dtrees[nodes[idx].dtree];
+                }
+                // Splits every leaf that recorded more than `threshold` samples; children inherit a copy of the
+                // parent's directional tree and half of its statistical weight
+                void refine(float threshold) {
+                    for (size_t i = 0; i < nodes.size(); i++) {
+                        if (!nodes[i].is_leaf() || nodes[i].depth >= MaxDepth) {
+                            continue;
+                        }
+                        int dt = nodes[i].dtree;
+                        float weight = dtrees[dt].building.statistical_weight();
+                        if (!(weight > threshold)) {
+                            continue;
+                        }
+                        dtrees[dt].building.set_statistical_weight(weight * 0.5f);
+                        dtrees.emplace_back(dtrees[dt]);
+                        STreeNode left, right;
+                        left.depth = right.depth = nodes[i].depth + 1;
+                        left.dtree = dt;
+                        right.dtree = (int)dtrees.size() - 1;
+                        nodes[i].dtree = -1;
+                        nodes[i].children[0] = (uint32_t)nodes.size();
+                        nodes[i].children[1] = (uint32_t)nodes.size() + 1;
+                        nodes.emplace_back(left);
+                        nodes.emplace_back(right);
+                    }
+                }
+                void build(float threshold) {
+                    parallel_for(dtrees.size(), [=](uint32_t i, uint32_t) { dtrees[i].build(threshold); });
+                }
+                [[nodiscard]] size_t num_leaves() const { return dtrees.size(); }
+                [[nodiscard]] size_t num_directional_nodes() const {
+                    size_t n = 0;
+                    for (auto &d : dtrees) {
+                        n += d.sampling.num_nodes();
+                    }
+                    return n;
+                }
+            };
+        } // namespace guiding
+
+        AKR_VARIANT void GuidedPathTracer<C>::render(const Scene<C> &scene, Film<C> *film) const {
+            using namespace guiding;
+            AKR_ASSERT_THROW(all(film->resolution() == scene.camera.resolution()));
+            auto n_tiles = film->n_tiles(tile_size);
+            STree<C> stree(scene.bounds());
+            struct PathVertex {
+                DTreeWrapper *dtree;
+                Float3 wi;
+                Spectrum beta;
+                Spectrum radiance;
+                Float pdf;
+            };
+            static constexpr int MaxRecordedVertices = 32;
+            auto Li = [&](Sampler<C> &sampler, const int2 &p, bool guided, bool record) -> Spectrum {
+                std::array<PathVertex, MaxRecordedVertices> vertices;
+                int n_vertices = 0;
+                GenericPathTracer<C> pt;
+                pt.depth = 0;
+                pt.max_depth = max_depth;
+                pt.sampler = sampler;
+                auto add_radiance = [&](const Spectrum &c) {
+                    pt.L += c;
+                    if (!record)
+                        return;
+                    for (int i = 0; i < n_vertices; i++) {
+                        for (int ch = 0; ch < (int)array_size_v<Spectrum>; ch++) {
+                            auto b = vertices[i].beta[ch];
+                            vertices[i].radiance[ch] += b > 0.0f ? c[ch] / b : 0.0f;
+                        }
+                    }
+                };
+                Ray3f ray = pt.camera_ray(scene.camera, p).ray;
+                while (true) {
+                    auto hit = scene.intersect(ray);
+                    if (!hit) {
+                        add_radiance(pt.beta * pt.environment_radiance(scene, ray, pt.prev_bsdf_pdf));
+                        break;
+                    }
+                    SurfaceHit<C> surface_hit(ray, hit.value());
+                    auto trig = scene.get_triangle(surface_hit.geom_id, surface_hit.prim_id);
+                    surface_hit.material = trig.material;
+                    SurfaceInteraction<C> si(surface_hit.uv, trig);
+                    pt.apply_ray_differential(si);
+                    auto *material = surface_hit.material;
+                    auto wo = surface_hit.wo;
+                    MaterialEvalContext<C> ctx(pt.sampler, si);
+                    if (material->template isa<EmissiveMaterial<C>>()) {
+                        add_radiance(pt.beta * pt.emitted_radiance(scene, si, surface_hit, pt.prev_bsdf_pdf));
+                        break;
+                    }
+                    if (pt.depth >= max_depth) {
+                        break;
+                    }
+                    si.bsdf = material->get_bsdf(ctx);
+                    auto *dtree = stree.lookup(si.p);
+                    bool use_guiding = guided && dtree->valid();
+                    auto scattering_pdf = [&](const Float3 &w) -> Float {
+                        Float bsdf_pdf = si.bsdf.evaluate_pdf(wo, w);
+                        if (!use_guiding)
+                            return bsdf_pdf;
+                        return bsdf_fraction * bsdf_pdf + (1.0f - bsdf_fraction) * dtree->pdf(w);
+                    };
+                    auto has_direct =
+                        pt.compute_direct_lighting(si, surface_hit, pt.select_light(scene, si), scattering_pdf);
+                    if (has_direct) {
+                        auto &direct = has_direct.value();
+                        if (!direct.color.is_black() && !scene.occlude(direct.shadow_ray)) {
+                            add_radiance(direct.color);
+                        }
+                    }
+                    Float3 wi;
+                    Spectrum f;
+                    Float pdf;
+                    if (use_guiding) {
+                        // one-sample MIS between the BSDF and the learned distribution
+                        if (pt.sampler.next1d() < bsdf_fraction) {
+                            auto sample = si.bsdf.sample(BSDFSampleContext<C>(pt.sampler.next2d(), wo));
+                            if (!(sample.pdf > 0.0f)) {
+                                break;
+                            }
+                            wi = sample.wi;
+                            f = sample.f;
+                            pdf = bsdf_fraction * sample.pdf + (1.0f - bsdf_fraction) * dtree->pdf(wi);
+                        } else {
+                            wi = dtree->template sample<Float3>(pt.sampler.next2d());
+                            f = si.bsdf.evaluate(wo, wi);
+                            pdf = scattering_pdf(wi);
+                        }
+                    } else {
+                        auto sample = si.bsdf.sample(BSDFSampleContext<C>(pt.sampler.next2d(), wo));
+                        wi = sample.wi;
+                        f = sample.f;
+                        pdf = sample.pdf;
+                    }
+                    if (!(pdf > 0.0f) || f.is_black()) {
+                        break;
+                    }
+                    pt.beta *= f * std::abs(dot(si.ng, wi)) / pdf;
+                    if (record && n_vertices < MaxRecordedVertices) {
+                        vertices[n_vertices++] = PathVertex{dtree, wi, pt.beta, Spectrum(0.0f), pdf};
+                    }
+                    pt.prev_p = si.p;
+                    pt.prev_n = si.ns;
+                    pt.prev_bsdf_pdf = pdf;
+                    ray = Ray3f(si.p, wi, Constants<Float>::Eps() / std::abs(dot(si.ng, wi)));
+                    pt.depth++;
+                }
+                for (int i = 0; i < n_vertices; i++) {
+                    auto &v = vertices[i];
+                    v.dtree->record(v.wi, float(luminance(v.radiance) / v.pdf));
+                }
+                sampler = pt.sampler;
+                return pt.L;
+            };
+            std::mutex mutex;
+            auto render_pass = [&](int pass_spp, int sample_offset, bool guided, bool record, Film<C> *out) {
+                auto resolution = film->resolution();
+                parallel_for_2d(n_tiles, [&](const int2 &tile_pos, int tid) {
+                    (void)tid;
+                    Bounds2i tileBounds = film->tile_bounds(tile_pos, tile_size);
+                    auto tile = film->tile(tileBounds);
+                    auto sampler = scene.sampler;
+                    for (int y = tile.bounds.pmin.y; y < tile.bounds.pmax.y; y++) {
+                        // once cancelled, rows already rendered are still merged
+                        if (render_cancellation().is_cancelled()) {
+                            break;
+                        }
+                        for (int x = tile.bounds.pmin.x; x < tile.bounds.pmax.x; x++) {
+                            sampler.set_sample_index(uint64_t(sample_offset) * resolution.x * resolution.y + x +
+                                                     y * resolution.x);
+                            for (int s = 0; s < pass_spp; s++) {
+                                sampler.start_next_sample();
+                                auto L = Li(sampler, int2(x, y), guided, record);
+                                tile.add_sample(float2(x, y), L, 1.0f);
+                            }
+                        }
+                    }
+                    if (out) {
+                        std::lock_guard<std::mutex> _(mutex);
+                        out->merge_tile(tile);
+                    }
+                });
+            };
+
+            // training passes double their sample count each iteration; only the final pass reaches the film
+            int training_spp = std::min(int(spp * training_budget), spp - 1);
+            int used_spp = 0;
+            int pass = 0;
+            Timer training_timer;
+            for (; used_spp + (1 << pass) <= training_spp && !render_cancellation().is_cancelled(); pass++) {
+                int pass_spp = 1 << pass;
+                render_pass(pass_spp, used_spp, pass > 0, true, nullptr);
+                used_spp += pass_spp;
+                stree.refine(spatial_threshold * std::sqrt(float(1 << pass)));
+                stree.build(directional_threshold);
+                debug("guiding pass {}: {} spp, {} spatial leaves, {} directional nodes", pass, pass_spp,
+                      stree.num_leaves(), stree.num_directional_nodes());
+            }
+            double training_time = training_timer.elapsed_seconds();
+            if (render_cancellation().is_cancelled()) {
+                // cancelled while training; the film gets no sample
+                info("path guiding: cancelled after {} training passes ({}s)", pass, training_time);
+                return;
+            }
+            Timer render_timer;
+            render_pass(spp - used_spp, used_spp, pass > 0, false, film);
+            double render_time = render_timer.elapsed_seconds();
+            info("path guiding: training {}s ({} passes, {} spp), rendering {}s ({} spp)", training_time, pass,
+                 used_spp, render_time, spp - used_spp);
+        }
+        AKR_RENDER_CLASS(GuidedPathTracer)
+    } // namespace cpu
+} // namespace akari
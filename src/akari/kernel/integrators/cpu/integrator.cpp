@@ -21,6 +21,7 @@
 // SOFTWARE.
 
 #include <mutex>
+#include <akari/core/cancellation.h>
 #include <akari/core/parallel.h>
 #include <akari/kernel/integrators/cpu/integrator.h>
 #include <akari/core/film.h>
@@ -32,6 +33,8 @@
 #include <akari/core/arena.h>
 #include <akari/common/smallarena.h>
 #include <akari/kernel/pathtracer.h>
+#include <akari/kernel/reservoir.h>
+#include <akari/kernel/integrators/cpu/radiance-cache.h>
 #include <akari/core/progress.hpp>
 
 namespace akari {
@@ -39,20 +42,36 @@ namespace akari {
 
         AKR_VARIANT void AmbientOcclusion<C>::render(const Scene<C> &scene, Film<C> *film) const {
             AKR_ASSERT_THROW(all(film->resolution() == scene.camera.resolution()));
-            auto n_tiles = int2(film->resolution() + int2(tile_size - 1)) / int2(tile_size);
-            auto Li = [=, &scene](Ray3f ray, Sampler<C> &sampler) -> Spectrum {
+            auto n_tiles = film->n_tiles(tile_size);
+            std::unique_ptr<RadianceCache<C>> cache;
+            if (radiance_cache) {
+                auto res = film->resolution();
+                cache = std::make_unique<RadianceCache<C>>(scene.bounds(), cache_resolution, cache_samples,
+                                                           RadianceCache<C>::capacity_for(size_t(res.x) * res.y * spp));
+            }
+            auto Li = [=, &scene, cache = cache.get()](Ray3f ray, Sampler<C> &sampler) -> Spectrum {
                 (void)scene;
                 Intersection<C> intersection;
                 if (scene.intersect(ray, &intersection)) {
                     auto trig = scene.get_triangle(intersection.geom_id, intersection.prim_id);
+                    auto p = trig.p(intersection.uv);
+                    if (cache) {
+                        if (auto cached = cache->lookup(p, trig.ng())) {
+                            return cached.value();
+                        }
+                    }
                     Frame3f frame(trig.ng());
                     auto w = sampling<C>::cosine_hemisphere_sampling(sampler.next2d());
                     w = frame.local_to_world(w);
-                    ray = Ray3f(trig.p(intersection.uv), w);
+                    ray = Ray3f(p, w);
                     intersection = Intersection<C>();
+                    Spectrum visibility(1);
                     if (scene.intersect(ray, &intersection) && intersection.t < occlude)
-                        return Spectrum(0);
-                    return Spectrum(1);
+                        visibility = Spectrum(0);
+                    if (cache) {
+                        cache->record(p, trig.ng(), visibility);
+                    }
+                    return visibility;
                     // return trig.ng() * 0.5 + 0.5;
                 }
                 return Spectrum(0);
@@ -64,12 +83,16 @@ namespace akari {
 
             parallel_for_2d(n_tiles, [=, &scene, &mutex](const int2 &tile_pos, int tid) {
                 (void)tid;
-                Bounds2i tileBounds = Bounds2i{tile_pos * (int)tile_size, (tile_pos + int2(1)) * (int)tile_size};
+                Bounds2i tileBounds = film->tile_bounds(tile_pos, tile_size);
                 auto boxed_tile = film->boxed_tile(tileBounds);
                 auto &tile = *boxed_tile.get();
                 auto &camera = scene.camera;
                 auto sampler = scene.sampler;
                 for (int y = tile.bounds.pmin.y; y < tile.bounds.pmax.y; y++) {
+                    // once cancelled, rows already rendered are still merged
+                    if (render_cancellation().is_cancelled()) {
+                        break;
+                    }
                     for (int x = tile.bounds.pmin.x; x < tile.bounds.pmax.x; x++) {
                         sampler.set_sample_index(x + y * film->resolution().x);
                         for (int s = 0; s < spp; s++) {
@@ -84,12 +107,167 @@ namespace akari {
                 std::lock_guard<std::mutex> _(mutex);
                 film->merge_tile(tile);
             });
+            if (cache) {
+                cache->report();
+            }
+        }
+
+        // a pixel's camera vertex, kept between the passes of a frame
+        AKR_VARIANT struct ReservoirPixel {
+            AKR_IMPORT_TYPES()
+            GenericPathTracer<C> pt;
+            astd::optional<SurfaceInteraction<C>> si;
+            SurfaceHit<C> surface_hit;
+            ScatteringEvent<C> event;
+            // distance from the camera
+            Float distance = 0.0f;
+        };
+
+        // ReSTIR-style direct lighting at the camera vertex [Bitterli et al. 2020]
+        // Every sample pass is a frame of three passes: trace the camera vertices and fill their reservoirs (merged
+        // with the pixel's reservoir from the previous frame), merge reservoirs of nearby pixels on similar surfaces,
+        // then shade each pixel's winner with a single shadow ray and continue its path as usual. Reservoirs are
+        // combined with the biased 1/M weights, so reuse trades a little bias for much less noise.
+        AKR_VARIANT static void render_with_reservoir_reuse(const PathTracer<C> &integrator, const Scene<C> &scene,
+                                                            Film<C> *film, int max_depth) {
+            AKR_IMPORT_TYPES()
+            auto res = film->resolution();
+            size_t n_pixels = size_t(res.x) * size_t(res.y);
+            std::vector<ReservoirPixel<C>> pixels(n_pixels);
+            std::vector<Reservoir<C>> reservoirs(n_pixels), reused(n_pixels), previous(n_pixels);
+            for (size_t i = 0; i < n_pixels; i++) {
+                pixels[i].pt.sampler = scene.sampler;
+                pixels[i].pt.sampler.set_sample_index(i);
+            }
+            // a reused sample's target function at this pixel
+            auto target = [](const ReservoirPixel<C> &pixel, const Reservoir<C> &reservoir) -> Float {
+                auto light_sample = reservoir.y.connect(pixel.si->p);
+                return luminance(pixel.pt.unshadowed_contribution(*pixel.si, pixel.surface_hit, light_sample));
+            };
+            // keeps the previous frame from outweighing the fresh candidates
+            const Float max_history = 20.0f * integrator.ris_candidates;
+            auto crop = film->bounds();
+            std::mutex mutex;
+            for (int frame = 0; frame < integrator.spp && !render_cancellation().is_cancelled(); frame++) {
+                parallel_for(
+                    crop.size().y,
+                    [&](uint32_t row, uint32_t) {
+                        int y = crop.pmin.y + row;
+                        for (int x = crop.pmin.x; x < crop.pmax.x; x++) {
+                            auto i = x + y * res.x;
+                            auto &pixel = pixels[i];
+                            auto &pt = pixel.pt;
+                            auto sampler = pt.sampler;
+                            pt = GenericPathTracer<C>();
+                            pt.sampler = sampler;
+                            pt.max_depth = max_depth;
+                            pt.ris_candidates = integrator.ris_candidates;
+                            pt.sampler.start_next_sample();
+                            pixel.si.reset();
+                            reservoirs[i] = Reservoir<C>();
+                            Ray3f ray = pt.camera_ray(scene.camera, int2(x, y)).ray;
+                            auto hit = scene.intersect(ray);
+                            if (!hit) {
+                                pt.on_miss(scene, ray);
+                                continue;
+                            }
+                            SurfaceHit<C> surface_hit(ray, hit.value());
+                            auto trig = scene.get_triangle(surface_hit.geom_id, surface_hit.prim_id);
+                            surface_hit.material = trig.material;
+                            SurfaceInteraction<C> si(surface_hit.uv, trig);
+                            auto has_event = pt.on_surface_scatter(scene, si, surface_hit);
+                            if (!has_event) {
+                                continue;
+                            }
+                            auto reservoir = pt.sample_reservoir(scene, si, surface_hit);
+                            pixel.si = si;
+                            pixel.surface_hit = surface_hit;
+                            pixel.event = has_event.value();
+                            pixel.distance = hit.value().t;
+                            if (integrator.temporal_reuse && previous[i].M > 0.0f) {
+                                reservoir.merge(previous[i], target(pixel, previous[i]), pt.sampler.next1d(),
+                                                max_history);
+                                reservoir.finalize();
+                            }
+                            reservoirs[i] = reservoir;
+                        }
+                    },
+                    1);
+                if (integrator.spatial_reuse > 0) {
+                    parallel_for(
+                        crop.size().y,
+                        [&](uint32_t row, uint32_t) {
+                            int y = crop.pmin.y + row;
+                            for (int x = crop.pmin.x; x < crop.pmax.x; x++) {
+                                auto i = x + y * res.x;
+                                auto &pixel = pixels[i];
+                                reused[i] = reservoirs[i];
+                                if (!pixel.si) {
+                                    continue;
+                                }
+                                auto &sampler = pixel.pt.sampler;
+                                for (int k = 0; k < integrator.spatial_reuse; k++) {
+                                    auto offset = sampling<C>::concentric_disk_sampling(sampler.next2d()) *
+                                                  float(integrator.spatial_radius);
+                                    auto q = clamp(int2(x, y) + int2(offset), crop.pmin, crop.pmax - int2(1));
+                                    auto j = q.x + q.y * res.x;
+                                    auto &neighbour = pixels[j];
+                                    if (j == i || !neighbour.si || dot(neighbour.si->ns, pixel.si->ns) < 0.9f ||
+                                        std::abs(neighbour.distance - pixel.distance) > 0.1f * pixel.distance) {
+                                        continue;
+                                    }
+                                    reused[i].merge(reservoirs[j], target(pixel, reservoirs[j]), sampler.next1d());
+                                }
+                                reused[i].finalize();
+                            }
+                        },
+                        1);
+                } else {
+                    std::swap(reused, reservoirs);
+                }
+                parallel_for(
+                    crop.size().y,
+                    [&](uint32_t row, uint32_t) {
+                        int y = crop.pmin.y + row;
+                        auto tile = film->tile(Bounds2i{int2(crop.pmin.x, y), int2(crop.pmax.x, y + 1)});
+                        for (int x = crop.pmin.x; x < crop.pmax.x; x++) {
+                            auto i = x + y * res.x;
+                            auto &pixel = pixels[i];
+                            auto &pt = pixel.pt;
+                            if (pixel.si) {
+                                auto &si = pixel.si.value();
+                                auto has_direct = pt.resampled_direct_lighting(si, pixel.surface_hit, reused[i]);
+                                if (has_direct) {
+                                    auto &direct = has_direct.value();
+                                    if (!direct.color.is_black() && !scene.occlude(direct.shadow_ray)) {
+                                        pt.L += direct.color;
+                                    }
+                                }
+                                pt.beta *= pixel.event.beta;
+                                pt.depth++;
+                                pt.trace(scene, pixel.event.ray);
+                            }
+                            tile.add_sample(float2(x, y), pt.L, 1.0f);
+                        }
+                        std::lock_guard<std::mutex> _(mutex);
+                        film->merge_tile(tile);
+                    },
+                    1);
+                std::swap(previous, reused);
+            }
         }
 
         AKR_VARIANT void PathTracer<C>::render(const Scene<C> &scene, Film<C> *film) const {
             AKR_ASSERT_THROW(all(film->resolution() == scene.camera.resolution()));
             int max_depth = 5;
-            auto n_tiles = int2(film->resolution() + int2(tile_size - 1)) / int2(tile_size);
+            if (ris_candidates > 0 && (spatial_reuse > 0 || temporal_reuse)) {
+                if (radiance_cache) {
+                    warning("radiance cache is not used with reservoir reuse");
+                }
+                render_with_reservoir_reuse(*this, scene, film, max_depth);
+                return;
+            }
+            auto n_tiles = film->n_tiles(tile_size);
             std::mutex mutex;
             auto num_threads = num_work_threads();
             auto _arena = MemoryArena<>(astd::pmr::polymorphic_allocator<>(active_device()->managed_resource()));
@@ -112,14 +290,76 @@ namespace akari {
                     putchar('\n');
                 }
             });
-            parallel_for_2d(n_tiles, [=, &scene, &mutex, &small_arenas](const int2 &tile_pos, int tid) {
+            std::unique_ptr<RadianceCache<C>> cache;
+            if (radiance_cache) {
+                auto res = film->resolution();
+                cache = std::make_unique<RadianceCache<C>>(scene.bounds(), cache_resolution, cache_samples,
+                                                           RadianceCache<C>::capacity_for(size_t(res.x) * res.y * spp));
+            }
+            // same as GenericPathTracer::run_megakernel, except that the first bounce either answers from the
+            // cache or records the radiance the rest of the path gathers from it
+            auto run_cached = [&scene, cache = cache.get()](GenericPathTracer<C> &pt, const int2 &p) {
+                Ray3f ray = pt.camera_ray(scene.camera, p).ray;
+                bool recording = false;
+                Float3 record_p, record_n;
+                Spectrum record_L, record_beta;
+                while (true) {
+                    auto hit = scene.intersect(ray);
+                    if (!hit) {
+                        pt.on_miss(scene, ray);
+                        break;
+                    }
+                    SurfaceHit<C> surface_hit(ray, hit.value());
+                    auto trig = scene.get_triangle(surface_hit.geom_id, surface_hit.prim_id);
+                    surface_hit.material = trig.material;
+                    SurfaceInteraction<C> si(surface_hit.uv, trig);
+                    if (pt.depth == 1 && !surface_hit.material->template isa<EmissiveMaterial<C>>()) {
+                        if (auto cached = cache->lookup(si.p, si.ng)) {
+                            pt.L += pt.beta * cached.value();
+                            break;
+                        }
+                        recording = true;
+                        record_p = si.p;
+                        record_n = si.ng;
+                        record_L = pt.L;
+                        record_beta = pt.beta;
+                    }
+                    auto has_event = pt.on_surface_scatter(scene, si, surface_hit);
+                    if (!has_event) {
+                        break;
+                    }
+                    auto has_direct = pt.direct_lighting(scene, si, surface_hit);
+                    if (has_direct) {
+                        auto &direct = has_direct.value();
+                        if (!direct.color.is_black() && !scene.occlude(direct.shadow_ray)) {
+                            pt.L += direct.color;
+                        }
+                    }
+                    auto event = has_event.value();
+                    pt.beta *= event.beta;
+                    pt.depth++;
+                    ray = event.ray;
+                }
+                if (recording) {
+                    Spectrum Lo(0.0f);
+                    for (size_t i = 0; i < array_size_v<Spectrum>; i++) {
+                        Lo[i] = record_beta[i] > 0.0f ? (pt.L[i] - record_L[i]) / record_beta[i] : Float(0.0f);
+                    }
+                    cache->record(record_p, record_n, Lo);
+                }
+            };
+            parallel_for_2d(n_tiles, [=, &scene, &mutex, &small_arenas, &run_cached](const int2 &tile_pos, int tid) {
                 (void)tid;
-                Bounds2i tileBounds = Bounds2i{tile_pos * (int)tile_size, (tile_pos + int2(1)) * (int)tile_size};
+                Bounds2i tileBounds = film->tile_bounds(tile_pos, tile_size);
                 auto tile = film->tile(tileBounds);
                 auto &camera = scene.camera;
                 auto &arena = small_arenas[tid];
                 auto sampler = scene.sampler;
                 for (int y = tile.bounds.pmin.y; y < tile.bounds.pmax.y; y++) {
+                    // once cancelled, rows already rendered are still merged
+                    if (render_cancellation().is_cancelled()) {
+                        break;
+                    }
                     for (int x = tile.bounds.pmin.x; x < tile.bounds.pmax.x; x++) {
                         sampler.set_sample_index(x + y * film->resolution().x);
                         for (int s = 0; s < spp; s++) {
@@ -128,7 +368,12 @@ namespace akari {
                             pt.depth = 0;
                             pt.max_depth = max_depth;
                             pt.sampler = sampler;
-                            pt.run_megakernel(scene, camera, int2(x, y));
+                            pt.ris_candidates = ris_candidates;
+                            if (radiance_cache) {
+                                run_cached(pt, int2(x, y));
+                            } else {
+                                pt.run_megakernel(scene, camera, int2(x, y));
+                            }
                             sampler = pt.sampler;
                             tile.add_sample(float2(x, y), pt.L, 1.0f);
                             arena.reset();
@@ -139,6 +384,9 @@ namespace akari {
                 reporter->update();
                 film->merge_tile(tile);
             });
+            if (cache) {
+                cache->report();
+            }
         }
         AKR_RENDER_CLASS(AmbientOcclusion)
         AKR_RENDER_CLASS(PathTracer)
@@ -36,6 +36,10 @@ namespace akari {
             int spp = 16;
             int tile_size = 16;
             float occlude = std::numeric_limits<float>::infinity();
+            // preview mode: reuse visibility from a world-space cache instead of tracing every occlusion ray
+            bool radiance_cache = false;
+            int cache_resolution = 256;
+            int cache_samples = 16;
             AKR_IMPORT_TYPES()
             AmbientOcclusion() = default;
             AmbientOcclusion(int spp, float occlude) : spp(spp), occlude(occlude) {}
@@ -45,16 +49,92 @@ namespace akari {
           public:
             int spp = 16;
             int tile_size = 16;
+            // preview mode: paths end at their first bounce and take its outgoing radiance from a world-space
+            // cache, assuming it is diffuse
+            bool radiance_cache = false;
+            // cells along the scene's diagonal
+            int cache_resolution = 256;
+            // samples a cell gathers before answering lookups
+            int cache_samples = 16;
+            // light samples resampled into each direct lighting estimate, 0 for plain light sampling with MIS
+            int ris_candidates = 0;
+            // ReSTIR-style reuse at the camera vertex: every sample pass shares reservoirs between spatial_reuse
+            // random neighbours within spatial_radius pixels and with the pixel's reservoir from the previous pass
+            int spatial_reuse = 0;
+            int spatial_radius = 16;
+            bool temporal_reuse = false;
             AKR_IMPORT_TYPES()
             PathTracer() = default;
             PathTracer(int spp) : spp(spp) {}
             void render(const Scene<C> &scene, Film<C> *out) const;
         };
-        AKR_VARIANT class Integrator : public Variant<AmbientOcclusion<C>, PathTracer<C>> {
+        // Practical path guiding [Muller et al. 2017]
+        // Learns the incident radiance in an SD-tree (a spatial binary tree with directional quadtrees in its
+        // leaves) over progressive training passes, then samples it with one-sample MIS against the BSDF.
+        AKR_VARIANT class GuidedPathTracer {
+          public:
+            int spp = 16;
+            int tile_size = 16;
+            int max_depth = 5;
+            // fraction of the sample budget spent on training passes
+            float training_budget = 0.5f;
+            // probability of sampling the BSDF instead of the guiding distribution
+            float bsdf_fraction = 0.5f;
+            // a spatial leaf is split once it has recorded more than c * sqrt(2^iteration) samples
+            float spatial_threshold = 12000.0f;
+            // a directional node is split once it holds more than this fraction of the leaf's energy
+            float directional_threshold = 0.01f;
+            AKR_IMPORT_TYPES()
+            GuidedPathTracer() = default;
+            GuidedPathTracer(int spp, int max_depth) : spp(spp), max_depth(max_depth) {}
+            void render(const Scene<C> &scene, Film<C> *out) const;
+        };
+        // Traces particles from the area lights and splats their connections to the camera into the film.
+        // Handles caustics the camera paths cannot find; emitters are not visible through specular paths.
+        AKR_VARIANT class LightTracer {
+          public:
+            // light paths per pixel
+            int spp = 16;
+            int max_depth = 5;
+            AKR_IMPORT_TYPES()
+            LightTracer() = default;
+            LightTracer(int spp, int max_depth) : spp(spp), max_depth(max_depth) {}
+            void render(const Scene<C> &scene, Film<C> *out) const;
+        };
+        // Stochastic progressive photon mapping [Hachisuka and Jensen 2009]
+        // Each iteration traces one camera path per pixel to a visible point, buckets the visible points in a
+        // hashed grid and gathers photons into them, shrinking the per-pixel radius as photons accumulate.
+        AKR_VARIANT class SPPM {
+          public:
+            int iterations = 64;
+            // 0 for one photon per pixel
+            int photons_per_iteration = 0;
+            int max_depth = 5;
+            // 0 for 1/256 of the scene's diagonal
+            float initial_radius = 0.0f;
+            // fraction of new photons kept by the radius reduction
+            float alpha = 0.7f;
+            AKR_IMPORT_TYPES()
+            SPPM() = default;
+            SPPM(int iterations, int max_depth) : iterations(iterations), max_depth(max_depth) {}
+            void render(const Scene<C> &scene, Film<C> *out) const;
+        };
+        AKR_VARIANT class Integrator
+            : public Variant<AmbientOcclusion<C>, PathTracer<C>, GuidedPathTracer<C>, LightTracer<C>, SPPM<C>> {
           public:
             AKR_IMPORT_TYPES()
-            using Variant<AmbientOcclusion<C>, PathTracer<C>>::Variant;
+            using Variant<AmbientOcclusion<C>, PathTracer<C>, GuidedPathTracer<C>, LightTracer<C>, SPPM<C>>::Variant;
             void render(const Scene<C> &scene, Film<C> *out) const { AKR_VAR_DISPATCH(render, scene, out); }
+            // overrides the samples per pixel, or the number of iterations for SPPM
+            void set_spp(int spp) {
+                this->dispatch_cpu([=](auto &&integrator) {
+                    if constexpr (std::is_same_v<std::decay_t<decltype(integrator)>, SPPM<C>>) {
+                        integrator.iterations = spp;
+                    } else {
+                        integrator.spp = spp;
+                    }
+                });
+            }
         };
     } // namespace cpu
 } // namespace akari
\ No newline at end of file
@@ -0,0 +1,125 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <atomic>
+#include <akari/core/cancellation.h>
+#include <akari/core/parallel.h>
+#include <akari/kernel/integrators/cpu/integrator.h>
+#include <akari/core/film.h>
+#include <akari/core/logger.h>
+#include <akari/core/profiler.h>
+#include <akari/kernel/scene.h>
+#include <akari/kernel/interaction.h>
+#include <akari/kernel/material.h>
+#include <akari/kernel/sampling.h>
+
+namespace akari {
+    namespace cpu {
+        AKR_VARIANT void LightTracer<C>::render(const Scene<C> &scene, Film<C> *film) const {
+            AKR_ASSERT_THROW(all(film->resolution() == scene.camera.resolution()));
+            if (scene.area_lights.size() == 0) {
+                warning("light tracer: scene has no area lights");
+                return;
+            }
+            if (scene.environment_light) {
+                warning("light tracer: environment light is ignored");
+            }
+            auto &camera = scene.camera;
+            auto res = film->resolution();
+            // spp light paths per pixel, traced in batches that each own a sampler stream
+            const size_t n_paths = size_t(res.x) * res.y * spp;
+            const size_t batch_size = 256;
+            const size_t n_batches = (n_paths + batch_size - 1) / batch_size;
+            // @param weight: path throughput including the scattering function towards the camera
+            auto connect = [&](const CameraWiSample<C> &sample, const Float3 &n, const Spectrum &weight) {
+                Spectrum L = weight * sample.We * std::abs(dot(n, sample.wi)) / sample.pdf;
+                if (L.is_black() || scene.occlude(sample.shadow_ray))
+                    return;
+                film->add_splat(sample.p_raster, L);
+            };
+            Timer timer;
+            std::atomic<size_t> traced_batches{0};
+            parallel_for_range(0, n_batches, 1, [&](Range r, uint32_t) {
+                for (size_t batch = r.begin; batch < r.end; batch++) {
+                    if (render_cancellation().is_cancelled()) {
+                        return;
+                    }
+                    traced_batches++;
+                    auto sampler = scene.sampler;
+                    sampler.set_sample_index(batch);
+                    for (size_t i = batch * batch_size; i < std::min(n_paths, (batch + 1) * batch_size); i++) {
+                        sampler.start_next_sample();
+                        // the power distribution's trailing environment entry, if any, is rejected
+                        Float light_pdf;
+                        size_t light_idx = scene.light_distribution->sample_discrete(sampler.next1d(), &light_pdf);
+                        if (light_idx >= scene.area_lights.size())
+                            continue;
+                        auto &light = scene.area_lights[light_idx];
+                        auto u_pos = sampler.next2d();
+                        auto u_dir = sampler.next2d();
+                        auto emission = light.sample_emission(u_pos, u_dir, sampler.next1d());
+                        auto p = emission.ray.o;
+                        auto ng = emission.ng;
+                        Float pdf_pos = light_pdf * emission.pdf_pos;
+                        // emission seen directly by the camera
+                        if (auto has_sample = camera.sample_wi(p)) {
+                            if (light.double_sided || dot(has_sample->wi, ng) > 0.0f) {
+                                connect(has_sample.value(), ng, emission.L / pdf_pos);
+                            }
+                        }
+                        if (!(emission.pdf_dir > 0.0f))
+                            continue;
+                        auto ray = emission.ray;
+                        Spectrum beta = emission.L * std::abs(dot(ray.d, ng)) / (pdf_pos * emission.pdf_dir);
+                        for (int depth = 0; depth < max_depth; depth++) {
+                            auto hit = scene.intersect(ray);
+                            if (!hit)
+                                break;
+                            auto trig = scene.get_triangle(hit->geom_id, hit->prim_id);
+                            auto *material = trig.material;
+                            if (!material || material->template isa<EmissiveMaterial<C>>())
+                                break;
+                            SurfaceInteraction<C> si(hit->uv, trig);
+                            MaterialEvalContext<C> ctx(sampler, si);
+                            si.bsdf = material->get_bsdf(ctx);
+                            auto wo = -ray.d;
+                            if (auto has_sample = camera.sample_wi(si.p)) {
+                                auto f = si.bsdf.evaluate(wo, has_sample->wi);
+                                connect(has_sample.value(), si.ns, beta * f);
+                            }
+                            auto sample = si.bsdf.sample(BSDFSampleContext<C>(sampler.next2d(), wo));
+                            if (!(sample.pdf > 0.0f) || sample.f.is_black())
+                                break;
+                            beta *= sample.f * std::abs(dot(si.ng, sample.wi)) / sample.pdf;
+                            ray = Ray3f(si.p, sample.wi, Constants<Float>::Eps() / std::abs(dot(si.ng, sample.wi)));
+                        }
+                    }
+                }
+            });
+            // every pixel owns spp of the paths, so each splat is an spp-sample estimate; a cancelled render traced
+            // only a fraction of them
+            film->splatScale = traced_batches == 0 ? Float(0.0f) : Float(n_batches) / (Float(traced_batches) * spp);
+            info("light tracer: {} paths ({}s)", n_paths, timer.elapsed_seconds());
+        }
+        AKR_RENDER_CLASS(LightTracer)
+    } // namespace cpu
+} // namespace akari
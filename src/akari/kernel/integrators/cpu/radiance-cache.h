@@ -0,0 +1,168 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <akari/common/math.h>
+#include <akari/core/parallel.h>
+#include <akari/core/logger.h>
+
+namespace akari {
+    namespace cpu {
+        // World-space cache of outgoing radiance at diffuse-ish surfaces.
+        // Cells are keyed by quantized position and normal and live in an open-addressing hash table, so any
+        // number of threads can record and look up concurrently without locks.
+        AKR_VARIANT class RadianceCache {
+          public:
+            AKR_IMPORT_TYPES()
+            struct Stats {
+                size_t cells = 0;
+                size_t lookups = 0;
+                size_t hits = 0;
+                size_t records = 0;
+                // samples lost because their probe sequence was full
+                size_t dropped = 0;
+            };
+            // @param resolution: number of cells along the diagonal of bounds
+            // @param min_samples: a cell answers lookups once it has gathered this many samples
+            // @param capacity: number of hash table slots, rounded up to a power of two
+            RadianceCache(const Bounds3f &bounds, int resolution, int min_samples, size_t capacity = 1u << 20)
+                : min_samples(min_samples) {
+                origin = bounds.pmin;
+                extent = std::max<Float>(length(bounds.extents()) / std::max(resolution, 1), Float(1e-6f));
+                size_t cap = 1;
+                while (cap < capacity)
+                    cap <<= 1u;
+                mask = cap - 1;
+                entries = std::make_unique<Entry[]>(cap);
+            }
+            // Hash table slots for a render taking n_samples camera samples. Every sample records at most one cell,
+            // so there are never more cells than samples; half of the slots stay free to keep probe sequences short.
+            static size_t capacity_for(size_t n_samples) {
+                return std::clamp<size_t>(2 * n_samples, size_t(4096), size_t(1u << 20));
+            }
+            // edge length of a cell in world units
+            [[nodiscard]] Float cell_size() const { return extent; }
+            // average radiance of the cell containing (p, n), if it has enough samples
+            astd::optional<Spectrum> lookup(const Float3 &p, const Float3 &n) {
+                n_lookups.fetch_add(1, std::memory_order_relaxed);
+                auto *entry = find(key(p, n), false);
+                if (!entry)
+                    return astd::nullopt;
+                auto count = entry->count.load(std::memory_order_acquire);
+                if (count < (uint32_t)min_samples)
+                    return astd::nullopt;
+                n_hits.fetch_add(1, std::memory_order_relaxed);
+                Spectrum L;
+                for (size_t i = 0; i < array_size_v<Spectrum>; i++) {
+                    L[i] = entry->sum[i].value() / count;
+                }
+                return L;
+            }
+            void record(const Float3 &p, const Float3 &n, const Spectrum &L) {
+                auto *entry = find(key(p, n), true);
+                if (!entry) {
+                    n_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                for (size_t i = 0; i < array_size_v<Spectrum>; i++) {
+                    entry->sum[i].add(L[i]);
+                }
+                entry->count.fetch_add(1, std::memory_order_release);
+                n_records.fetch_add(1, std::memory_order_relaxed);
+            }
+            [[nodiscard]] Stats stats() const {
+                Stats s;
+                s.cells = n_cells.load();
+                s.lookups = n_lookups.load();
+                s.hits = n_hits.load();
+                s.records = n_records.load();
+                s.dropped = n_dropped.load();
+                return s;
+            }
+            void report() const {
+                auto s = stats();
+                info("radiance cache: {} cells of size {}, {}/{} lookups reused ({:.1f}%), {} records, {} dropped",
+                     s.cells, extent, s.hits, s.lookups, s.lookups == 0 ? 0.0 : 100.0 * s.hits / s.lookups,
+                     s.records, s.dropped);
+            }
+
+          private:
+            static constexpr int MaxProbes = 32;
+            struct Entry {
+                // 0 marks an empty slot
+                std::atomic<uint64_t> key{0};
+                AtomicFloat sum[array_size_v<Spectrum>];
+                std::atomic<uint32_t> count{0};
+            };
+            Float3 origin;
+            Float extent;
+            int min_samples;
+            size_t mask;
+            std::unique_ptr<Entry[]> entries;
+            std::atomic<size_t> n_cells{0}, n_lookups{0}, n_hits{0}, n_records{0}, n_dropped{0};
+
+            // 19 bits per cell coordinate, 5 bits for one of 27 normal bins, top bit set so keys are never 0
+            uint64_t key(const Float3 &p, const Float3 &n) const {
+                uint64_t k = uint64_t(1) << 63u;
+                uint64_t normal_bin = 0;
+                for (int i = 0; i < 3; i++) {
+                    auto q = (int64_t)std::floor((p[i] - origin[i]) / extent);
+                    k |= (uint64_t(q) & 0x7FFFFu) << (19u * i);
+                    normal_bin = normal_bin * 3 + std::clamp<int>(int((n[i] * 0.5f + 0.5f) * 3.0f), 0, 2);
+                }
+                return k | (normal_bin << 57u);
+            }
+            static uint64_t hash(uint64_t x) {
+                x ^= x >> 30u;
+                x *= 0xbf58476d1ce4e5b9ull;
+                x ^= x >> 27u;
+                x *= 0x94d049bb133111ebull;
+                x ^= x >> 31u;
+                return x;
+            }
+            Entry *find(uint64_t k, bool insert) {
+                size_t idx = hash(k) & mask;
+                for (int probe = 0; probe < MaxProbes; probe++) {
+                    auto &entry = entries[idx];
+                    uint64_t current = entry.key.load(std::memory_order_acquire);
+                    if (current == k)
+                        return &entry;
+                    if (current == 0) {
+                        if (!insert)
+                            return nullptr;
+                        if (entry.key.compare_exchange_strong(current, k, std::memory_order_acq_rel)) {
+                            n_cells.fetch_add(1, std::memory_order_relaxed);
+                            return &entry;
+                        }
+                        // another thread claimed the slot first, possibly for the same cell
+                        if (current == k)
+                            return &entry;
+                    }
+                    idx = (idx + 1) & mask;
+                }
+                return nullptr;
+            }
+        };
+    } // namespace cpu
+} // namespace akari
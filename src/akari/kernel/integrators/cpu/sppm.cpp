@@ -0,0 +1,335 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <atomic>
+#include <memory>
+#include <akari/core/cancellation.h>
+#include <akari/core/parallel.h>
+#include <akari/kernel/integrators/cpu/integrator.h>
+#include <akari/core/film.h>
+#include <akari/core/logger.h>
+#include <akari/core/profiler.h>
+#include <akari/kernel/scene.h>
+#include <akari/kernel/interaction.h>
+#include <akari/kernel/material.h>
+#include <akari/kernel/sampling.h>
+#include <akari/kernel/pathtracer.h>
+
+namespace akari {
+    namespace cpu {
+        namespace sppm {
+            AKR_VARIANT struct VisiblePoint {
+                AKR_IMPORT_TYPES()
+                Float3 p;
+                Float3 wo;
+                BSDF<C> bsdf;
+                Spectrum beta = Spectrum(0.0f);
+                bool valid = false;
+            };
+            AKR_VARIANT struct SPPMPixel {
+                AKR_IMPORT_TYPES()
+                Float radius = 0.0f;
+                // directly visible and directly lit radiance, summed over iterations
+                Spectrum Ld = Spectrum(0.0f);
+                VisiblePoint<C> vp;
+                // flux gathered by vp during the current photon pass
+                AtomicFloat phi[array_size_v<Spectrum>];
+                std::atomic<int> M{0};
+                Float N = 0.0f;
+                Spectrum tau = Spectrum(0.0f);
+            };
+            inline uint32_t hash_cell(const int3 &q, uint32_t size) {
+                uint64_t h = (uint64_t(uint32_t(q.x)) * 73856093u) ^ (uint64_t(uint32_t(q.y)) * 19349663u) ^
+                             (uint64_t(uint32_t(q.z)) * 83492791u);
+                return uint32_t(h % size);
+            }
+            // Visible points bucketed by hashed grid cell. Built with a counting sort: an atomic count per
+            // bucket, a prefix sum, then an atomic cursor per bucket to scatter the references. The hash table
+            // has one bucket per pixel, so memory stays bounded by the resolution no matter how big the radii get.
+            AKR_VARIANT struct VisiblePointGrid {
+                AKR_IMPORT_TYPES()
+                Bounds3f bounds;
+                Float cell_size = 1.0f;
+                uint32_t n_buckets = 0;
+                std::vector<uint32_t> offsets;
+                std::vector<uint32_t> refs;
+
+                int3 cell(const Float3 &p) const { return int3(floor((p - bounds.pmin) / cell_size)); }
+                template <class Pixels>
+                void build(const Pixels &pixels, size_t n_pixels) {
+                    n_buckets = (uint32_t)std::max<size_t>(n_pixels, 1);
+                    bounds = Bounds3f();
+                    Float max_radius = 0.0f;
+                    for (size_t i = 0; i < n_pixels; i++) {
+                        if (!pixels[i].vp.valid)
+                            continue;
+                        bounds = bounds.expand(pixels[i].vp.p);
+                        max_radius = std::max(max_radius, pixels[i].radius);
+                    }
+                    // a point's disk then overlaps at most two cells per axis
+                    cell_size = std::max<Float>(2.0f * max_radius, Float(1e-6f));
+                    bounds.pmin -= Float3(max_radius);
+                    std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[n_buckets]);
+                    for (uint32_t i = 0; i < n_buckets; i++) {
+                        counts[i] = 0;
+                    }
+                    auto for_each_bucket = [&](size_t i, auto &&f) {
+                        auto &pixel = pixels[i];
+                        auto lo = cell(pixel.vp.p - Float3(pixel.radius));
+                        auto hi = cell(pixel.vp.p + Float3(pixel.radius));
+                        for (int z = lo.z; z <= hi.z; z++)
+                            for (int y = lo.y; y <= hi.y; y++)
+                                for (int x = lo.x; x <= hi.x; x++)
+                                    f(hash_cell(int3(x, y, z), n_buckets));
+                    };
+                    parallel_for(
+                        n_pixels,
+                        [&](uint32_t i, uint32_t) {
+                            if (pixels[i].vp.valid)
+                                for_each_bucket(i,
+                                                [&](uint32_t h) { counts[h].fetch_add(1, std::memory_order_relaxed); });
+                        },
+                        1024);
+                    offsets.assign(n_buckets + 1, 0);
+                    for (uint32_t i = 0; i < n_buckets; i++) {
+                        offsets[i + 1] = offsets[i] + counts[i].load(std::memory_order_relaxed);
+                        counts[i] = 0;
+                    }
+                    refs.resize(offsets[n_buckets]);
+                    parallel_for(
+                        n_pixels,
+                        [&](uint32_t i, uint32_t) {
+                            if (pixels[i].vp.valid)
+                                for_each_bucket(i, [&](uint32_t h) {
+                                    refs[offsets[h] + counts[h].fetch_add(1, std::memory_order_relaxed)] = i;
+                                });
+                        },
+                        1024);
+                }
+                template <class F>
+                void for_each_point(const Float3 &p, F &&f) const {
+                    if (refs.empty())
+                        return;
+                    auto h = hash_cell(cell(p), n_buckets);
+                    for (uint32_t i = offsets[h]; i < offsets[h + 1]; i++) {
+                        f(refs[i]);
+                    }
+                }
+                [[nodiscard]] size_t memory_usage() const {
+                    return offsets.size() * sizeof(uint32_t) + refs.size() * sizeof(uint32_t);
+                }
+            };
+        } // namespace sppm
+
+        AKR_VARIANT void SPPM<C>::render(const Scene<C> &scene, Film<C> *film) const {
+            using namespace sppm;
+            AKR_ASSERT_THROW(all(film->resolution() == scene.camera.resolution()));
+            if (scene.area_lights.size() == 0) {
+                warning("sppm: scene has no area lights");
+                return;
+            }
+            auto res = film->resolution();
+            auto crop = film->bounds();
+            const size_t n_pixels = size_t(res.x) * res.y;
+            const size_t n_photons = photons_per_iteration > 0 ? size_t(photons_per_iteration) : n_pixels;
+            Float radius0 = initial_radius > 0.0f ? Float(initial_radius) : length(scene.bounds().extents()) / 256.0f;
+            std::unique_ptr<SPPMPixel<C>[]> pixels(new SPPMPixel<C>[n_pixels]);
+            for (size_t i = 0; i < n_pixels; i++) {
+                pixels[i].radius = radius0;
+            }
+            VisiblePointGrid<C> grid;
+            Timer timer;
+            // iterations run to completion; a cancelled render stops between them
+            int completed = 0;
+            for (int iter = 0; iter < iterations && !render_cancellation().is_cancelled(); iter++, completed++) {
+                // camera pass: direct lighting and one visible point per pixel, found through glossy bounces
+                // pixels outside the crop window keep no visible point
+                parallel_for(
+                    crop.size().y,
+                    [&](uint32_t row, uint32_t) {
+                        int y = crop.pmin.y + row;
+                        for (int x = crop.pmin.x; x < crop.pmax.x; x++) {
+                            auto &pixel = pixels[x + y * res.x];
+                            pixel.vp.valid = false;
+                            GenericPathTracer<C> pt;
+                            pt.sampler = scene.sampler;
+                            pt.sampler.set_sample_index((uint64_t(iter) * n_pixels) + x + y * res.x);
+                            pt.max_depth = max_depth;
+                            Ray3f ray = pt.camera_ray(scene.camera, int2(x, y)).ray;
+                            for (pt.depth = 0; pt.depth < max_depth; pt.depth++) {
+                                auto hit = scene.intersect(ray);
+                                if (!hit) {
+                                    pixel.Ld += pt.beta * pt.environment_radiance(scene, ray, pt.prev_bsdf_pdf);
+                                    break;
+                                }
+                                SurfaceHit<C> surface_hit(ray, hit.value());
+                                auto trig = scene.get_triangle(surface_hit.geom_id, surface_hit.prim_id);
+                                surface_hit.material = trig.material;
+                                SurfaceInteraction<C> si(surface_hit.uv, trig);
+                                pt.apply_ray_differential(si);
+                                if (!surface_hit.material)
+                                    break;
+                                if (surface_hit.material->template isa<EmissiveMaterial<C>>()) {
+                                    pixel.Ld +=
+                                        pt.beta * pt.emitted_radiance(scene, si, surface_hit, pt.prev_bsdf_pdf);
+                                    break;
+                                }
+                                MaterialEvalContext<C> ctx(pt.sampler, si);
+                                si.bsdf = surface_hit.material->get_bsdf(ctx);
+                                bool is_visible_point = si.bsdf.match_flags(BSDF_DIFFUSE) || pt.depth == max_depth - 1;
+                                // the path ends at a visible point, so no BSDF sample competes with the light sample
+                                auto has_direct = pt.compute_direct_lighting(
+                                    si, surface_hit, pt.select_light(scene, si), [&](const Float3 &wi) {
+                                        return is_visible_point ? Float(0.0f)
+                                                                : si.bsdf.evaluate_pdf(surface_hit.wo, wi);
+                                    });
+                                if (has_direct) {
+                                    auto &direct = has_direct.value();
+                                    if (!direct.color.is_black() && !scene.occlude(direct.shadow_ray)) {
+                                        pixel.Ld += direct.color;
+                                    }
+                                }
+                                if (is_visible_point) {
+                                    pixel.vp.p = si.p;
+                                    pixel.vp.wo = surface_hit.wo;
+                                    pixel.vp.bsdf = si.bsdf;
+                                    pixel.vp.beta = pt.beta;
+                                    pixel.vp.valid = true;
+                                    break;
+                                }
+                                auto sample = si.bsdf.sample(BSDFSampleContext<C>(pt.sampler.next2d(), surface_hit.wo));
+                                if (!(sample.pdf > 0.0f) || sample.f.is_black())
+                                    break;
+                                pt.beta *= sample.f * std::abs(dot(si.ns, sample.wi)) / sample.pdf;
+                                pt.prev_p = si.p;
+                                pt.prev_n = si.ns;
+                                pt.prev_bsdf_pdf = sample.pdf;
+                                ray = Ray3f(si.p, sample.wi, Constants<Float>::Eps() / std::abs(dot(si.ng, sample.wi)));
+                            }
+                        }
+                    },
+                    1);
+                grid.build(pixels.get(), n_pixels);
+                info("sppm iteration {}/{}: grid {} buckets, {} references, {:.2f} MB", iter + 1, iterations,
+                     grid.n_buckets, grid.refs.size(), grid.memory_usage() / (1024.0 * 1024.0));
+                // photon pass
+                const size_t batch_size = 256;
+                const size_t n_batches = (n_photons + batch_size - 1) / batch_size;
+                parallel_for(n_batches, [&](uint32_t batch, uint32_t) {
+                    auto sampler = scene.sampler;
+                    sampler.set_sample_index(uint64_t(iter) * n_batches + batch + 0x9e3779b9u);
+                    for (size_t i = batch * batch_size; i < std::min(n_photons, (batch + 1) * batch_size); i++) {
+                        sampler.start_next_sample();
+                        Float light_pdf;
+                        size_t light_idx = scene.light_distribution->sample_discrete(sampler.next1d(), &light_pdf);
+                        if (light_idx >= scene.area_lights.size())
+                            continue;
+                        auto u_pos = sampler.next2d();
+                        auto u_dir = sampler.next2d();
+                        auto emission = scene.area_lights[light_idx].sample_emission(u_pos, u_dir, sampler.next1d());
+                        if (!(emission.pdf_dir > 0.0f))
+                            continue;
+                        auto ray = emission.ray;
+                        Spectrum beta = emission.L * std::abs(dot(ray.d, emission.ng)) /
+                                        (light_pdf * emission.pdf_pos * emission.pdf_dir);
+                        for (int depth = 0; depth < max_depth; depth++) {
+                            auto hit = scene.intersect(ray);
+                            if (!hit)
+                                break;
+                            auto trig = scene.get_triangle(hit->geom_id, hit->prim_id);
+                            auto *material = trig.material;
+                            if (!material || material->template isa<EmissiveMaterial<C>>())
+                                break;
+                            SurfaceInteraction<C> si(hit->uv, trig);
+                            // direct lighting is already in Ld
+                            if (depth > 0) {
+                                grid.for_each_point(si.p, [&](uint32_t idx) {
+                                    auto &pixel = pixels[idx];
+                                    auto d = pixel.vp.p - si.p;
+                                    if (dot(d, d) > pixel.radius * pixel.radius)
+                                        return;
+                                    auto phi = beta * pixel.vp.bsdf.evaluate(pixel.vp.wo, -ray.d);
+                                    for (size_t ch = 0; ch < array_size_v<Spectrum>; ch++) {
+                                        pixel.phi[ch].add(phi[ch]);
+                                    }
+                                    pixel.M.fetch_add(1, std::memory_order_relaxed);
+                                });
+                            }
+                            MaterialEvalContext<C> ctx(sampler, si);
+                            si.bsdf = material->get_bsdf(ctx);
+                            auto sample = si.bsdf.sample(BSDFSampleContext<C>(sampler.next2d(), -ray.d));
+                            if (!(sample.pdf > 0.0f) || sample.f.is_black())
+                                break;
+                            auto beta_new = beta * sample.f * std::abs(dot(si.ns, sample.wi)) / sample.pdf;
+                            // russian roulette on the throughput change keeps photon weights bounded
+                            Float q = std::max<Float>(
+                                0.0f, 1.0f - luminance(beta_new) / std::max<Float>(luminance(beta), 1e-8f));
+                            if (sampler.next1d() < q)
+                                break;
+                            beta = beta_new / (1.0f - q);
+                            ray = Ray3f(si.p, sample.wi, Constants<Float>::Eps() / std::abs(dot(si.ng, sample.wi)));
+                        }
+                    }
+                });
+                // progressive radius reduction [Hachisuka and Jensen 2009]
+                parallel_for(
+                    n_pixels,
+                    [&](uint32_t i, uint32_t) {
+                        auto &pixel = pixels[i];
+                        int M = pixel.M.load(std::memory_order_relaxed);
+                        if (M > 0) {
+                            Float N_new = pixel.N + alpha * M;
+                            Float radius_new = pixel.radius * std::sqrt(N_new / (pixel.N + M));
+                            Spectrum phi;
+                            for (size_t ch = 0; ch < array_size_v<Spectrum>; ch++) {
+                                phi[ch] = pixel.phi[ch].value();
+                                pixel.phi[ch].set(0.0f);
+                            }
+                            pixel.tau = (pixel.tau + pixel.vp.beta * phi) * (radius_new * radius_new) /
+                                        (pixel.radius * pixel.radius);
+                            pixel.N = N_new;
+                            pixel.radius = radius_new;
+                            pixel.M = 0;
+                        }
+                    },
+                    1024);
+            }
+            if (completed == 0) {
+                return;
+            }
+            auto tile = film->tile(film->bounds());
+            const double total_photons = double(n_photons) * completed;
+            for (int y = crop.pmin.y; y < crop.pmax.y; y++) {
+                for (int x = crop.pmin.x; x < crop.pmax.x; x++) {
+                    auto &pixel = pixels[x + y * res.x];
+                    Spectrum L = pixel.Ld / Float(completed);
+                    L += pixel.tau /
+                         Float(total_photons * Constants<Float>::Pi() * pixel.radius * pixel.radius);
+                    tile.add_sample(float2(x, y), L, 1.0f);
+                }
+            }
+            film->merge_tile(tile);
+            info("sppm: {} iterations, {} photons ({}s)", completed, size_t(total_photons), timer.elapsed_seconds());
+        }
+        AKR_RENDER_CLASS(SPPM)
+    } // namespace cpu
+} // namespace akari
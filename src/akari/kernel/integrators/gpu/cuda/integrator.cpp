@@ -43,7 +43,7 @@ namespace akari::gpu {
     AKR_VARIANT void AmbientOcclusion<C>::render(const Scene<C> &scene, Film<C> *film) const {
         if constexpr (std::is_same_v<Float, float>) {
             AKR_ASSERT_THROW(all(film->resolution() == scene.camera.resolution()));
-            auto n_tiles = int2(film->resolution() + int2(tile_size - 1)) / int2(tile_size);
+            auto n_tiles = film->n_tiles(tile_size);
             auto Li = AKR_GPU_LAMBDA(Ray3f ray, Sampler<C> & sampler)->Spectrum {
                 Intersection<C> intersection;
                 if (scene.intersect(ray, &intersection)) {
@@ -67,7 +67,7 @@ namespace akari::gpu {
             for (int tile_y = 0; tile_y < n_tiles.y; tile_y++) {
                 for (int tile_x = 0; tile_x < n_tiles.x; tile_x++) {
                     int2 tile_pos(tile_x, tile_y);
-                    Bounds2i tileBounds = Bounds2i{tile_pos * (int)tile_size, (tile_pos + int2(1)) * (int)tile_size};
+                    Bounds2i tileBounds = film->tile_bounds(tile_pos, tile_size);
                     auto boxed_tile = film->boxed_tile(tileBounds);
                     auto &camera = scene.camera;
                     auto sampler = scene.sampler;
@@ -149,7 +149,7 @@ namespace akari::gpu {
     struct ShadowRay;
     AKR_VARIANT void PathTracerImpl<C>::render(const Scene<C> &scene, Film<C> *film) {
         std::shared_ptr<ProgressReporter> reporter;
-        auto n_tiles = int2(film->resolution() + int2(tile_size - 1)) / int2(tile_size);
+        auto n_tiles = film->n_tiles(tile_size);
         struct WorkTile {
             int2 tile_pos;
             Bounds2i tile_bounds;
@@ -162,7 +162,7 @@ namespace akari::gpu {
         for (int tile_y = 0; tile_y < n_tiles.y; tile_y++) {
             for (int tile_x = 0; tile_x < n_tiles.x; tile_x++) {
                 int2 tile_pos(tile_x, tile_y);
-                Bounds2i tileBounds = Bounds2i{tile_pos * (int)tile_size, (tile_pos + int2(1)) * (int)tile_size};
+                Bounds2i tileBounds = film->tile_bounds(tile_pos, tile_size);
                 tiles.emplace_back(tile_pos, tileBounds, film);
             }
         }
@@ -311,6 +311,10 @@ namespace akari::gpu {
                             if (path_state.state != PathKernelState::HitNothing) {
                                 return;
                             }
+                            auto pt = path_state.path_tracer();
+                            pt.depth = path_state.depth;
+                            pt.on_miss(scene, (*ray_queue[0])[tid].ray);
+                            path_state.update(pt);
                             path_state.state = PathKernelState::Splat;
                             path_states[tid] = path_state;
                         });
@@ -332,13 +336,13 @@ namespace akari::gpu {
                                 auto trig = scene.get_triangle(material_item.geom_id, material_item.prim_id);
                                 SurfaceInteraction<C> si(surface_hit.uv, trig);
 
-                                auto has_event = pt.on_surface_scatter(si, surface_hit, material_item.pdf);
+                                auto has_event = pt.on_surface_scatter(scene, si, surface_hit, material_item.pdf);
                                 if (has_event) {
                                     auto event = has_event.value();
 
                                     // Direct Light Sampling
                                     astd::optional<DirectLighting<C>> has_direct =
-                                        pt.compute_direct_lighting(si, surface_hit, pt.select_light(scene));
+                                        pt.compute_direct_lighting(si, surface_hit, pt.select_light(scene, si));
                                     path_state.state = PathKernelState::ExtensionRay;
                                     if (has_direct) {
                                         auto direct = has_direct.value();
@@ -56,6 +56,7 @@ namespace akari {
             AKR_IMPORT_TYPES()
             using Variant<AmbientOcclusion<C>, PathTracer<C>>::Variant;
             void render(const Scene<C> &scene, Film<C> *out) const { AKR_VAR_DISPATCH(render, scene, out); }
+            void set_spp(int spp) { this->dispatch_cpu([=](auto &&integrator) { integrator.spp = spp; }); }
         };
     } // namespace gpu
 } // namespace akari
\ No newline at end of file
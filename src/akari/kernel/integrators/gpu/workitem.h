@@ -42,17 +42,26 @@ namespace akari {
         Sampler<C> sampler;
         Spectrum L;
         Spectrum beta;
+        Float3 prev_p;
+        Float3 prev_n;
+        Float prev_bsdf_pdf;
         AKR_XPU GenericPathTracer<C> path_tracer() const {
             GenericPathTracer<C> pt;
             pt.sampler = sampler;
             pt.L = L;
             pt.beta = beta;
+            pt.prev_p = prev_p;
+            pt.prev_n = prev_n;
+            pt.prev_bsdf_pdf = prev_bsdf_pdf;
             return pt;
         }
         AKR_XPU void update(const GenericPathTracer<C> &pt) {
             sampler = pt.sampler;
             L = pt.L;
             beta = pt.beta;
+            prev_p = pt.prev_p;
+            prev_n = pt.prev_n;
+            prev_bsdf_pdf = pt.prev_bsdf_pdf;
         }
         // bool terminated = false;
     };
@@ -33,6 +33,8 @@ namespace akari {
         BSDF<C> bsdf;
         Float3 ng, ns;
         float2 texcoords;
+        // change of texcoords from one pixel to the next; zero when unknown, which selects the finest MIP level
+        float2 dtcdx = float2(0), dtcdy = float2(0);
 
         AKR_XPU SurfaceInteraction(const Intersection<C> &isct, const Triangle<C> &triangle)
             : triangle(triangle), p(isct.p), ng(isct.ng), ns(triangle.ns(isct.uv)),
@@ -40,5 +42,34 @@ namespace akari {
         AKR_XPU SurfaceInteraction(const float2 &uv, const Triangle<C> &triangle)
             : triangle(triangle), p(triangle.p(uv)), ng(triangle.ng()), ns(triangle.ns(uv)),
               texcoords(triangle.texcoord(uv)) {}
+
+        // Texcoord derivatives from where the neighbouring pixels' rays meet the triangle's plane. The offsets are
+        // expressed in barycentric coordinates by least squares on the triangle's edges, so triangles with
+        // degenerate texcoords need no special case.
+        template <class Differential>
+        AKR_XPU void compute_differentials(const Differential &diff) {
+            Float dx_cos = dot(ng, diff.rx_d), dy_cos = dot(ng, diff.ry_d);
+            if (std::abs(dx_cos) < Float(1e-6f) || std::abs(dy_cos) < Float(1e-6f)) {
+                return;
+            }
+            Float3 dpdx = diff.rx_o + diff.rx_d * (dot(ng, p - diff.rx_o) / dx_cos) - p;
+            Float3 dpdy = diff.ry_o + diff.ry_d * (dot(ng, p - diff.ry_o) / dy_cos) - p;
+            Float3 e1 = triangle.vertices[1] - triangle.vertices[0];
+            Float3 e2 = triangle.vertices[2] - triangle.vertices[0];
+            Float a = dot(e1, e1), b = dot(e1, e2), c = dot(e2, e2);
+            Float det = a * c - b * b;
+            if (!(std::abs(det) > Float(1e-20f))) {
+                return;
+            }
+            auto to_texcoords = [&](const Float3 &dp) {
+                Float r1 = dot(e1, dp), r2 = dot(e2, dp);
+                Float db1 = (c * r1 - b * r2) / det;
+                Float db2 = (a * r2 - b * r1) / det;
+                return float2((triangle.texcoords[1] - triangle.texcoords[0]) * db1 +
+                              (triangle.texcoords[2] - triangle.texcoords[0]) * db2);
+            };
+            dtcdx = to_texcoords(dpdx);
+            dtcdy = to_texcoords(dpdy);
+        }
     };
 } // namespace akari
\ No newline at end of file
@@ -0,0 +1,357 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <akari/common/math.h>
+#include <akari/common/buffer.h>
+#include <akari/core/parallel.h>
+#include <akari/kernel/light.h>
+namespace akari {
+    // Bounding cone of emitted directions: every emitting normal lies within theta_o of axis, and light
+    // leaves each point within theta_e of its normal
+    AKR_VARIANT struct LightBounds {
+        AKR_IMPORT_TYPES()
+        Bounds3f bounds;
+        Float3 axis = Float3(0.0f, 0.0f, 1.0f);
+        Float cos_theta_o = 1.0f;
+        Float cos_theta_e = 0.0f;
+        Float power = 0.0f;
+        bool two_sided = false;
+
+        AKR_XPU static Float cos_sub_clamped(Float sin_a, Float cos_a, Float sin_b, Float cos_b) {
+            if (cos_a > cos_b)
+                return 1.0f;
+            return cos_a * cos_b + sin_a * sin_b;
+        }
+        AKR_XPU static Float sin_sub_clamped(Float sin_a, Float cos_a, Float sin_b, Float cos_b) {
+            if (cos_a > cos_b)
+                return 0.0f;
+            return sin_a * cos_b - cos_a * sin_b;
+        }
+        AKR_XPU static Float safe_sqrt(Float x) { return sqrt(max(Float(0.0f), x)); }
+        // conservative estimate of the contribution of the lights inside to a point p with normal n
+        // n may be zero for points without a surface
+        AKR_XPU Float importance(const Float3 &p, const Float3 &n) const {
+            auto pc = bounds.centroid();
+            auto d = p - pc;
+            auto d2 = max(dot(d, d), length(bounds.extents()) * Float(0.5f));
+            Float3 wi = d / sqrt(max(dot(d, d), Float(1e-12f)));
+            Float cos_theta_w = dot(axis, wi);
+            if (two_sided)
+                cos_theta_w = std::abs(cos_theta_w);
+            Float sin_theta_w = safe_sqrt(1.0f - cos_theta_w * cos_theta_w);
+            // angle subtended by the bounds as seen from p
+            Float cos_theta_b = -1.0f;
+            auto radius2 = dot(bounds.extents(), bounds.extents()) * Float(0.25f);
+            if (dot(d, d) > radius2) {
+                cos_theta_b = safe_sqrt(1.0f - radius2 / dot(d, d));
+            }
+            Float sin_theta_b = safe_sqrt(1.0f - cos_theta_b * cos_theta_b);
+            Float sin_theta_o = safe_sqrt(1.0f - cos_theta_o * cos_theta_o);
+            Float cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+            Float sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+            Float cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+            if (cos_theta_p <= cos_theta_e)
+                return 0.0f;
+            Float result = power * cos_theta_p / d2;
+            if (dot(n, n) > 0.0f) {
+                Float cos_theta_i = std::abs(dot(wi, n));
+                Float sin_theta_i = safe_sqrt(1.0f - cos_theta_i * cos_theta_i);
+                result *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+            }
+            return max(result, Float(0.0f));
+        }
+        static LightBounds merge(const LightBounds &a, const LightBounds &b) {
+            if (a.power == 0.0f)
+                return b;
+            if (b.power == 0.0f)
+                return a;
+            LightBounds r;
+            r.bounds = a.bounds.merge(b.bounds);
+            r.power = a.power + b.power;
+            r.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+            r.two_sided = a.two_sided || b.two_sided;
+            // union of the two normal cones
+            Float theta_a = std::acos(std::clamp<Float>(a.cos_theta_o, -1, 1));
+            Float theta_b = std::acos(std::clamp<Float>(b.cos_theta_o, -1, 1));
+            Float theta_d = std::acos(std::clamp<Float>(dot(a.axis, b.axis), -1, 1));
+            const Float pi = Constants<Float>::Pi();
+            if (std::min(theta_d + theta_b, pi) <= theta_a) {
+                r.axis = a.axis;
+                r.cos_theta_o = a.cos_theta_o;
+            } else if (std::min(theta_d + theta_a, pi) <= theta_b) {
+                r.axis = b.axis;
+                r.cos_theta_o = b.cos_theta_o;
+            } else {
+                Float theta_o = (theta_a + theta_d + theta_b) * Float(0.5f);
+                auto k = cross(a.axis, b.axis);
+                if (theta_o >= pi || dot(k, k) == 0.0f) {
+                    r.axis = a.axis;
+                    r.cos_theta_o = -1.0f;
+                } else {
+                    // rotate a.axis towards b.axis by theta_o - theta_a
+                    Float theta_r = theta_o - theta_a;
+                    k = normalize(k);
+                    auto v = a.axis;
+                    r.axis = normalize(v * std::cos(theta_r) + cross(k, v) * std::sin(theta_r) +
+                                       k * dot(k, v) * (Float(1.0f) - std::cos(theta_r)));
+                    r.cos_theta_o = std::cos(theta_o);
+                }
+            }
+            return r;
+        }
+    };
+
+    // BVH over area lights for many-light sampling [Conty Estevez and Kulla 2018]
+    // Lights are selected by descending the tree and choosing each child proportionally to its importance
+    // with respect to the shading point. Each light records its root-to-leaf path so pdf() can replay it.
+    AKR_VARIANT class LightBVH {
+      public:
+        AKR_IMPORT_TYPES()
+        struct Node {
+            LightBounds<C> light_bounds;
+            int left = -1;
+            int right = -1;
+            int light = -1;
+            AKR_XPU bool is_leaf() const { return light >= 0; }
+        };
+        static constexpr int MaxDepth = 64;
+
+        LightBVH(MemoryResource *resource, const AreaLight<C> *lights, const Float *power, size_t n)
+            : nodes(resource), light_paths(resource) {
+            if (n == 0)
+                return;
+            std::vector<LightBounds<C>> bounds(n);
+            for (size_t i = 0; i < n; i++) {
+                auto &triangle = lights[i].triangle;
+                auto &b = bounds[i];
+                for (int j = 0; j < 3; j++) {
+                    b.bounds = b.bounds.expand(triangle.vertices[j]);
+                }
+                b.axis = triangle.ng();
+                b.power = power[i];
+                b.two_sided = lights[i].double_sided;
+            }
+            std::vector<int> refs;
+            for (size_t i = 0; i < n; i++) {
+                if (power[i] > 0.0f)
+                    refs.emplace_back(int(i));
+            }
+            if (refs.empty())
+                return;
+            std::vector<uint64_t> paths(n, 0);
+            build_nodes.reserve(2 * refs.size());
+            recursive_build(bounds, std::move(refs), 0);
+            assign_paths(0, 0, 0, paths);
+            nodes.copy(build_nodes.data(), build_nodes.size());
+            light_paths.copy(paths.data(), paths.size());
+            build_nodes = std::vector<Node>();
+        }
+        [[nodiscard]] AKR_XPU bool empty() const { return nodes.size() == 0; }
+        // returns the index of the selected light and its probability, or -1 if no light contributes at p
+        AKR_XPU int sample(Float u, const Float3 &p, const Float3 &n, Float *pdf) const {
+            *pdf = 0.0f;
+            if (empty())
+                return -1;
+            Float pmf = 1.0f;
+            int idx = 0;
+            while (true) {
+                auto &node = nodes[idx];
+                if (node.is_leaf()) {
+                    if (idx == 0 && !(node.light_bounds.importance(p, n) > 0.0f))
+                        return -1;
+                    *pdf = pmf;
+                    return node.light;
+                }
+                Float i0 = nodes[node.left].light_bounds.importance(p, n);
+                Float i1 = nodes[node.right].light_bounds.importance(p, n);
+                if (!(i0 + i1 > 0.0f))
+                    return -1;
+                Float p0 = i0 / (i0 + i1);
+                if (u < p0) {
+                    u = min(u / p0, Float(OneMinusEpsilon));
+                    pmf *= p0;
+                    idx = node.left;
+                } else {
+                    u = min((u - p0) / (1.0f - p0), Float(OneMinusEpsilon));
+                    pmf *= 1.0f - p0;
+                    idx = node.right;
+                }
+            }
+        }
+        AKR_XPU Float pdf(int light, const Float3 &p, const Float3 &n) const {
+            if (empty())
+                return 0.0f;
+            uint64_t path = light_paths[light];
+            Float pmf = 1.0f;
+            int idx = 0;
+            while (!nodes[idx].is_leaf()) {
+                auto &node = nodes[idx];
+                Float i0 = nodes[node.left].light_bounds.importance(p, n);
+                Float i1 = nodes[node.right].light_bounds.importance(p, n);
+                if (!(i0 + i1 > 0.0f))
+                    return 0.0f;
+                if (path & 1u) {
+                    pmf *= i1 / (i0 + i1);
+                    idx = node.right;
+                } else {
+                    pmf *= i0 / (i0 + i1);
+                    idx = node.left;
+                }
+                path >>= 1u;
+            }
+            return nodes[idx].light == light ? pmf : Float(0.0f);
+        }
+        [[nodiscard]] size_t num_nodes() const { return nodes.size(); }
+
+      private:
+        static constexpr Float OneMinusEpsilon = Float(1.0f) - std::numeric_limits<Float>::epsilon();
+        Buffer<Node> nodes;
+        Buffer<uint64_t> light_paths;
+        std::vector<Node> build_nodes;
+        std::mutex m;
+
+        int recursive_build(const std::vector<LightBounds<C>> &bounds, std::vector<int> refs, int depth) {
+            LightBounds<C> lb;
+            Bounds3f centroid_bounds;
+            for (auto i : refs) {
+                lb = LightBounds<C>::merge(lb, bounds[i]);
+                centroid_bounds = centroid_bounds.expand(bounds[i].bounds.centroid());
+            }
+            int ret;
+            {
+                std::lock_guard<std::mutex> _(m);
+                ret = (int)build_nodes.size();
+                build_nodes.emplace_back();
+                build_nodes[ret].light_bounds = lb;
+            }
+            if (refs.size() == 1) {
+                std::lock_guard<std::mutex> _(m);
+                build_nodes[ret].light = refs[0];
+                return ret;
+            }
+            auto partition = split(bounds, refs, lb, centroid_bounds, depth);
+            auto left_refs = std::vector<int>(refs.begin(), refs.begin() + partition);
+            auto right_refs = std::vector<int>(refs.begin() + partition, refs.end());
+            refs = std::vector<int>();
+            int left, right;
+            if (left_refs.size() + right_refs.size() > 64 * 1024) {
+                TaskGroup group;
+                group.run([&]() { left = recursive_build(bounds, std::move(left_refs), depth + 1); });
+                right = recursive_build(bounds, std::move(right_refs), depth + 1);
+                group.wait();
+            } else {
+                left = recursive_build(bounds, std::move(left_refs), depth + 1);
+                right = recursive_build(bounds, std::move(right_refs), depth + 1);
+            }
+            std::lock_guard<std::mutex> _(m);
+            build_nodes[ret].left = left;
+            build_nodes[ret].right = right;
+            return ret;
+        }
+
+        // surface area orientation heuristic over 12 buckets on the widest centroid axis; falls back to a
+        // median split when the heuristic fails or the tree gets too deep for the 64-bit light paths
+        size_t split(const std::vector<LightBounds<C>> &bounds, std::vector<int> &refs, const LightBounds<C> &lb,
+                     const Bounds3f &centroid_bounds, int depth) {
+            auto extents = centroid_bounds.extents();
+            int axis = 0;
+            if (extents[1] > extents[axis])
+                axis = 1;
+            if (extents[2] > extents[axis])
+                axis = 2;
+            auto median_split = [&]() {
+                size_t mid = refs.size() / 2;
+                std::nth_element(refs.begin(), refs.begin() + mid, refs.end(), [&](int a, int b) {
+                    return bounds[a].bounds.centroid()[axis] < bounds[b].bounds.centroid()[axis];
+                });
+                return mid;
+            };
+            if (depth >= MaxDepth - 24 || !(extents[axis] > 0.0f)) {
+                return median_split();
+            }
+            constexpr int nBuckets = 12;
+            auto bucket_of = [&](int i) {
+                auto b = int(nBuckets * (bounds[i].bounds.centroid()[axis] - centroid_bounds.pmin[axis]) /
+                             extents[axis]);
+                return std::clamp(b, 0, nBuckets - 1);
+            };
+            LightBounds<C> buckets[nBuckets];
+            for (auto i : refs) {
+                auto b = bucket_of(i);
+                buckets[b] = LightBounds<C>::merge(buckets[b], bounds[i]);
+            }
+            auto orientation_measure = [](const LightBounds<C> &b) {
+                Float theta_o = std::acos(std::clamp<Float>(b.cos_theta_o, -1, 1));
+                Float theta_e = std::acos(std::clamp<Float>(b.cos_theta_e, -1, 1));
+                Float theta_w = std::min(theta_o + theta_e, Constants<Float>::Pi());
+                Float sin_theta_o = std::sin(theta_o);
+                return 2 * Constants<Float>::Pi() * (1 - std::cos(theta_o)) +
+                       Constants<Float>::Pi() / 2 *
+                           (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w) -
+                            2 * theta_o * sin_theta_o + std::cos(theta_o));
+            };
+            auto cost_of = [&](const LightBounds<C> &b) {
+                if (b.power == 0.0f)
+                    return Float(0.0f);
+                return b.power * b.bounds.surface_area() * orientation_measure(b);
+            };
+            Float best_cost = std::numeric_limits<Float>::infinity();
+            int best_split = -1;
+            for (int s = 0; s < nBuckets - 1; s++) {
+                LightBounds<C> b0, b1;
+                for (int i = 0; i <= s; i++)
+                    b0 = LightBounds<C>::merge(b0, buckets[i]);
+                for (int i = s + 1; i < nBuckets; i++)
+                    b1 = LightBounds<C>::merge(b1, buckets[i]);
+                if (b0.power == 0.0f || b1.power == 0.0f)
+                    continue;
+                Float cost = cost_of(b0) + cost_of(b1);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_split = s;
+                }
+            }
+            if (best_split < 0) {
+                return median_split();
+            }
+            auto mid = std::partition(refs.begin(), refs.end(), [&](int i) { return bucket_of(i) <= best_split; });
+            size_t partition = mid - refs.begin();
+            if (partition == 0 || partition == refs.size()) {
+                return median_split();
+            }
+            return partition;
+        }
+        void assign_paths(int idx, uint64_t path, int depth, std::vector<uint64_t> &paths) {
+            auto &node = build_nodes[idx];
+            if (node.is_leaf()) {
+                paths[node.light] = path;
+                return;
+            }
+            assign_paths(node.left, path, depth + 1, paths);
+            assign_paths(node.right, path | (uint64_t(1) << depth), depth + 1, paths);
+        }
+    };
+} // namespace akari
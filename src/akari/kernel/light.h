@@ -20,6 +20,7 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 #pragma once
+#include <akari/common/distribution.h>
 #include <akari/kernel/texture.h>
 #include <akari/kernel/sampling.h>
 namespace akari {
@@ -36,6 +37,15 @@ namespace akari {
         float2 u;
         Float3 p;
     };
+    // a particle leaving a light
+    AKR_VARIANT struct LightRaySample {
+        AKR_IMPORT_TYPES()
+        Ray3f ray;
+        Float3 ng;
+        Spectrum L;
+        // area pdf of ray.o and solid angle pdf of ray.d
+        Float pdf_pos = 0.0f, pdf_dir = 0.0f;
+    };
     AKR_VARIANT
     struct DirectLighting {
         AKR_IMPORT_TYPES()
@@ -55,6 +65,20 @@ namespace akari {
             color = triangle.material->template get<EmissiveMaterial<C>>()->color;
             double_sided = triangle.material->template get<EmissiveMaterial<C>>()->double_sided;
         }
+        // cosine between the emitting side and the direction from the lit point towards the light
+        AKR_XPU Float emit_cos(const Float3 &wi) const {
+            auto c = -dot(wi, triangle.ng());
+            return double_sided ? std::abs(c) : max(Float(0.0), c);
+        }
+        // solid angle pdf at ref of sample() choosing point p on the light
+        AKR_XPU Float pdf(const Float3 &ref, const Float3 &p) const {
+            auto wi = p - ref;
+            auto dist_sqr = dot(wi, wi);
+            auto cos_theta = emit_cos(wi / sqrt(dist_sqr));
+            if (cos_theta <= 0.0f)
+                return 0.0f;
+            return dist_sqr / cos_theta / triangle.area();
+        }
         AKR_XPU LightSample<C> sample(const LightSampleContext<C> &ctx) const {
             auto coords = sampling<C>::uniform_sample_triangle(ctx.u);
             auto p = triangle.p(coords);
@@ -64,12 +88,109 @@ namespace akari {
             auto dist_sqr = dot(sample.wi, sample.wi);
             sample.wi /= sqrt(dist_sqr);
             sample.L = color->evaluate(triangle.texcoord(coords));
-            sample.pdf = dist_sqr / max(Float(0.0), -dot(sample.wi, sample.ng)) / triangle.area();
+            auto cos_theta = emit_cos(sample.wi);
+            sample.pdf = cos_theta > 0.0f ? dist_sqr / cos_theta / triangle.area() : Float(0.0f);
             sample.shadow_ray = Ray3f(p, -sample.wi, Constants<Float>::Eps() / std::abs(dot(sample.wi, sample.ng)),
                                       sqrt(dist_sqr) * (Float(1.0f) - Constants<Float>::ShadowEps()));
             return sample;
         }
+        // cosine-distributed emission from a uniformly chosen point; u_side picks the face of two-sided lights
+        AKR_XPU LightRaySample<C> sample_emission(const float2 &u_pos, const float2 &u_dir, Float u_side) const {
+            LightRaySample<C> sample;
+            auto coords = sampling<C>::uniform_sample_triangle(u_pos);
+            auto p = triangle.p(coords);
+            sample.ng = triangle.ng();
+            sample.L = color->evaluate(triangle.texcoord(coords));
+            sample.pdf_pos = Float(1.0f) / triangle.area();
+            auto w = sampling<C>::cosine_hemisphere_sampling(u_dir);
+            sample.pdf_dir = sampling<C>::cosine_hemisphere_pdf(w.y);
+            auto n = sample.ng;
+            if (double_sided) {
+                if (u_side < 0.5f)
+                    n = -n;
+                sample.pdf_dir *= 0.5f;
+            }
+            w = Frame3f(n).local_to_world(w);
+            sample.ray = Ray3f(p, w, Constants<Float>::Eps() / std::abs(dot(w, sample.ng)));
+            return sample;
+        }
+    };
+    // Infinitely distant light given by an equirectangular map, +y is up
+    AKR_VARIANT class EnvironmentLight {
+      public:
+        AKR_IMPORT_TYPES()
+        PackedImageView image;
+        Float scale = 1.0f;
+        // over the map's (u, v), proportional to luminance * sin(theta)
+        const Distribution2D<C> *distribution = nullptr;
+        EnvironmentLight() = default;
+        EnvironmentLight(PackedImageView image, const Distribution2D<C> *distribution, Float scale)
+            : image(image), scale(scale), distribution(distribution) {}
+        AKR_XPU static float2 direction_to_uv(const Float3 &w) {
+            Float theta = std::acos(std::clamp<Float>(w.y, -1.0f, 1.0f));
+            Float phi = std::atan2(w.z, w.x);
+            if (phi < 0.0f)
+                phi += 2.0f * Constants<Float>::Pi();
+            return float2(phi / (2.0f * Constants<Float>::Pi()), theta * Constants<Float>::InvPi());
+        }
+        AKR_XPU static Float3 uv_to_direction(const float2 &uv) {
+            Float theta = uv[1] * Constants<Float>::Pi();
+            Float phi = uv[0] * 2.0f * Constants<Float>::Pi();
+            Float sin_theta = std::sin(theta);
+            return Float3(sin_theta * std::cos(phi), std::cos(theta), sin_theta * std::sin(phi));
+        }
+        // radiance arriving along -w
+        AKR_XPU Spectrum Le(const Float3 &w) const { return Spectrum(image(direction_to_uv(w)).rgb) * scale; }
+        // solid angle pdf of sample() choosing w
+        AKR_XPU Float pdf(const Float3 &w) const {
+            auto uv = direction_to_uv(w);
+            Float sin_theta = std::sin(uv[1] * Constants<Float>::Pi());
+            if (sin_theta <= 0.0f)
+                return 0.0f;
+            return distribution->pdf_continuous(uv) /
+                   (2.0f * Constants<Float>::Pi() * Constants<Float>::Pi() * sin_theta);
+        }
+        AKR_XPU LightSample<C> sample(const LightSampleContext<C> &ctx) const {
+            LightSample<C> sample;
+            Float map_pdf;
+            auto uv = distribution->sample_continuous(ctx.u, &map_pdf);
+            Float sin_theta = std::sin(uv[1] * Constants<Float>::Pi());
+            sample.wi = uv_to_direction(uv);
+            sample.ng = -sample.wi;
+            sample.L = Le(sample.wi);
+            sample.pdf = sin_theta > 0.0f
+                             ? map_pdf / (2.0f * Constants<Float>::Pi() * Constants<Float>::Pi() * sin_theta)
+                             : Float(0.0f);
+            sample.shadow_ray = Ray3f(ctx.p, sample.wi);
+            return sample;
+        }
+        // per-texel sampling weights for building distribution
+        static std::vector<Float> sampling_weights(const PackedImageView &image) {
+            auto res = image.resolution();
+            std::vector<Float> weights(res.x * res.y);
+            parallel_for(
+                res.y,
+                [&](uint32_t y, uint32_t) {
+                    Float sin_theta = std::sin((y + 0.5f) / res.y * Constants<Float>::Pi());
+                    for (int x = 0; x < res.x; x++) {
+                        weights[x + y * res.x] = luminance(Spectrum(image(x, (int)y).rgb)) * sin_theta;
+                    }
+                },
+                64);
+            return weights;
+        }
+    };
+    // Reference to either kind of light; null if no light was selected
+    AKR_VARIANT class Light : public Variant<const AreaLight<C> *, const EnvironmentLight<C> *> {
+      public:
+        AKR_IMPORT_TYPES()
+        using Base = Variant<const AreaLight<C> *, const EnvironmentLight<C> *>;
+        Light() = default;
+        AKR_XPU Light(const AreaLight<C> *light) : Base(light) {}
+        AKR_XPU Light(const EnvironmentLight<C> *light) : Base(light) {}
+        AKR_XPU explicit operator bool() const { return !this->null(); }
+        AKR_XPU LightSample<C> sample(const LightSampleContext<C> &ctx) const {
+            return this->dispatch([&](auto &&light) { return light->sample(ctx); });
+        }
     };
-    template <class C>
-    using Light = AreaLight<C>;
 } // namespace akari
\ No newline at end of file
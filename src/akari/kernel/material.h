@@ -193,10 +193,15 @@ namespace akari {
         AKR_IMPORT_TYPES()
         float2 u1, u2;
         float2 texcoords;
+        // texcoord footprint of a pixel, for filtered texture lookups
+        float2 dtcdx = float2(0), dtcdy = float2(0);
         Float3 ng, ns;
         MaterialEvalContext() = default;
         AKR_XPU MaterialEvalContext(Sampler<C> sampler, const SurfaceInteraction<C> &si)
-            : MaterialEvalContext(sampler, si.texcoords, si.ng, si.ns) {}
+            : MaterialEvalContext(sampler, si.texcoords, si.ng, si.ns) {
+            dtcdx = si.dtcdx;
+            dtcdy = si.dtcdy;
+        }
         AKR_XPU MaterialEvalContext(Sampler<C> sampler, const float2 &texcoords, const Float3 &ng,
                                     const Float3 &ns)
             : u1(sampler.next2d()), u2(sampler.next2d()), texcoords(texcoords), ng(ng), ns(ns) {}
@@ -208,7 +213,7 @@ namespace akari {
         AKR_IMPORT_TYPES()
         Texture<C> *color;
         AKR_XPU BSDF<C> get_bsdf(MaterialEvalContext<C> &ctx) const {
-            auto R = color->evaluate(ctx.texcoords);
+            auto R = color->evaluate(ctx.texcoords, ctx.dtcdx, ctx.dtcdy);
             BSDF<C> bsdf(ctx.ng, ctx.ns);
             bsdf.set_closure((DiffuseBSDF<C>(R)));
             return bsdf;
@@ -221,8 +226,8 @@ namespace akari {
         const Texture<C> *roughness = nullptr;
         GlossyMaterial(Texture<C> *color, const Texture<C> *roughness) : color(color), roughness(roughness) {}
         AKR_XPU BSDF<C> get_bsdf(MaterialEvalContext<C> &ctx) const {
-            auto R = color->evaluate(ctx.texcoords);
-            auto roughness_ = roughness->evaluate(ctx.texcoords).x;
+            auto R = color->evaluate(ctx.texcoords, ctx.dtcdx, ctx.dtcdy);
+            auto roughness_ = roughness->evaluate(ctx.texcoords, ctx.dtcdx, ctx.dtcdy).x;
             roughness_ *= roughness_;
             BSDF<C> bsdf(ctx.ng, ctx.ns);
             bsdf.set_closure(MicrofacetReflection<C>(R, roughness_));
@@ -237,14 +242,75 @@ namespace akari {
         AKR_XPU EmissiveMaterial(const Texture<C> *color, bool double_sided = false)
             : color(color), double_sided(double_sided) {}
     };
-    AKR_VARIANT class MixMaterial;
+    // A tree of MixMaterials compiled into its leaves. Walking the tree picks a leaf with the product of the
+    // fractions (or one minus them) along its path; the table keeps that product for the constant fractions and
+    // indices of the textured ones, so selection evaluates each textured fraction once and loops over the leaves.
+    AKR_VARIANT struct MixTable {
+        AKR_IMPORT_TYPES()
+        static constexpr int MaxLeaves = 8;
+        // a binary tree with MaxLeaves leaves has one less inner node, which bounds both fractions and path length
+        static constexpr int MaxFractions = MaxLeaves - 1;
+        static constexpr uint8_t FirstBranch = 0x80;
+        static constexpr Float OneMinusEpsilon = Float(1.0f) - std::numeric_limits<Float>::epsilon();
+        struct Leaf {
+            const Material<C> *material = nullptr;
+            Float weight = 1.0f;
+            uint8_t n_terms = 0;
+            // textured fractions on the path: index into fractions, or'ed with FirstBranch for a (1 - fraction) factor
+            uint8_t terms[MaxFractions] = {};
+        };
+        const Texture<C> *fractions[MaxFractions] = {};
+        int n_fractions = 0;
+        Leaf leaves[MaxLeaves];
+        int n_leaves = 0;
+
+        // fraction picks second; children that are MixMaterials are inlined while the leaves fit
+        MixTable(const Texture<C> *fraction, const Material<C> *first, const Material<C> *second);
+
+        // picks a leaf for u and rescales u for reuse; also returns the inverse of the leaf's probability
+        AKR_XPU astd::pair<const Material<C> *, Float> select(Float &u, const float2 &texcoords, const float2 &dtcdx,
+                                                             const float2 &dtcdy) const {
+            Float f[MaxFractions];
+            for (int i = 0; i < n_fractions; i++) {
+                f[i] = fractions[i]->evaluate(texcoords, dtcdx, dtcdy)[0];
+            }
+            Float w[MaxLeaves];
+            Float total = 0.0f;
+            for (int i = 0; i < n_leaves; i++) {
+                auto &leaf = leaves[i];
+                Float p = leaf.weight;
+                for (int t = 0; t < leaf.n_terms; t++) {
+                    auto term = leaf.terms[t];
+                    Float fi = f[term & ~FirstBranch];
+                    p *= (term & FirstBranch) ? Float(1.0f) - fi : fi;
+                }
+                w[i] = p;
+                total += p;
+            }
+            Float target = u * total, cdf = 0.0f;
+            int chosen = -1;
+            for (int i = 0; i < n_leaves; i++) {
+                if (w[i] > 0.0f) {
+                    chosen = i;
+                    if (target < cdf + w[i]) {
+                        break;
+                    }
+                }
+                cdf += w[i];
+            }
+            if (chosen < 0) {
+                return {nullptr, 0.0f};
+            }
+            cdf = std::min(cdf, total - w[chosen]);
+            u = std::clamp((target - cdf) / w[chosen], Float(0.0f), OneMinusEpsilon);
+            return {leaves[chosen].material, total / w[chosen]};
+        }
+    };
     AKR_VARIANT class MixMaterial {
       public:
         AKR_IMPORT_TYPES()
-        const Texture<C> *fraction;
-        const Material<C> *material_A, *material_B;
-        MixMaterial(const Texture<C> *fraction, const Material<C> *material_A, const Material<C> *material_B)
-            : fraction(fraction), material_A(material_A), material_B(material_B) {}
+        const MixTable<C> *table;
+        AKR_XPU explicit MixMaterial(const MixTable<C> *table) : table(table) {}
     };
     AKR_VARIANT class Material
         : public Variant<DiffuseMaterial<C>, GlossyMaterial<C>, EmissiveMaterial<C>, MixMaterial<C>> {
@@ -252,20 +318,16 @@ namespace akari {
         AKR_IMPORT_TYPES()
         using Variant<DiffuseMaterial<C>, GlossyMaterial<C>, EmissiveMaterial<C>, MixMaterial<C>>::Variant;
 
-        AKR_XPU astd::pair<const Material<C> *, Float> select_material(Float &u, const float2 &texcoords) const {
+        AKR_XPU astd::pair<const Material<C> *, Float> select_material(Float &u, const float2 &texcoords,
+                                                                       const float2 &dtcdx = float2(0),
+                                                                       const float2 &dtcdy = float2(0)) const {
             Float choice_pdf = 1.0f;
             auto ptr = this;
-            while (ptr->template isa<MixMaterial<C>>()) {
-                auto frac = ptr->template get<MixMaterial<C>>()->fraction->evaluate(texcoords).x;
-                if (u < frac) {
-                    u = u / frac;
-                    ptr = ptr->template get<MixMaterial<C>>()->material_B;
-                    choice_pdf *= 1.0f / frac;
-                } else {
-                    u = (u - frac) / (1.0f - frac);
-                    ptr = ptr->template get<MixMaterial<C>>()->material_A;
-                    choice_pdf *= 1.0f / (1.0f - frac);
-                }
+            // one step unless a tree had more leaves than a table holds
+            while (ptr && ptr->template isa<MixMaterial<C>>()) {
+                auto [leaf, inv_prob] = ptr->template get<MixMaterial<C>>()->table->select(u, texcoords, dtcdx, dtcdy);
+                ptr = leaf;
+                choice_pdf *= inv_prob;
             }
             return {ptr, choice_pdf};
         }
@@ -290,11 +352,56 @@ namespace akari {
             return bsdf;
         }
         AKR_XPU BSDF<C> get_bsdf(MaterialEvalContext<C> &ctx) const {
-            auto [mat, choice_pdf] = select_material(ctx.u1[0], ctx.texcoords);
+            auto [mat, choice_pdf] = select_material(ctx.u1[0], ctx.texcoords, ctx.dtcdx, ctx.dtcdy);
             auto bsdf = mat->get_bsdf0(ctx);
             bsdf.set_choice_pdf(choice_pdf);
             return bsdf;
         }
     };
 
+    AKR_VARIANT MixTable<C>::MixTable(const Texture<C> *fraction, const Material<C> *first, const Material<C> *second) {
+        int term = -1;
+        Float f = 0.0f;
+        if (fraction->template isa<ConstantTexture<C>>()) {
+            f = fraction->template get<ConstantTexture<C>>()->value[0];
+        } else {
+            term = n_fractions++;
+            fractions[term] = fraction;
+        }
+        auto add = [&](const Material<C> *m, bool is_first, int max_leaves) {
+            Float weight = term >= 0 ? Float(1.0f) : is_first ? Float(1.0f) - f : f;
+            auto own = uint8_t(term | (is_first ? FirstBranch : 0));
+            const MixTable<C> *child =
+                m && m->template isa<MixMaterial<C>>() ? m->template get<MixMaterial<C>>()->table : nullptr;
+            if (child && n_leaves + child->n_leaves <= max_leaves) {
+                int base = n_fractions;
+                for (int i = 0; i < child->n_fractions; i++) {
+                    fractions[n_fractions++] = child->fractions[i];
+                }
+                for (int i = 0; i < child->n_leaves; i++) {
+                    Leaf leaf = child->leaves[i];
+                    leaf.weight *= weight;
+                    for (int t = 0; t < leaf.n_terms; t++) {
+                        auto index = (leaf.terms[t] & ~FirstBranch) + base;
+                        leaf.terms[t] = uint8_t((leaf.terms[t] & FirstBranch) | index);
+                    }
+                    if (term >= 0) {
+                        leaf.terms[leaf.n_terms++] = own;
+                    }
+                    leaves[n_leaves++] = leaf;
+                }
+            } else {
+                Leaf leaf;
+                leaf.material = m;
+                leaf.weight = weight;
+                if (term >= 0) {
+                    leaf.terms[leaf.n_terms++] = own;
+                }
+                leaves[n_leaves++] = leaf;
+            }
+        };
+        // leave room for at least one leaf of second
+        add(first, true, MaxLeaves - 1);
+        add(second, false, MaxLeaves);
+    }
 } // namespace akari
\ No newline at end of file
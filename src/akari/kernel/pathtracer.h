@@ -28,6 +28,7 @@
 #include <akari/kernel/material.h>
 #include <akari/kernel/light.h>
 #include <akari/kernel/scene.h>
+#include <akari/kernel/reservoir.h>
 namespace akari {
     AKR_VARIANT
     struct SurfaceHit {
@@ -57,31 +58,57 @@ namespace akari {
         Spectrum beta = Spectrum(1.0f);
         int depth = 0;
         int max_depth = 5;
+        // previous scattering vertex, for weighting emitters hit by BSDF sampling
+        Float3 prev_p, prev_n;
+        Float prev_bsdf_pdf = 0.0f;
+        // light samples resampled per direct lighting estimate; 0 takes a single light sample under MIS instead
+        int ris_candidates = 0;
+        // pixel footprint of the camera ray, consumed by the first surface hit
+        RayDifferential<C> differential;
 
         AKR_XPU CameraSample<C> camera_ray(const Camera<C> &camera, const int2 &p) {
             CameraSample<C> sample = camera.generate_ray(sampler.next2d(), sampler.next2d(), p);
+            differential = sample.differential;
             return sample;
         }
-        AKR_XPU astd::pair<const Light<C> *, Float> select_light(const Scene<C> &scene) {
-            return scene.select_light(sampler.next2d());
+        // texture filtering only follows the camera ray; hits after a bounce keep zero derivatives and
+        // use the finest MIP level
+        AKR_XPU void apply_ray_differential(SurfaceInteraction<C> &si) {
+            if (differential.valid) {
+                si.compute_differentials(differential);
+                differential.valid = false;
+            }
+        }
+        AKR_XPU astd::pair<Light<C>, Float> select_light(const Scene<C> &scene, const SurfaceInteraction<C> &si) {
+            return scene.select_light(sampler.next2d(), si.p, si.ns);
         }
 
         AKR_XPU astd::optional<DirectLighting<C>>
         compute_direct_lighting(SurfaceInteraction<C> &si, const SurfaceHit<C> &surface_hit,
-                                const astd::pair<const Light<C> *, Float> &selected) {
+                                const astd::pair<Light<C>, Float> &selected) {
+            return compute_direct_lighting(si, surface_hit, selected, [&] AKR_XPU(const Float3 &wi) {
+                return si.bsdf.evaluate_pdf(surface_hit.wo, wi);
+            });
+        }
+        // @param scattering_pdf: pdf of the direction sampler that competes with light sampling under MIS
+        template <class ScatteringPdf>
+        AKR_XPU astd::optional<DirectLighting<C>>
+        compute_direct_lighting(SurfaceInteraction<C> &si, const SurfaceHit<C> &surface_hit,
+                                const astd::pair<Light<C>, Float> &selected, ScatteringPdf &&scattering_pdf) {
             auto [light, light_pdf] = selected;
             if (light) {
                 DirectLighting<C> lighting;
                 LightSampleContext<C> light_ctx;
                 light_ctx.u = sampler.next2d();
                 light_ctx.p = si.p;
-                LightSample<C> light_sample = light->sample(light_ctx);
+                LightSample<C> light_sample = light.sample(light_ctx);
                 if(light_sample.pdf <= 0.0)
                     return astd::nullopt;
                 light_pdf *= light_sample.pdf;
                 auto f = light_sample.L * si.bsdf.evaluate(surface_hit.wo, light_sample.wi) *
                          std::abs(dot(si.ns, light_sample.wi));
-                lighting.color = beta * f / light_pdf;
+                auto weight = sampling<C>::power_heuristic(light_pdf, scattering_pdf(light_sample.wi));
+                lighting.color = beta * f / light_pdf * weight;
                 lighting.shadow_ray = light_sample.shadow_ray;
                 lighting.pdf = light_pdf;
                 return lighting;
@@ -90,25 +117,115 @@ namespace akari {
             }
         }
 
-        AKR_XPU void on_miss(const Scene<C> &scene, const Ray3f &ray) {}
+        // unshadowed contribution of a light sample, the target function of resampled direct lighting
+        AKR_XPU Spectrum unshadowed_contribution(const SurfaceInteraction<C> &si, const SurfaceHit<C> &surface_hit,
+                                                 const LightSample<C> &light_sample) const {
+            return light_sample.L * si.bsdf.evaluate(surface_hit.wo, light_sample.wi) *
+                   std::abs(dot(si.ns, light_sample.wi));
+        }
+        // Resamples ris_candidates light samples down to one, in proportion to their unshadowed contribution
+        AKR_XPU Reservoir<C> sample_reservoir(const Scene<C> &scene, const SurfaceInteraction<C> &si,
+                                              const SurfaceHit<C> &surface_hit) {
+            Reservoir<C> reservoir;
+            for (int i = 0; i < ris_candidates; i++) {
+                auto [light, light_pdf] = select_light(scene, si);
+                if (!light) {
+                    reservoir.M += 1.0f;
+                    continue;
+                }
+                LightSampleContext<C> light_ctx;
+                light_ctx.u = sampler.next2d();
+                light_ctx.p = si.p;
+                LightSample<C> light_sample = light.sample(light_ctx);
+                Float pdf = light_pdf * light_sample.pdf;
+                Float p_hat = pdf > 0.0f ? luminance(unshadowed_contribution(si, surface_hit, light_sample)) : 0.0f;
+                reservoir.update(LightCandidate<C>(light, light_sample), pdf > 0.0f ? p_hat / pdf : Float(0.0f),
+                                 p_hat, sampler.next1d());
+            }
+            reservoir.finalize();
+            return reservoir;
+        }
+        // shades the sample a reservoir kept; the caller still traces the shadow ray
+        AKR_XPU astd::optional<DirectLighting<C>> resampled_direct_lighting(const SurfaceInteraction<C> &si,
+                                                                           const SurfaceHit<C> &surface_hit,
+                                                                           const Reservoir<C> &reservoir) const {
+            if (reservoir.W <= 0.0f) {
+                return astd::nullopt;
+            }
+            auto light_sample = reservoir.y.connect(si.p);
+            DirectLighting<C> lighting;
+            lighting.color = beta * unshadowed_contribution(si, surface_hit, light_sample) * reservoir.W;
+            lighting.shadow_ray = light_sample.shadow_ray;
+            lighting.pdf = Float(1.0f) / reservoir.W;
+            return lighting;
+        }
+        AKR_XPU astd::optional<DirectLighting<C>> direct_lighting(const Scene<C> &scene, SurfaceInteraction<C> &si,
+                                                                 const SurfaceHit<C> &surface_hit) {
+            if (ris_candidates > 0) {
+                return resampled_direct_lighting(si, surface_hit, sample_reservoir(scene, si, surface_hit));
+            }
+            return compute_direct_lighting(si, surface_hit, select_light(scene, si));
+        }
+
+        AKR_XPU void on_miss(const Scene<C> &scene, const Ray3f &ray) {
+            L += beta * environment_radiance(scene, ray, prev_bsdf_pdf);
+        }
+
+        // Environment radiance along an escaped ray, weighted against light sampling past the camera vertex
+        // @param scattering_pdf: solid angle pdf with which the previous vertex sampled ray.d
+        AKR_XPU Spectrum environment_radiance(const Scene<C> &scene, const Ray3f &ray, Float scattering_pdf) const {
+            auto *light = scene.environment_light;
+            if (!light) {
+                return Spectrum(0.0f);
+            }
+            auto w = normalize(ray.d);
+            auto Le = light->Le(w);
+            if (depth == 0) {
+                return Le;
+            }
+            if (ris_candidates > 0) {
+                // resampled direct lighting is not MIS weighted and accounts for all of it
+                return Spectrum(0.0f);
+            }
+            Float light_pdf = scene.environment_light_pdf() * light->pdf(w);
+            return Le * sampling<C>::power_heuristic(scattering_pdf, light_pdf);
+        }
+
+        // Emission seen from the previous vertex; past the camera vertex it is weighted against light sampling
+        // @param scattering_pdf: solid angle pdf with which the previous vertex sampled this direction
+        AKR_XPU Spectrum emitted_radiance(const Scene<C> &scene, const SurfaceInteraction<C> &si,
+                                          const SurfaceHit<C> &surface_hit, Float scattering_pdf) const {
+            auto *emission = surface_hit.material->template get<EmissiveMaterial<C>>();
+            bool face_front = dot(-surface_hit.wo, si.ng) < 0.0f;
+            if (!emission->double_sided && !face_front) {
+                return Spectrum(0.0f);
+            }
+            auto Le = emission->color->evaluate(si.texcoords);
+            if (depth == 0) {
+                return Le;
+            }
+            if (ris_candidates > 0) {
+                return Spectrum(0.0f);
+            }
+            auto *light = scene.get_area_light(surface_hit.geom_id, surface_hit.prim_id);
+            if (!light) {
+                return Spectrum(0.0f);
+            }
+            Float light_pdf = scene.light_pdf(prev_p, prev_n, light) * light->pdf(prev_p, si.p);
+            return Le * sampling<C>::power_heuristic(scattering_pdf, light_pdf);
+        }
 
         // @param mat_pdf: supplied if material is already chosen
-        AKR_XPU astd::optional<ScatteringEvent<C>> on_surface_scatter(SurfaceInteraction<C> &si,
+        AKR_XPU astd::optional<ScatteringEvent<C>> on_surface_scatter(const Scene<C> &scene, SurfaceInteraction<C> &si,
                                                                       const SurfaceHit<C> &surface_hit,
                                                                       astd::optional<Float> mat_pdf = astd::nullopt) {
             auto *material = surface_hit.material;
             auto wo = surface_hit.wo;
+            apply_ray_differential(si);
             MaterialEvalContext<C> ctx(sampler, si);
             if (material->template isa<EmissiveMaterial<C>>()) {
-
-                if (depth == 0) {
-                    auto *emission = material->template get<EmissiveMaterial<C>>();
-                    bool face_front = dot(-wo, si.ng) < 0.0f;
-                    if (emission->double_sided || face_front) {
-                        L += beta * emission->color->evaluate(ctx.texcoords);
-                        return astd::nullopt;
-                    }
-                }
+                L += beta * emitted_radiance(scene, si, surface_hit, prev_bsdf_pdf);
+                return astd::nullopt;
             } else if (depth < max_depth) {
                 ScatteringEvent<C> event;
                 if (mat_pdf) {
@@ -126,13 +243,19 @@ namespace akari {
                 event.ray = Ray3f(si.p, sample.wi, Constants<Float>::Eps() / std::abs(dot(si.ng, sample.wi)));
                 event.beta = sample.f * std::abs(dot(si.ng, sample.wi)) / sample.pdf;
                 event.pdf = sample.pdf;
+                prev_p = si.p;
+                prev_n = si.ns;
+                prev_bsdf_pdf = sample.pdf;
                 return event;
             }
             return astd::nullopt;
         }
         AKR_XPU void run_megakernel(const Scene<C> &scene, const Camera<C> &camera, const int2 &p) {
             auto camera_sample = camera_ray(camera, p);
-            Ray3f ray = camera_sample.ray;
+            trace(scene, camera_sample.ray);
+        }
+        // follows ray from the current vertex until the path ends
+        AKR_XPU void trace(const Scene<C> &scene, Ray3f ray) {
             while (true) {
                 auto hit = scene.intersect(ray);
                 if (!hit) {
@@ -144,12 +267,11 @@ namespace akari {
                 surface_hit.material = trig.material;
                 SurfaceInteraction<C> si(surface_hit.uv, trig);
 
-                auto has_event = on_surface_scatter(si, surface_hit);
+                auto has_event = on_surface_scatter(scene, si, surface_hit);
                 if (!has_event) {
                     break;
                 }
-                astd::optional<DirectLighting<C>> has_direct =
-                    compute_direct_lighting(si, surface_hit, select_light(scene));
+                astd::optional<DirectLighting<C>> has_direct = direct_lighting(scene, si, surface_hit);
                 if (has_direct) {
                     auto &direct = has_direct.value();
                     if (!direct.color.is_black() && !scene.occlude(direct.shadow_ray)) {
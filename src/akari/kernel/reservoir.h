@@ -0,0 +1,92 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <akari/kernel/light.h>
+namespace akari {
+    // A point on a light kept by a reservoir; reconnecting it to another shading point lets neighbouring pixels
+    // share their candidates
+    AKR_VARIANT struct LightCandidate {
+        AKR_IMPORT_TYPES()
+        Light<C> light;
+        // point on an area light, or the direction towards an environment light
+        Float3 p;
+        Spectrum Le;
+        LightCandidate() = default;
+        AKR_XPU LightCandidate(const Light<C> &light, const LightSample<C> &sample) : light(light), Le(sample.L) {
+            p = light.template isa<const AreaLight<C> *>() ? sample.shadow_ray.o : sample.wi;
+        }
+        // the candidate as seen from ref; pdf is left zero
+        AKR_XPU LightSample<C> connect(const Float3 &ref) const {
+            LightSample<C> sample;
+            if (auto area = light.template get<const AreaLight<C> *>()) {
+                sample.ng = (*area)->triangle.ng();
+                sample.wi = p - ref;
+                auto dist_sqr = dot(sample.wi, sample.wi);
+                sample.wi /= sqrt(dist_sqr);
+                sample.L = (*area)->emit_cos(sample.wi) > 0.0f ? Le : Spectrum(0.0f);
+                sample.shadow_ray =
+                    Ray3f(p, -sample.wi, Constants<Float>::Eps() / std::abs(dot(sample.wi, sample.ng)),
+                          sqrt(dist_sqr) * (Float(1.0f) - Constants<Float>::ShadowEps()));
+            } else {
+                sample.wi = p;
+                sample.ng = -p;
+                sample.L = Le;
+                sample.shadow_ray = Ray3f(ref, p);
+            }
+            return sample;
+        }
+    };
+
+    // Weighted reservoir for resampled importance sampling [Bitterli et al. 2020]
+    // Streams candidates with weight target / source pdf and keeps one with probability proportional to its weight.
+    AKR_VARIANT struct Reservoir {
+        AKR_IMPORT_TYPES()
+        LightCandidate<C> y;
+        Float w_sum = 0.0f;
+        // target function at y
+        Float p_hat = 0.0f;
+        // number of candidates seen
+        Float M = 0.0f;
+        // contribution weight of y, in place of 1 / pdf
+        Float W = 0.0f;
+        AKR_XPU bool update(const LightCandidate<C> &x, Float w, Float p_hat_x, Float u, Float count = 1.0f) {
+            w_sum += w;
+            M += count;
+            if (w > 0.0f && u * w_sum < w) {
+                y = x;
+                p_hat = p_hat_x;
+                return true;
+            }
+            return false;
+        }
+        AKR_XPU void finalize() { W = p_hat > 0.0f && M > 0.0f ? w_sum / (M * p_hat) : Float(0.0f); }
+        // streams in another reservoir, whose sample has target p_hat_here at this reservoir's shading point
+        // @param max_M: caps the other reservoir's history so stale samples cannot dominate
+        AKR_XPU void merge(const Reservoir &r, Float p_hat_here, Float u,
+                           Float max_M = std::numeric_limits<Float>::infinity()) {
+            Float count = std::min(r.M, max_M);
+            update(r.y, p_hat_here * r.W * count, p_hat_here, u, count);
+        }
+    };
+} // namespace akari
@@ -61,6 +61,10 @@ namespace akari {
             Float phi = 2 * Constants<Float>::Pi * u[1];
             return Float3(r * cos(phi), r * sin(phi), z);
         }
+        AKR_XPU static inline Float power_heuristic(Float pdf_f, Float pdf_g) {
+            auto f = pdf_f * pdf_f, g = pdf_g * pdf_g;
+            return f + g > 0.0f ? f / (f + g) : Float(0.0f);
+        }
         AKR_XPU static inline float2 uniform_sample_triangle(const float2 &u) {
             Float su0 = sqrt(u[0]);
             Float b0 = 1 - su0;
@@ -79,6 +79,24 @@ namespace akari {
             }
         });
     }
+    AKR_VARIANT void Scene<C>::update(const std::vector<uint32_t> &mesh_ids) {
+        accel.dispatch_cpu([&](auto &&arg) {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<T, EmbreeAccelerator<C> *>) {
+#ifndef AKR_GPU_CODE
+                if constexpr (akari_enable_embree) {
+                    return arg->update(*this, mesh_ids);
+                } else {
+                    astd::abort();
+                }
+#else
+                astd::abort();
+#endif
+            } else {
+                return arg->update(*this, mesh_ids);
+            }
+        });
+    }
 
     AKR_RENDER_CLASS(Scene)
 } // namespace akari
\ No newline at end of file
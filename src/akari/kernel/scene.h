@@ -28,6 +28,7 @@
 #include <akari/kernel/sampler.h>
 #include <akari/kernel/shape.h>
 #include <akari/kernel/light.h>
+#include <akari/kernel/light-bvh.h>
 #ifdef AKR_ENABLE_EMBREE
 #    include <akari/kernel/embree.inl>
 #endif
@@ -54,8 +55,11 @@ namespace akari {
         Camera<C> camera;
         Sampler<C> sampler;
         BufferView<AreaLight<C>> area_lights;
+        const EnvironmentLight<C> *environment_light = nullptr;
         Variant<EmbreeAccelerator<C> *, BVHAccelerator<C> *> accel;
         Distribution1D<C> *light_distribution;
+        // importance-based light selection; power-proportional selection is used when null
+        LightBVH<C> *light_bvh = nullptr;
         AKR_XPU bool intersect(const Ray3f &ray, Intersection<C> *isct) const;
         AKR_XPU astd::optional<Intersection<C>> intersect(const Ray3f &ray) const {
             Intersection<C> isct;
@@ -67,6 +71,18 @@ namespace akari {
         AKR_XPU bool occlude(const Ray3f &ray) const;
 
         void commit();
+        // rebuilds the acceleration structure of meshes whose vertices or indices changed since commit()
+        void update(const std::vector<uint32_t> &mesh_ids);
+        // bounds of all mesh vertices, computed on the host
+        Bounds3f bounds() const {
+            Bounds3f box;
+            for (auto &mesh : meshes) {
+                for (size_t i = 0; i + 2 < mesh.vertices.size(); i += 3) {
+                    box = box.expand(Float3(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]));
+                }
+            }
+            return box;
+        }
         AKR_XPU Triangle<C> get_triangle(int mesh_id, int prim_id) const {
             auto &mesh = meshes[mesh_id];
             Triangle<C> trig = akari::get_triangle<C>(mesh, prim_id);
@@ -76,17 +92,58 @@ namespace akari {
             }
             return trig;
         }
-        AKR_XPU astd::pair<const AreaLight<C> *, Float> select_light(const float2 &u) const {
-            if (area_lights.size() == 0) {
-                return {nullptr, Float(0.0f)};
+        AKR_XPU const AreaLight<C> *get_area_light(int mesh_id, int prim_id) const {
+            auto &mesh = meshes[mesh_id];
+            if (mesh.light_indices.size() == 0)
+                return nullptr;
+            auto idx = mesh.light_indices[prim_id];
+            return idx < 0 ? nullptr : &area_lights[idx];
+        }
+        // probability of select_light() choosing the environment light
+        AKR_XPU Float environment_light_pdf() const {
+            if (!environment_light)
+                return 0.0f;
+            if (light_bvh) {
+                // the light BVH only holds area lights, so both get an equal share
+                return area_lights.size() == 0 ? Float(1.0f) : Float(0.5f);
             }
+            return light_distribution->pdf_discrete(area_lights.size());
+        }
+        // probability of select_light() choosing light for a point p with normal n
+        AKR_XPU Float light_pdf(const Float3 &p, const Float3 &n, const AreaLight<C> *light) const {
+            int idx = int(light - area_lights.begin());
+            if (light_bvh) {
+                return (Float(1.0f) - environment_light_pdf()) * light_bvh->pdf(idx, p, n);
+            }
+            return light_distribution->pdf_discrete(idx);
+        }
+        AKR_XPU astd::pair<Light<C>, Float> select_light(const float2 &u, const Float3 &p, const Float3 &n) const {
             Float pdf;
+            if (light_bvh) {
+                Float u0 = u[0];
+                Float env_pdf = environment_light_pdf();
+                if (environment_light) {
+                    if (u0 < env_pdf) {
+                        return {Light<C>(environment_light), env_pdf};
+                    }
+                    u0 = std::min<Float>((u0 - env_pdf) / (Float(1.0f) - env_pdf),
+                                         Float(1.0f) - std::numeric_limits<Float>::epsilon());
+                }
+                int idx = light_bvh->sample(u0, p, n, &pdf);
+                if (idx < 0) {
+                    return {Light<C>(), Float(0.0f)};
+                }
+                return {Light<C>(&area_lights[idx]), pdf * (Float(1.0f) - env_pdf)};
+            }
+            if (light_distribution->count() == 0) {
+                return {Light<C>(), Float(0.0f)};
+            }
             size_t idx = light_distribution->sample_discrete(u[0], &pdf);
-            // size_t idx = area_lights.size() * u[0];
+            // the environment light, if any, is the last entry
             if (idx == area_lights.size()) {
-                idx -= 1;
+                return {Light<C>(environment_light), pdf};
             }
-            return {&area_lights[idx], pdf};
+            return {Light<C>(&area_lights[idx]), pdf};
         }
     };
 } // namespace akari
@@ -25,6 +25,7 @@
 #include <akari/common/variant.h>
 #include <akari/common/color.h>
 #include <akari/core/image.hpp>
+#include <akari/core/texture-cache.h>
 
 namespace akari {
     AKR_VARIANT class ConstantTexture {
@@ -33,26 +34,101 @@ namespace akari {
         ConstantTexture(Spectrum v) : value(v) {}
         Spectrum value;
         AKR_XPU Spectrum evaluate(const float2 &texcoords) const { return value; }
+        AKR_XPU Spectrum evaluate(const float2 &texcoords, const float2 &dtcdx, const float2 &dtcdy) const {
+            return value;
+        }
         Float integral() const { return luminance(value); }
     };
 
     AKR_VARIANT class ImageTexture {
       public:
         AKR_IMPORT_TYPES()
-        RGBAImage::View image;
+        static constexpr int MaxLevels = 16;
+        // levels[0] is the full resolution image, each following level halves it down to 1x1
+        PackedImageView levels[MaxLevels];
+        int n_levels = 0;
+        // when set, texels are paged in through the texture cache and levels only carry resolutions (CPU only)
+        const TiledImage *tiled = nullptr;
+        // integral() as computed once for the image; negative when it has to be computed here
+        Float mean_luminance = -1.0f;
         ImageTexture() = default;
-        AKR_XPU ImageTexture(RGBAImage::View image) : image(image) {}
+        AKR_XPU ImageTexture(PackedImageView image) : n_levels(1) { levels[0] = image; }
+        AKR_XPU ImageTexture(const PackedImageView *views, int count, const TiledImage *tiled = nullptr)
+            : n_levels(std::min(count, MaxLevels)), tiled(tiled) {
+            for (int i = 0; i < n_levels; i++) {
+                levels[i] = views[i];
+            }
+        }
+        AKR_XPU const PackedImageView &image() const { return levels[0]; }
+        AKR_XPU RGBA texel(int level, int x, int y) const {
+#ifndef AKR_GPU_CODE
+            if (tiled) {
+                return tiled->texel(level, x, y);
+            }
+#endif
+            return levels[level](x, y);
+        }
         AKR_XPU Spectrum evaluate(const float2 &texcoords) const {
             float2 tc = fmod(texcoords, Array2f(1.0f));
             tc.y = 1.0f - tc.y;
-            return image(tc).rgb;
+            int2 p = int2(tc * float2(image().resolution()));
+            return texel(0, p.x, p.y).rgb;
+        }
+        // trilinear lookup; the level is chosen so that one texel covers the larger of the two pixel footprints
+        AKR_XPU Spectrum evaluate(const float2 &texcoords, const float2 &dtcdx, const float2 &dtcdy) const {
+            auto res = image().resolution();
+            Float width = std::max(length(dtcdx), length(dtcdy)) * Float(std::max(res.x, res.y));
+            Float level = width > 1.0f ? std::min(std::log2(width), Float(n_levels - 1)) : Float(0.0f);
+            int lo = int(level);
+            Float t = level - Float(lo);
+            float2 tc = texcoords - floor(texcoords);
+            tc.y = 1.0f - tc.y;
+            Spectrum c = bilinear(lo, tc);
+            if (t > 0.0f && lo + 1 < n_levels) {
+                c = lerp(c, bilinear(lo + 1, tc), t);
+            }
+            return c;
         }
         Float integral() const {
+            if (mean_luminance >= 0.0f) {
+                return mean_luminance;
+            }
+            // the coarsest level has the same mean and spares paging in a whole tiled texture
+            int level = tiled ? n_levels - 1 : 0;
+            auto res = levels[level].resolution();
             Float I = 0;
-            for (size_t i = 0; i < image.resolution().x * image.resolution().y; i++) {
-                I += luminance(image.data()[i].rgb);
+            for (int y = 0; y < res.y; y++) {
+                for (int x = 0; x < res.x; x++) {
+                    I += luminance(texel(level, x, y).rgb);
+                }
+            }
+            return I / (res.x * res.y);
+        }
+
+      private:
+        // bilinear filter with repeat wrapping, texel centers at half integers
+        AKR_XPU Spectrum bilinear(int level, const float2 &tc) const {
+            auto res = levels[level].resolution();
+            Float x = tc.x * Float(res.x) - 0.5f, y = tc.y * Float(res.y) - 0.5f;
+            Float fx = std::floor(x), fy = std::floor(y);
+            Float dx = x - fx, dy = y - fy;
+            int x0 = int(fx), y0 = int(fy);
+            auto wrap = [&](int i, int j) { return int2((i % res.x + res.x) % res.x, (j % res.y + res.y) % res.y); };
+            int2 p[4] = {wrap(x0, y0), wrap(x0 + 1, y0), wrap(x0, y0 + 1), wrap(x0 + 1, y0 + 1)};
+            RGBA t[4];
+#ifndef AKR_GPU_CODE
+            if (tiled) {
+                // pins the footprint's tile once rather than once per texel
+                tiled->texels(level, p, 4, t);
+            } else
+#endif
+            {
+                for (int i = 0; i < 4; i++) {
+                    t[i] = levels[level](p[i]);
+                }
             }
-            return I / (image.resolution().x * image.resolution().y);
+            return lerp(lerp(Spectrum(t[0].rgb), Spectrum(t[1].rgb), dx),
+                        lerp(Spectrum(t[2].rgb), Spectrum(t[3].rgb), dx), dy);
         }
     };
     AKR_VARIANT class Texture : public Variant<ConstantTexture<C>, ImageTexture<C>> {
@@ -60,6 +136,10 @@ namespace akari {
         AKR_IMPORT_TYPES()
         using Variant<ConstantTexture<C>, ImageTexture<C>>::Variant;
         AKR_XPU Spectrum evaluate(const float2 &texcoords) const { AKR_VAR_DISPATCH(evaluate, texcoords); }
+        // filtered lookup over the footprint given by the texcoord derivatives
+        AKR_XPU Spectrum evaluate(const float2 &texcoords, const float2 &dtcdx, const float2 &dtcdy) const {
+            AKR_VAR_DISPATCH(evaluate, texcoords, dtcdx, dtcdy);
+        }
         Float integral() const {
             return dispatch_cpu([=](auto &&arg) { return arg.integral(); });
         }
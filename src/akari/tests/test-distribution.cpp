@@ -0,0 +1,96 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <random>
+#include <akari/common/color.h>
+#include <akari/common/distribution.h>
+#include <akari/core/parallel.h>
+#include "gtest/gtest.h"
+using namespace akari;
+
+using C = Config<float, Color<float, 3>>;
+AKR_IMPORT_TYPES()
+
+TEST(TestDistribution, AliasMatchesPdf) {
+    set_device_cpu();
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    // large enough to take the parallel construction path
+    const size_t n = 100000;
+    std::vector<float> f(n);
+    for (auto &v : f) {
+        v = dist(rng) < 0.1f ? 0.0f : dist(rng) * dist(rng);
+    }
+    Distribution1D<C> distribution(default_resource(), f.data(), n, parallel_loop);
+    const int n_samples = 4000000;
+    std::vector<int> counts(n, 0);
+    for (int i = 0; i < n_samples; i++) {
+        float pdf;
+        int idx = distribution.sample_discrete(dist(rng), &pdf);
+        ASSERT_GE(idx, 0);
+        ASSERT_LT(idx, (int)n);
+        ASSERT_GT(f[idx], 0.0f);
+        ASSERT_FLOAT_EQ(pdf, distribution.pdf_discrete(idx));
+        counts[idx]++;
+    }
+    // compare on coarse buckets so the expected counts are large
+    const size_t bucket = 1000;
+    for (size_t b = 0; b < n / bucket; b++) {
+        double expected = 0.0;
+        int count = 0;
+        for (size_t i = b * bucket; i < (b + 1) * bucket; i++) {
+            expected += distribution.pdf_discrete(i) * n_samples;
+            count += counts[i];
+        }
+        EXPECT_NEAR(count, expected, 5.0 * std::sqrt(expected));
+    }
+}
+
+TEST(TestDistribution, Distribution2DPdf) {
+    set_device_cpu();
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const size_t nu = 64, nv = 32;
+    std::vector<float> f(nu * nv);
+    for (auto &v : f) {
+        v = dist(rng);
+    }
+    for (bool use_alias : {false, true}) {
+        Distribution2D<C> distribution(default_resource(), f.data(), nu, nv, use_alias, parallel_loop);
+        double integral = 0.0;
+        for (size_t v = 0; v < nv; v++) {
+            for (size_t u = 0; u < nu; u++) {
+                integral += distribution.pdf_continuous(Float2((u + 0.5f) / nu, (v + 0.5f) / nv)) / (nu * nv);
+            }
+        }
+        EXPECT_NEAR(integral, 1.0, 1e-4);
+        for (int i = 0; i < 1000; i++) {
+            float pdf;
+            auto p = distribution.sample_continuous(Float2(dist(rng), dist(rng)), &pdf);
+            ASSERT_GE(p[0], 0.0f);
+            ASSERT_LE(p[0], 1.0f);
+            ASSERT_GE(p[1], 0.0f);
+            ASSERT_LE(p[1], 1.0f);
+            EXPECT_NEAR(pdf, distribution.pdf_continuous(p), 1e-3f * pdf);
+        }
+    }
+}
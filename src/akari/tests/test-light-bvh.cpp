@@ -0,0 +1,85 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <random>
+#include <akari/common/color.h>
+#include <akari/kernel/scene.h>
+#include "gtest/gtest.h"
+using namespace akari;
+
+using C = Config<float, Color<float, 3>>;
+AKR_IMPORT_TYPES()
+
+static std::vector<AreaLight<C>> random_lights(std::mt19937 &rng, size_t n, bool double_sided) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<AreaLight<C>> lights(n);
+    for (auto &light : lights) {
+        auto center = Float3(dist(rng), dist(rng), dist(rng)) * 10.0f;
+        for (int i = 0; i < 3; i++) {
+            light.triangle.vertices[i] = center + Float3(dist(rng), dist(rng), dist(rng)) * 0.2f;
+        }
+        light.double_sided = double_sided;
+    }
+    return lights;
+}
+
+TEST(TestLightBVH, PdfSumsToOne) {
+    set_device_cpu();
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    // two-sided lights seen from points without a surface normal can all reach every point
+    auto lights = random_lights(rng, 500, true);
+    std::vector<float> power(lights.size());
+    for (auto &p : power) {
+        p = dist(rng) + 1.5f;
+    }
+    LightBVH<C> bvh(default_resource(), lights.data(), power.data(), lights.size());
+    for (int trial = 0; trial < 16; trial++) {
+        auto p = Float3(dist(rng), dist(rng), dist(rng)) * 12.0f;
+        auto n = Float3(0.0f);
+        double sum = 0.0;
+        for (size_t i = 0; i < lights.size(); i++) {
+            sum += bvh.pdf((int)i, p, n);
+        }
+        ASSERT_NEAR(sum, 1.0, 1e-3);
+    }
+}
+
+TEST(TestLightBVH, SampleMatchesPdf) {
+    set_device_cpu();
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    auto lights = random_lights(rng, 200, false);
+    std::vector<float> power(lights.size(), 1.0f);
+    LightBVH<C> bvh(default_resource(), lights.data(), power.data(), lights.size());
+    std::uniform_real_distribution<float> u01(0.0f, 1.0f);
+    for (int trial = 0; trial < 256; trial++) {
+        auto p = Float3(dist(rng), dist(rng), dist(rng)) * 12.0f;
+        auto n = normalize(Float3(dist(rng), dist(rng), dist(rng)));
+        float pdf;
+        int idx = bvh.sample(u01(rng), p, n, &pdf);
+        if (idx < 0)
+            continue;
+        ASSERT_GT(pdf, 0.0f);
+        ASSERT_NEAR(pdf, bvh.pdf(idx, p, n), 1e-4f * pdf);
+    }
+}
@@ -0,0 +1,66 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <random>
+#include <akari/common/color.h>
+#include <akari/kernel/scene.h>
+#include "gtest/gtest.h"
+using namespace akari;
+
+using C = Config<float, Color<float, 3>>;
+AKR_IMPORT_TYPES()
+
+TEST(TestMaterial, FlattenedMixMatchesTree) {
+    // mix(image 0.3: mix(0.25: d0, d1), d2), so d0, d1 and d2 are picked with 0.7 * 0.75, 0.7 * 0.25 and 0.3
+    RGBAImage pixel(int2(1));
+    pixel(0, 0) = RGBA(float3(0.3f), 1.0f);
+    PackedImage packed(pixel, TexelFormat::R32F);
+    auto view = packed.view();
+    Texture<C> image_fraction{ImageTexture<C>(&view, 1)};
+    Texture<C> constant_fraction(ConstantTexture<C>(Spectrum(0.25f)));
+    Texture<C> white(ConstantTexture<C>(Spectrum(1.0f)));
+    Material<C> leaves[3] = {DiffuseMaterial<C>(&white), DiffuseMaterial<C>(&white), DiffuseMaterial<C>(&white)};
+    MixTable<C> inner(&constant_fraction, &leaves[0], &leaves[1]);
+    Material<C> inner_mix{MixMaterial<C>(&inner)};
+    MixTable<C> outer(&image_fraction, &inner_mix, &leaves[2]);
+    Material<C> root{MixMaterial<C>(&outer)};
+    ASSERT_EQ(outer.n_leaves, 3);
+    ASSERT_EQ(outer.n_fractions, 1);
+
+    const double expected[3] = {0.7 * 0.75, 0.7 * 0.25, 0.3};
+    int counts[3] = {};
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const int n = 100000;
+    for (int i = 0; i < n; i++) {
+        Float u = dist(rng);
+        auto [leaf, inv_prob] = root.select_material(u, float2(0.5f));
+        int idx = int(leaf - leaves);
+        ASSERT_TRUE(idx >= 0 && idx < 3);
+        ASSERT_NEAR(inv_prob, 1.0 / expected[idx], 1e-3);
+        ASSERT_TRUE(u >= 0.0f && u < 1.0f);
+        counts[idx]++;
+    }
+    for (int i = 0; i < 3; i++) {
+        ASSERT_NEAR(double(counts[i]) / n, expected[i], 0.01);
+    }
+}
@@ -0,0 +1,161 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <akari/core/options.h>
+#include <akari/core/parallel.h>
+#include "gtest/gtest.h"
+using namespace akari;
+
+TEST(TestParallel, ReduceMatchesSerialSum) {
+    const size_t n = 1000003;
+    auto sum = parallel_reduce(
+        size_t(0), n, 4096, uint64_t(0),
+        [](Range r) {
+            uint64_t s = 0;
+            for (auto i = r.begin; i < r.end; i++) {
+                s += i;
+            }
+            return s;
+        },
+        [](uint64_t a, uint64_t b) { return a + b; });
+    ASSERT_EQ(sum, uint64_t(n) * (n - 1) / 2);
+}
+
+TEST(TestParallel, NestedLoops) {
+    // every outer block waits on an inner loop from inside a worker
+    const int n = 64;
+    std::vector<std::atomic<int>> hits(n * n);
+    parallel_for_range(0, n, 1, [&](Range outer, uint32_t tid) {
+        ASSERT_LT(tid, num_work_threads());
+        parallel_for_range(0, n, 3, [&](Range inner, uint32_t) {
+            for (auto j = inner.begin; j < inner.end; j++) {
+                hits[outer.begin * n + j]++;
+            }
+        });
+    });
+    for (auto &h : hits) {
+        ASSERT_EQ(h.load(), 1);
+    }
+}
+
+TEST(TestParallel, FutureContinuations) {
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 16; i++) {
+        futures.emplace_back(async_do([](int x) { return x * x; }, i).then([](int x) { return x + 1; }));
+    }
+    auto all = when_all(futures).get();
+    for (int i = 0; i < 16; i++) {
+        ASSERT_EQ(all[i], i * i + 1);
+    }
+    Promise<int> never;
+    auto any = when_any(std::vector<Future<int>>{never.get_future(), async_do([] { return 1; })});
+    ASSERT_EQ(any.get(), 1u);
+    auto failed = async_do([]() -> int { throw std::runtime_error("failed"); }).then([](int x) { return x; });
+    ASSERT_THROW(when_all(std::vector<Future<int>>{failed}).get(), std::runtime_error);
+}
+
+TEST(TestParallel, TidsOfRunningIterationsDiffer) {
+    std::vector<std::atomic<int>> busy(num_work_threads());
+    std::atomic_bool ok{true};
+    parallel_for(512, [&](uint32_t, uint32_t tid) {
+        if (tid >= busy.size() || busy[tid].exchange(1) != 0) {
+            ok = false;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        busy[tid] = 0;
+    });
+    ASSERT_TRUE(ok.load());
+}
+
+TEST(TestParallel, TaskGroupRethrowsFromWait) {
+    std::atomic<int> ran{0};
+    TaskGroup group;
+    for (int i = 0; i < 16; i++) {
+        group.run([&, i] {
+            ran++;
+            if (i == 5) {
+                throw std::runtime_error("failed");
+            }
+        });
+    }
+    ASSERT_THROW(group.wait(), std::runtime_error);
+    ASSERT_EQ(ran.load(), 16);
+}
+
+// runs in a fresh process, as the thread count is fixed once the pool has started
+static void exit_with_thread_count_check(int n) {
+    GlobalOptions::get()->num_threads = n;
+    std::atomic<int> running{0}, peak{0};
+    std::atomic_bool ok{num_work_threads() == size_t(n)};
+    parallel_for(256, [&](uint32_t, uint32_t tid) {
+        if (tid >= size_t(n)) {
+            ok = false;
+        }
+        int now = ++running;
+        for (int seen = peak.load(); now > seen && !peak.compare_exchange_weak(seen, now);) {
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        running--;
+    });
+    std::exit(ok && peak.load() <= n ? 0 : 1);
+}
+
+TEST(TestParallel, ThreadCountIsHonoured) {
+    ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+    for (int n : {1, 3}) {
+        EXPECT_EXIT(exit_with_thread_count_check(n), ::testing::ExitedWithCode(0), "") << n << " threads";
+    }
+}
+
+static void exit_with_budget_check() {
+    GlobalOptions::get()->num_threads = 4;
+    std::atomic<int> running{0}, peak{0};
+    std::atomic_bool ok{true};
+    {
+        ThreadBudget budget(2);
+        parallel_for(256, [&](uint32_t, uint32_t) {
+            int now = ++running;
+            for (int seen = peak.load(); now > seen && !peak.compare_exchange_weak(seen, now);) {
+            }
+            // loops nested in the job's tasks inherit its budget
+            parallel_for(4, [&](uint32_t, uint32_t) {
+                if (task_budget() != 2) {
+                    ok = false;
+                }
+            });
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            running--;
+        });
+    }
+    std::exit(ok && peak.load() <= 2 && task_budget() == 4 ? 0 : 1);
+}
+
+TEST(TestParallel, ThreadBudgetLimitsConcurrency) {
+    ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+    EXPECT_EXIT(exit_with_budget_check(), ::testing::ExitedWithCode(0), "");
+}
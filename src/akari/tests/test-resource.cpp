@@ -0,0 +1,115 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <akari/core/device.h>
+#include <akari/core/image.hpp>
+#include <akari/core/parallel.h>
+#include <akari/core/resource.h>
+#include "gtest/gtest.h"
+using namespace akari;
+
+namespace {
+    std::atomic<int> n_loads{0};
+    struct SlowResource : Resource {
+        Expected<bool> load(const fs::path &) override {
+            n_loads++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return true;
+        }
+    };
+    std::atomic_bool fail_next_load{false};
+    struct FlakyResource : Resource {
+        Expected<bool> load(const fs::path &) override {
+            if (fail_next_load.exchange(false)) {
+                return Error("flaky");
+            }
+            return true;
+        }
+    };
+} // namespace
+
+TEST(TestResource, ConcurrentLoadsShareOneResource) {
+    auto path = fs::temp_directory_path() / "akari-test-resource.txt";
+    std::ofstream(path) << "resource";
+    std::vector<Future<std::shared_ptr<SlowResource>>> loads;
+    for (int i = 0; i < 8; i++) {
+        loads.emplace_back(async_do([=] { return resource_manager()->load_path<SlowResource>(path).extract_value(); }));
+    }
+    auto resources = when_all(std::move(loads)).get();
+    fs::remove(path);
+    ASSERT_EQ(n_loads.load(), 1);
+    for (auto &r : resources) {
+        ASSERT_EQ(r, resources[0]);
+    }
+}
+
+TEST(TestResource, FailedReloadIsRetried) {
+    auto path = fs::temp_directory_path() / "akari-test-flaky.txt";
+    std::ofstream(path) << "resource";
+    auto first = resource_manager()->load_path<FlakyResource>(path).extract_value();
+    fs::last_write_time(path, fs::last_write_time(path) + std::chrono::seconds(10));
+    auto reloaded = [&] {
+        auto paths = resource_manager()->refresh();
+        return std::find(paths.begin(), paths.end(), fs::absolute(path)) != paths.end();
+    };
+    fail_next_load = true;
+    ASSERT_FALSE(reloaded());
+    ASSERT_EQ(resource_manager()->load_path<FlakyResource>(path).extract_value(), first);
+    // the file has not changed since, but the failed reload has not caught up with it yet
+    ASSERT_TRUE(reloaded());
+    ASSERT_NE(resource_manager()->load_path<FlakyResource>(path).extract_value(), first);
+    ASSERT_FALSE(reloaded());
+    fs::remove(path);
+}
+
+TEST(TestResource, ImageIsKeptOnlyWhileHeld) {
+    set_device_cpu();
+    auto path = fs::temp_directory_path() / "akari-test-image.hdr";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 1 +X 2\n";
+        const unsigned char texels[] = {128, 128, 128, 129, 128, 64, 32, 129};
+        out.write(reinterpret_cast<const char *>(texels), sizeof(texels));
+    }
+    auto resource = resource_manager()->load_path<ImageResource>(path).extract_value();
+    fs::remove(path);
+    auto image = resource->image();
+    auto texture = resource->texture();
+    ASSERT_EQ(resource->image(), image);
+    image = nullptr;
+    // the file is gone, and it would not be read again anyway
+    ASSERT_THROW(resource->image(), std::runtime_error);
+    ASSERT_EQ(resource->texture(), texture);
+    int n_builds = 0;
+    auto build = [&] {
+        n_builds++;
+        return std::make_shared<int>(n_builds);
+    };
+    auto first = resource->derived<int>(0, build);
+    ASSERT_EQ(resource->derived<int>(0, build), first);
+    ASSERT_EQ(n_builds, 1);
+    ASSERT_NE(resource->derived<int>(1, build), first);
+}
@@ -0,0 +1,176 @@
+// MIT License
+//
+// Copyright (c) 2020 椎名深雪
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <fstream>
+#include <random>
+#include <akari/common/color.h>
+#include <akari/core/logger.h>
+#include <akari/core/parallel.h>
+#include <akari/kernel/scene.h>
+#include "gtest/gtest.h"
+using namespace akari;
+
+using C = Config<float, Color<float, 3>>;
+AKR_IMPORT_TYPES()
+
+// 64x64 black and white checkerboard with one texel wide squares
+static RGBAImage checkerboard() {
+    RGBAImage image(int2(64));
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            image(x, y) = RGBA(float3((x + y) % 2 == 0 ? 1.0f : 0.0f), 1.0f);
+        }
+    }
+    return image;
+}
+
+TEST(TestTexture, MipChainAverages) {
+    auto image = checkerboard();
+    auto levels = build_mip_chain(image);
+    ASSERT_EQ(levels.size(), 6u);
+    for (auto &level : levels) {
+        for (auto &texel : level.texels()) {
+            ASSERT_NEAR(texel.rgb[0], 0.5f, 1e-6f);
+        }
+    }
+    ASSERT_EQ(levels.back().resolution().x, 1);
+    ASSERT_EQ(levels.back().resolution().y, 1);
+}
+
+TEST(TestTexture, FootprintSelectsLevel) {
+    auto image = checkerboard();
+    auto levels = build_mip_chain(image);
+    std::vector<PackedImage> packed{PackedImage(image, TexelFormat::R8)};
+    for (auto &level : levels) {
+        packed.emplace_back(level, TexelFormat::R8);
+    }
+    std::vector<PackedImageView> views;
+    for (auto &level : packed) {
+        views.emplace_back(level.view());
+    }
+    ImageTexture<C> texture(views.data(), (int)views.size());
+    // a texel center sampled with no footprint returns that texel
+    auto tc = float2(0.5f / 64.0f, 1.0f - 0.5f / 64.0f);
+    ASSERT_NEAR(texture.evaluate(tc, float2(0), float2(0))[0], 1.0f, 1e-5f);
+    // a footprint several texels wide blends the checkers to grey, up to R8 quantization
+    ASSERT_NEAR(texture.evaluate(tc, float2(4.0f / 64.0f, 0), float2(0))[0], 0.5f, 1.0f / 255.0f);
+}
+
+TEST(TestTexture, PackedFormatsRoundTrip) {
+    RGBAImage image(int2(256, 1));
+    for (int x = 0; x < 256; x++) {
+        image(x, 0) = RGBA(float3(srgb8_to_linear(uint8_t(x))), float(x) / 255.0f);
+    }
+    // every 8 bit sRGB code survives encoding exactly
+    PackedImage srgb(image, TexelFormat::RGBA8_SRGB);
+    for (int x = 0; x < 256; x++) {
+        ASSERT_EQ(srgb.bytes()[4 * x], x);
+        ASSERT_EQ(srgb.bytes()[4 * x + 3], x);
+        ASSERT_EQ(srgb.view()(x, 0).rgb[1], image(x, 0).rgb[1]);
+    }
+    PackedImage half(image, TexelFormat::RGBA16F);
+    for (int x = 0; x < 256; x++) {
+        ASSERT_NEAR(half.view()(x, 0).rgb[2], image(x, 0).rgb[2], image(x, 0).rgb[2] * 1e-3f);
+        ASSERT_NEAR(half.view()(x, 0).alpha, image(x, 0).alpha, 1e-3f);
+    }
+    ASSERT_EQ(half_to_float(float_to_half(65504.0f)), 65504.0f);
+    ASSERT_EQ(half_to_float(float_to_half(std::ldexp(1.0f, -24))), std::ldexp(1.0f, -24));
+}
+
+TEST(TestTexture, BrightRadianceFileStaysFloat) {
+    // 2x1 flat RGBE: 1.0 and 195 * 2^9 = 99840, which is past the half range
+    auto path = fs::temp_directory_path() / "akari-test-bright.hdr";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 1 +X 2\n";
+        const unsigned char texels[] = {128, 128, 128, 129, 195, 195, 195, 145};
+        out.write(reinterpret_cast<const char *>(texels), sizeof(texels));
+    }
+    auto image = default_image_reader()->read(path);
+    fs::remove(path);
+    ASSERT_TRUE(image);
+    ASSERT_EQ(image->format, TexelFormat::RGBA32F);
+    PackedImage packed(*image, image->format);
+    ASSERT_EQ(packed.view()(0, 0).rgb[0], 1.0f);
+    ASSERT_EQ(packed.view()(1, 0).rgb[1], 99840.0f);
+}
+
+TEST(TestTexture, TriangleDifferentials) {
+    Triangle<C> triangle;
+    triangle.vertices[0] = Float3(0, 0, 0);
+    triangle.vertices[1] = Float3(2, 0, 0);
+    triangle.vertices[2] = Float3(0, 2, 0);
+    triangle.texcoords[0] = float2(0, 0);
+    triangle.texcoords[1] = float2(1, 0);
+    triangle.texcoords[2] = float2(0, 1);
+    SurfaceInteraction<C> si(float2(0.25f, 0.25f), triangle);
+    struct {
+        Float3 rx_o, rx_d, ry_o, ry_d;
+    } diff{Float3(0.6f, 0.5f, 1), Float3(0, 0, -1), Float3(0.5f, 0.7f, 1), Float3(0, 0, -1)};
+    si.compute_differentials(diff);
+    ASSERT_NEAR(si.dtcdx[0], 0.05f, 1e-5f);
+    ASSERT_NEAR(si.dtcdx[1], 0.0f, 1e-5f);
+    ASSERT_NEAR(si.dtcdy[0], 0.0f, 1e-5f);
+    ASSERT_NEAR(si.dtcdy[1], 0.1f, 1e-5f);
+}
+
+TEST(TestTexture, TiledTextureEvicts) {
+    RGBAImage image(int2(512, 384));
+    for (int y = 0; y < image.resolution().y; y++) {
+        for (int x = 0; x < image.resolution().x; x++) {
+            image(x, y) = RGBA(float3(float(x), float(y), float(x ^ y)), 1.0f);
+        }
+    }
+    // a name of its own, so that concurrent test runs do not share the file
+    auto path = fs::temp_directory_path() / fmt::format("akari-test-tiled-{:08x}.akt", std::random_device()());
+    write_tiled_texture(image, path);
+    // 64 slots, fewer than the texture's 71 RGBA32F tiles
+    TileCache cache(0);
+    auto levels = build_mip_chain(image);
+    {
+        auto tiled = cache.open(path);
+        ASSERT_EQ(tiled->n_levels(), (int)levels.size() + 1);
+        for (int pass = 0; pass < 2; pass++) {
+            for (int l = 0; l < tiled->n_levels(); l++) {
+                auto &ref = l == 0 ? image : levels[l - 1];
+                parallel_for_range(0, ref.resolution().y, 8, [&](Range r, uint32_t) {
+                    for (int y = (int)r.begin; y < (int)r.end; y++) {
+                        for (int x = 0; x < ref.resolution().x; x++) {
+                            ASSERT_EQ(tiled->texel(l, x, y).rgb[2], ref(x, y).rgb[2]);
+                        }
+                    }
+                });
+            }
+        }
+        // a footprint across the corner of four tiles
+        int2 p[4] = {int2(63, 63), int2(64, 63), int2(63, 64), int2(64, 64)};
+        RGBA t[4];
+        tiled->texels(0, p, 4, t);
+        for (int i = 0; i < 4; i++) {
+            ASSERT_EQ(t[i].rgb[2], image(p[i]).rgb[2]);
+        }
+    }
+    fs::remove(path);
+    auto stats = cache.stats();
+    ASSERT_GT(stats.hits, stats.misses);
+    ASSERT_GT(stats.evictions, 0u);
+}